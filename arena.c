@@ -0,0 +1,79 @@
+#include "arena.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+ArenaBlock *new_arena_block(size_t capacity) {
+    ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + capacity);
+    assertNotNull(block);
+    block->next = NULL;
+    block->capacity = capacity;
+    block->used = 0;
+    return block;
+}
+
+Arena *new_arena(size_t block_size) {
+    Arena *arena = (Arena *)malloc(sizeof(Arena));
+    assertNotNull(arena);
+    arena->block_size = block_size;
+    arena->first = new_arena_block(block_size);
+    arena->current = arena->first;
+    return arena;
+}
+
+void free_arena(Arena **arena) {
+    if (arena == NULL || *arena == NULL) {
+        return;
+    }
+    ArenaBlock *block = (*arena)->first;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    safe_free((void **)arena);
+}
+
+// Blocks past the first are reused lazily: their `used` counter is cleared
+// when arena_alloc advances into them.
+void arena_reset(Arena *arena) {
+    assertNotNull(arena);
+    arena->current = arena->first;
+    arena->first->used = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    if (arena == NULL) {
+        return malloc(size);
+    }
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    ArenaBlock *block = arena->current;
+    while (block->used + size > block->capacity) {
+        ArenaBlock *next = block->next;
+        if (next == NULL || next->capacity < size) {
+            ArenaBlock *fresh = new_arena_block(
+                size > arena->block_size ? size : arena->block_size);
+            fresh->next = next;
+            block->next = fresh;
+            next = fresh;
+        }
+        block = next;
+        block->used = 0;
+    }
+    arena->current = block;
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size,
+                    size_t new_size) {
+    if (arena == NULL) {
+        return realloc(ptr, new_size);
+    }
+    void *out = arena_alloc(arena, new_size);
+    if (ptr != NULL) {
+        memcpy(out, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return out;
+}
@@ -0,0 +1,33 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 4096
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+} ArenaBlock;
+
+// Bump allocator owning all lexer, parser and AST memory for one input.
+// Blocks are kept across resets, so a reset is O(1) and steady-state
+// evaluation does not touch malloc at all.
+typedef struct {
+    ArenaBlock *first;
+    ArenaBlock *current;
+    size_t block_size;
+} Arena;
+
+ArenaBlock *new_arena_block(size_t capacity);
+Arena *new_arena(size_t block_size);
+void free_arena(Arena **arena);
+void arena_reset(Arena *arena);
+// Both fall back to the heap (malloc/realloc) when arena is NULL.
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+#endif
@@ -2,32 +2,99 @@
 #include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+// Infix operator for a token type, -1 if the token is not an operator.
+Operator token_operator(TokenType type) {
+    switch (type) {
+    case PLUS:
+        return ADD;
+    case MINUS:
+        return SUBTRACT;
+    case ASTERISK:
+        return MULTIPLY;
+    case SLASH:
+        return DIVIDE;
+    case CARET:
+        return POWER;
+    default:
+        return -1;
+    }
+}
+
+Expression *new_expression(Arena *arena, ExpressionType type) {
+    Expression *expr = (Expression *)arena_alloc(arena, sizeof(Expression));
+    assertNotNull(expr);
+    expr->type = type;
+    expr->in_arena = arena != NULL;
+    expr->depends_on_i = 0;
+    expr->slot = -1;
+    expr->depth = 1;
+    expr->nesting = 1;
+    expr->refs = 0;
+    expr->shared = NULL;
+    return expr;
+}
+
+// Number literal that does not come from the input, e.g. a folded constant.
+Expression *new_number_literal(Arena *arena, double value) {
+    NumberLiteral *literal =
+        (NumberLiteral *)arena_alloc(arena, sizeof(NumberLiteral));
+    assertNotNull(literal);
+    literal->token = new_token(NUMBER, 0, 0);
+    literal->value = value;
+
+    Expression *expr = new_expression(arena, NUMBER_LITERAL);
+    expr->expression.number_literal = literal;
+    return expr;
+}
+
+// Walks the tree with an explicit stack, so any depth can be freed. Nodes
+// in an arena are left to arena_reset.
 void free_expression(Expression **expression) {
     if (expression == NULL || *expression == NULL) {
         return;
     }
-    Expression *expr = *expression;
-    switch (expr->type) {
-    case NUMBER_LITERAL:
-        free_number_literal(&expr->expression.number_literal);
-        break;
-    case IDENTIFIER:
-        free_identifier(&expr->expression.identifier);
-        break;
-    case PREFIX_EXPRESSION:
-        free_prefix_expression(&expr->expression.prefix_expression);
-        break;
-    case INFIX_EXPRESSION:
-        free_infix_expression(&expr->expression.infix_expression);
-        break;
-    case CALL_EXPRESSION:
-        free_call_expression(&expr->expression.call_expression);
-        break;
-    default:
-        break;
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, *expression);
+    *expression = NULL;
+    while (s.num_frames > 0) {
+        Expression *expr = s.frames[--s.num_frames].expr;
+        if (expr == NULL || expr->in_arena) {
+            continue;
+        }
+        for (int k = 0; k < expression_num_children(expr); k++) {
+            expression_stack_push(&s, expression_child(expr, k));
+        }
+        safe_free((void **)&expr->shared);
+        switch (expr->type) {
+        case NUMBER_LITERAL:
+            free_number_literal(&expr->expression.number_literal);
+            break;
+        case IDENTIFIER:
+            free_identifier(&expr->expression.identifier);
+            break;
+        case PREFIX_EXPRESSION:
+            safe_free((void **)&expr->expression.prefix_expression);
+            break;
+        case INFIX_EXPRESSION:
+            safe_free((void **)&expr->expression.infix_expression);
+            break;
+        case CALL_EXPRESSION: {
+            CallExpression *call = expr->expression.call_expression;
+            expression_stack_push(&s, call->function);
+            safe_free((void **)&call->arguments);
+            safe_free((void **)&call->invariants);
+            safe_free((void **)&expr->expression.call_expression);
+            break;
+        }
+        default:
+            break;
+        }
+        safe_free((void **)&expr);
     }
-    safe_free((void **)&expr);
+    free_expression_stack(&s);
 }
 
 void free_number_literal(NumberLiteral **expression) {
@@ -35,7 +102,6 @@ void free_number_literal(NumberLiteral **expression) {
         return;
     }
     NumberLiteral *expr = *expression;
-    free_token(&expr->token);
     safe_free((void **)&expr);
 }
 
@@ -44,7 +110,6 @@ void free_identifier(Identifier **expression) {
         return;
     }
     Identifier *expr = *expression;
-    free_token(&expr->token);
     safe_free((void **)&expr);
 }
 
@@ -54,7 +119,6 @@ void free_prefix_expression(PrefixExpression **expression) {
     }
     PrefixExpression *expr = *expression;
     free_expression(&expr->right);
-    free_token(&expr->token);
     safe_free((void **)&expr);
 }
 
@@ -65,7 +129,6 @@ void free_infix_expression(InfixExpression **expression) {
     InfixExpression *expr = *expression;
     free_expression(&expr->left);
     free_expression(&expr->right);
-    free_token(&expr->token);
     safe_free((void **)&expr);
 }
 
@@ -74,51 +137,142 @@ void free_call_expression(CallExpression **expression) {
         return;
     }
     CallExpression *expr = *expression;
-    free_token(&expr->token);
     free_expression(&expr->function);
     for (int i = 0; i < expr->num_arguments; i++) {
         free_expression(&expr->arguments[i]);
     }
     safe_free((void **)&expr->arguments);
+    safe_free((void **)&expr->invariants);
     safe_free((void **)&expr);
 }
 
 void print_expression(FILE *out, Expression *expr) {
     assertNotNull(out);
     assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        print_expression_step(out, f->expr, f->step);
+        if (f->step == expression_num_children(f->expr)) {
+            s.num_frames--;
+            continue;
+        }
+        expression_stack_push(&s, expression_child(f->expr, f->step++));
+    }
+    free_expression_stack(&s);
+}
+
+// Prints the text of expr that comes before its child number step, or after
+// its last child when step is the number of children.
+void print_expression_step(FILE *out, Expression *expr, int step) {
+    int last = expression_num_children(expr);
     switch (expr->type) {
     case NUMBER_LITERAL:
         fprintf(out, "%g", expr->expression.number_literal->value);
         break;
     case IDENTIFIER:
-        fprintf(out, "%s", expr->expression.identifier->value);
+        fprintf(out, "%.*s", (int)expr->expression.identifier->length,
+                expr->expression.identifier->value);
         break;
     case PREFIX_EXPRESSION:
-        fprintf(out, "(%s", expr->expression.prefix_expression->op);
-        print_expression(out, expr->expression.prefix_expression->right);
-        fprintf(out, ")");
+        if (step == 0) {
+            fprintf(out, "(%.*s",
+                    (int)expr->expression.prefix_expression->token.length,
+                    expr->expression.prefix_expression->op);
+        } else {
+            fprintf(out, ")");
+        }
         break;
     case INFIX_EXPRESSION:
-        fprintf(out, "(");
-        print_expression(out, expr->expression.infix_expression->left);
-        fprintf(out, " %s ", expr->expression.infix_expression->op);
-        print_expression(out, expr->expression.infix_expression->right);
-        fprintf(out, ")");
+        if (step == 1) {
+            fprintf(out, " %.*s ",
+                    (int)expr->expression.infix_expression->token.length,
+                    expr->expression.infix_expression->op);
+        } else {
+            fprintf(out, step == 0 ? "(" : ")");
+        }
         break;
     case CALL_EXPRESSION:
-        print_expression(out, expr->expression.call_expression->function);
-        fprintf(out, "(");
-        for (int i = 0; i < expr->expression.call_expression->num_arguments;
-             i++) {
-            print_expression(out,
-                             expr->expression.call_expression->arguments[i]);
-            if (i < expr->expression.call_expression->num_arguments - 1) {
-                fprintf(out, ", ");
-            }
+        if (step == 0) {
+            print_expression_step(
+                out, expr->expression.call_expression->function, 0);
+            fprintf(out, "(");
+        } else if (step < last) {
+            fprintf(out, ", ");
+        }
+        if (step == last) {
+            fprintf(out, ")");
         }
-        fprintf(out, ")");
         break;
     default:
         break;
     }
 }
+
+// Operands of expr in evaluation order; a call's function is not one.
+int expression_num_children(Expression *expr) {
+    switch (expr->type) {
+    case PREFIX_EXPRESSION:
+        return 1;
+    case INFIX_EXPRESSION:
+        return 2;
+    case CALL_EXPRESSION:
+        return expr->expression.call_expression->num_arguments;
+    default:
+        return 0;
+    }
+}
+
+Expression *expression_child(Expression *expr, int k) {
+    Expression **child = expression_child_slot(expr, k);
+    return child != NULL ? *child : NULL;
+}
+
+// Where operand k of expr is stored, for walks that replace it.
+Expression **expression_child_slot(Expression *expr, int k) {
+    switch (expr->type) {
+    case PREFIX_EXPRESSION:
+        return &expr->expression.prefix_expression->right;
+    case INFIX_EXPRESSION:
+        return k == 0 ? &expr->expression.infix_expression->left
+                      : &expr->expression.infix_expression->right;
+    case CALL_EXPRESSION:
+        return &expr->expression.call_expression->arguments[k];
+    default:
+        return NULL;
+    }
+}
+
+void init_expression_stack(ExpressionStack *s) {
+    assertNotNull(s);
+    s->frames = s->small;
+    s->num_frames = 0;
+    s->capacity = EXPRESSION_STACK_SIZE;
+}
+
+void expression_stack_push(ExpressionStack *s, Expression *expr) {
+    if (s->num_frames == s->capacity) {
+        size_t size = s->capacity * sizeof(ExpressionFrame);
+        ExpressionFrame *frames = (ExpressionFrame *)(
+            s->frames == s->small ? malloc(2 * size)
+                                  : realloc(s->frames, 2 * size));
+        assertNotNull(frames);
+        if (s->frames == s->small) {
+            memcpy(frames, s->small, size);
+        }
+        s->frames = frames;
+        s->capacity *= 2;
+    }
+    s->frames[s->num_frames].expr = expr;
+    s->frames[s->num_frames].step = 0;
+    s->frames[s->num_frames].data = NULL;
+    s->num_frames++;
+}
+
+void free_expression_stack(ExpressionStack *s) {
+    if (s->frames != s->small) {
+        safe_free((void **)&s->frames);
+    }
+}
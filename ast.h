@@ -1,41 +1,54 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
+#include "keyword.h"
 #include "token.h"
 #include <stddef.h>
 #include <stdio.h>
 
 struct Expression;
 
+typedef enum { ADD, SUBTRACT, MULTIPLY, DIVIDE, POWER, NEGATE } Operator;
+
 typedef struct {
-    Token *token;
+    Token token;
     double value;
 } NumberLiteral;
 
 typedef struct {
-    Token *token;
-    char *value;
+    Token token;
+    char *value; // slice of the input, not NUL-terminated
     size_t length;
+    KeywordType keyword; // resolved at parse time, -1 if unknown
 } Identifier;
 
 typedef struct {
-    Token *token; // operator token
-    char *op;     // operator
+    Token token; // operator token
+    char *op;    // operator
+    Operator operation;
     struct Expression *right;
 } PrefixExpression;
 
 typedef struct {
-    Token *token; // operator token
+    Token token; // operator token
     struct Expression *left;
     char *op; // operator
+    Operator operation;
     struct Expression *right;
 } InfixExpression;
 
 typedef struct {
-    Token *token;                // '(' token
+    Token token;                 // '(' token
     struct Expression *function; // identifier
     struct Expression **arguments;
     int num_arguments;
+    KeywordType keyword; // resolved at parse time, -1 if unknown
+    // sum() only: loop invariants of the body, evaluated once before the
+    // loop into their env_vars slots (see hoist_invariants)
+    struct Expression **invariants;
+    int num_invariants;
+    struct ClosedForm *closed_form; // sum() only: see find_closed_forms
 } CallExpression;
 
 typedef enum {
@@ -46,6 +59,16 @@ typedef enum {
     CALL_EXPRESSION
 } ExpressionType;
 
+// What evaluating a common subexpression leaves for its other parents.
+// hash_cons gives one to each shared node only, so every other node stays
+// small.
+typedef struct {
+    int temp;               // compiler temporary holding the value
+    const void *temp_scope; // Program that temp belongs to
+    double memo;            // tree walker's value for memo_epoch
+    unsigned long memo_epoch;
+} SharedNode;
+
 // Expression node tagged union
 typedef struct Expression {
     union {
@@ -55,9 +78,40 @@ typedef struct Expression {
         InfixExpression *infix_expression;
         CallExpression *call_expression;
     } expression;
+    SharedNode *shared; // common subexpression, see hash_cons, or NULL
     ExpressionType type;
+    int slot;    // env_vars slot of a named variable or a hoisted
+                 // invariant, or -1
+    int depth;   // height of the tree as parsed, 1 for a leaf
+    int nesting; // levels -d counts: like depth, but the left operand of an
+                 // infix is not a level below it
+    int refs;    // parents in the DAG, 0 before hash-consing
+    unsigned char in_arena;     // node and children are owned by an Arena
+    unsigned char depends_on_i; // value changes with the innermost sum
+                                // iterator
 } Expression;
 
+#define EXPRESSION_STACK_SIZE 64
+
+typedef struct {
+    Expression *expr;
+    int step;   // children visited so far
+    void *data; // state a walk keeps per node, NULL when pushed
+} ExpressionFrame;
+
+// Explicit stack for walking trees too deep for the C stack. The first
+// EXPRESSION_STACK_SIZE frames are kept in the struct itself, so shallow
+// walks from a local stack do not allocate.
+typedef struct {
+    ExpressionFrame *frames;
+    size_t num_frames;
+    size_t capacity;
+    ExpressionFrame small[EXPRESSION_STACK_SIZE];
+} ExpressionStack;
+
+Operator token_operator(TokenType type);
+Expression *new_expression(Arena *arena, ExpressionType type);
+Expression *new_number_literal(Arena *arena, double value);
 void free_expression(Expression **expression);
 void free_number_literal(NumberLiteral **expression);
 void free_identifier(Identifier **expression);
@@ -65,5 +119,12 @@ void free_prefix_expression(PrefixExpression **expression);
 void free_infix_expression(InfixExpression **expression);
 void free_call_expression(CallExpression **expression);
 void print_expression(FILE *out, Expression *expr);
+void print_expression_step(FILE *out, Expression *expr, int step);
+int expression_num_children(Expression *expr);
+Expression *expression_child(Expression *expr, int k);
+Expression **expression_child_slot(Expression *expr, int k);
+void init_expression_stack(ExpressionStack *s);
+void expression_stack_push(ExpressionStack *s, Expression *expr);
+void free_expression_stack(ExpressionStack *s);
 
 #endif
@@ -0,0 +1,306 @@
+#include "batch.h"
+#include "compiler.h"
+#include "evaluator.h"
+#include "util.h"
+#include "vecmath.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#else
+#define BATCH_X86 0
+#endif
+
+void scalar_add(double *a, const double *b) {
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        a[k] += b[k];
+    }
+}
+
+void scalar_sub(double *a, const double *b) {
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        a[k] -= b[k];
+    }
+}
+
+void scalar_mul(double *a, const double *b) {
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        a[k] *= b[k];
+    }
+}
+
+void scalar_div(double *a, const double *b) {
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        a[k] /= b[k];
+    }
+}
+
+void scalar_neg(double *a) {
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        a[k] = -a[k];
+    }
+}
+
+void scalar_sqrt(double *a) {
+    for (int k = 0; k < BATCH_SIZE; k++) {
+        a[k] = sqrt(a[k]);
+    }
+}
+
+BatchKernels batch_kernels = {"scalar",   scalar_add, scalar_sub, scalar_mul,
+                              scalar_div, scalar_neg, scalar_sqrt};
+
+#if BATCH_X86
+#define SSE2_BINARY(name, intrinsic)                                           \
+    void sse2_##name(double *a, const double *b) {                             \
+        for (int k = 0; k < BATCH_SIZE; k += 2) {                              \
+            _mm_storeu_pd(a + k, intrinsic(_mm_loadu_pd(a + k),                \
+                                           _mm_loadu_pd(b + k)));              \
+        }                                                                      \
+    }
+
+#define AVX2_BINARY(name, intrinsic)                                           \
+    __attribute__((target("avx2"))) void avx2_##name(double *a,                \
+                                                     const double *b) {        \
+        for (int k = 0; k < BATCH_SIZE; k += 4) {                              \
+            _mm256_storeu_pd(a + k, intrinsic(_mm256_loadu_pd(a + k),          \
+                                              _mm256_loadu_pd(b + k)));        \
+        }                                                                      \
+    }
+
+SSE2_BINARY(add, _mm_add_pd)
+SSE2_BINARY(sub, _mm_sub_pd)
+SSE2_BINARY(mul, _mm_mul_pd)
+SSE2_BINARY(div, _mm_div_pd)
+AVX2_BINARY(add, _mm256_add_pd)
+AVX2_BINARY(sub, _mm256_sub_pd)
+AVX2_BINARY(mul, _mm256_mul_pd)
+AVX2_BINARY(div, _mm256_div_pd)
+
+void sse2_neg(double *a) {
+    __m128d sign = _mm_set1_pd(-0.0);
+    for (int k = 0; k < BATCH_SIZE; k += 2) {
+        _mm_storeu_pd(a + k, _mm_xor_pd(_mm_loadu_pd(a + k), sign));
+    }
+}
+
+void sse2_sqrt(double *a) {
+    for (int k = 0; k < BATCH_SIZE; k += 2) {
+        _mm_storeu_pd(a + k, _mm_sqrt_pd(_mm_loadu_pd(a + k)));
+    }
+}
+
+__attribute__((target("avx2"))) void avx2_neg(double *a) {
+    __m256d sign = _mm256_set1_pd(-0.0);
+    for (int k = 0; k < BATCH_SIZE; k += 4) {
+        _mm256_storeu_pd(a + k, _mm256_xor_pd(_mm256_loadu_pd(a + k), sign));
+    }
+}
+
+__attribute__((target("avx2"))) void avx2_sqrt(double *a) {
+    for (int k = 0; k < BATCH_SIZE; k += 4) {
+        _mm256_storeu_pd(a + k, _mm256_sqrt_pd(_mm256_loadu_pd(a + k)));
+    }
+}
+
+// Picks the widest kernels the CPU supports before main() runs, so the
+// table is read-only once evaluation starts.
+__attribute__((constructor)) void batch_init(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        BatchKernels avx2 = {"avx2",   avx2_add, avx2_sub, avx2_mul,
+                             avx2_div, avx2_neg, avx2_sqrt};
+        batch_kernels = avx2;
+    } else {
+        BatchKernels sse2 = {"sse2",   sse2_add, sse2_sub, sse2_mul,
+                             sse2_div, sse2_neg, sse2_sqrt};
+        batch_kernels = sse2;
+    }
+}
+#else
+void batch_init(void) {}
+#endif
+
+// Bodies with nested sums (or the stores that set them up) need the scalar
+// VM; everything else maps onto lane-wise kernels.
+int is_batchable(Program *prog) {
+    assertNotNull(prog);
+    if (prog->max_stack > BATCH_STACK_SIZE ||
+        prog->num_temps > BATCH_MAX_TEMPS) {
+        return 0;
+    }
+    for (int i = 0; i < prog->num_code; i++) {
+        if (prog->code[i].op == OP_SUM || prog->code[i].op == OP_STORE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Runs prog on BATCH_SIZE lanes at once. Each env_vars slot is either
+// broadcast to every lane or, where lanes[slot] is non-NULL, read per lane
+// from that array. Writes one result per lane to out.
+void batch_run(Program *prog, double *env_vars, const double **lanes,
+               double *out) {
+    assertNotNull(prog);
+    _Alignas(32) double stack[BATCH_STACK_SIZE][BATCH_SIZE];
+    _Alignas(32) double temps[BATCH_MAX_TEMPS][BATCH_SIZE];
+    int sp = 0; // next free vector
+    for (const Instruction *ip = prog->code;; ip++) {
+        double *a = sp >= 2 ? stack[sp - 2] : NULL; // second operand
+        double *b = sp >= 1 ? stack[sp - 1] : NULL; // top of the stack
+        switch (ip->op) {
+        case OP_CONST:
+            for (int k = 0; k < BATCH_SIZE; k++) {
+                stack[sp][k] = prog->constants[ip->arg];
+            }
+            sp++;
+            break;
+        case OP_LOAD:
+            if (lanes[ip->arg] != NULL) {
+                memcpy(stack[sp], lanes[ip->arg], sizeof(stack[sp]));
+            } else {
+                for (int k = 0; k < BATCH_SIZE; k++) {
+                    stack[sp][k] = env_vars[ip->arg];
+                }
+            }
+            sp++;
+            break;
+        case OP_TEE:
+            memcpy(temps[ip->arg], b, sizeof(temps[ip->arg]));
+            break;
+        case OP_TEMP:
+            memcpy(stack[sp], temps[ip->arg], sizeof(stack[sp]));
+            sp++;
+            break;
+        case OP_NEG:
+            batch_kernels.neg(b);
+            break;
+        case OP_ADD:
+            batch_kernels.add(a, b);
+            sp--;
+            break;
+        case OP_SUB:
+            batch_kernels.sub(a, b);
+            sp--;
+            break;
+        case OP_MUL:
+            batch_kernels.mul(a, b);
+            sp--;
+            break;
+        case OP_DIV:
+            batch_kernels.div(a, b);
+            sp--;
+            break;
+        case OP_POW:
+            if (ip[-1].op == OP_CONST && prog->constants[ip[-1].arg] == 2) {
+                batch_kernels.mul(a, a); // x^2 is exact either way
+                sp--;
+                break;
+            }
+            for (int k = 0; k < BATCH_SIZE; k++) {
+                a[k] = pow(a[k], b[k]);
+            }
+            sp--;
+            break;
+        case OP_SQRT:
+            batch_kernels.sqrt(b);
+            break;
+        case OP_ROOTN:
+            vecmath_kernels.rootn(a, b, BATCH_SIZE);
+            sp--;
+            break;
+        case OP_LOG:
+            vecmath_kernels.log(b, BATCH_SIZE);
+            break;
+        case OP_LOGN:
+            vecmath_kernels.ln(a, BATCH_SIZE);
+            vecmath_kernels.ln(b, BATCH_SIZE);
+            batch_kernels.div(a, b);
+            sp--;
+            break;
+        case OP_LN:
+            vecmath_kernels.ln(b, BATCH_SIZE);
+            break;
+        case OP_SIN:
+            vecmath_kernels.sin(b, BATCH_SIZE);
+            break;
+        case OP_COS:
+            vecmath_kernels.cos(b, BATCH_SIZE);
+            break;
+        case OP_TAN:
+            vecmath_kernels.tan(b, BATCH_SIZE);
+            break;
+        case OP_ASIN:
+            vecmath_kernels.asin(b, BATCH_SIZE);
+            break;
+        case OP_ACOS:
+            vecmath_kernels.acos(b, BATCH_SIZE);
+            break;
+        case OP_ATAN:
+            vecmath_kernels.atan(b, BATCH_SIZE);
+            break;
+        case OP_EXP:
+            vecmath_kernels.exp(b, BATCH_SIZE);
+            break;
+        case OP_RETURN:
+            memcpy(out, stack[sp - 1], sizeof(stack[sp - 1]));
+            return;
+        default:
+            // rejected by is_batchable
+            return;
+        }
+    }
+}
+
+// Sums body over [start, end] one block of consecutive iterator values at a
+// time, keeping one accumulator per lane. The lanes are combined pairwise
+// at the end, so the result only depends on the range, not on timing.
+double batch_sum(Program *body, long long start, long long end,
+                 double *env_vars) {
+    assertNotNull(body);
+    _Alignas(32) double acc[BATCH_SIZE] = {0};
+    _Alignas(32) double iterator[BATCH_SIZE];
+    _Alignas(32) double out[BATCH_SIZE];
+    const double *small[NUM_ENV_VARS + BATCH_STACK_SIZE];
+    const double **lanes = small;
+    if (body->env_size > NUM_ENV_VARS + BATCH_STACK_SIZE) {
+        lanes = (const double **)malloc(body->env_size * sizeof(double *));
+        assertNotNull(lanes);
+    }
+    for (int slot = 0; slot < body->env_size; slot++) {
+        lanes[slot] = NULL;
+    }
+    lanes[ENV_I] = iterator;
+
+    for (long long block = start; block <= end; block += BATCH_SIZE) {
+        for (int k = 0; k < BATCH_SIZE; k++) {
+            iterator[k] = (double)(block + k);
+        }
+        batch_run(body, env_vars, lanes, out);
+        if (end - block + 1 >= BATCH_SIZE) {
+            batch_kernels.add(acc, out);
+        } else {
+            for (int k = 0; k <= end - block; k++) {
+                acc[k] += out[k];
+            }
+        }
+    }
+    if (lanes != small) {
+        free(lanes);
+    }
+    return reduce_lanes(acc);
+}
+
+// Pairwise sum of BATCH_SIZE lane accumulators, overwriting them.
+double reduce_lanes(double *acc) {
+    for (int width = BATCH_SIZE / 2; width > 0; width /= 2) {
+        for (int k = 0; k < width; k++) {
+            acc[k] += acc[k + width];
+        }
+    }
+    return acc[0];
+}
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "compiler.h"
+#include "evaluator.h"
+
+#define BATCH_SIZE 64 // lanes per block, a multiple of the widest vector
+#define BATCH_STACK_SIZE 16
+#define BATCH_MAX_TEMPS 8
+
+typedef void batch_unary_fn(double *a);
+typedef void batch_binary_fn(double *a, const double *b);
+
+// Lane-wise kernels over BATCH_SIZE doubles: a[k] = a[k] op b[k]. The
+// scalar versions are always available; on x86-64 Linux they are replaced
+// at startup with SSE2 or AVX2 versions depending on the CPU.
+typedef struct {
+    const char *name;
+    batch_binary_fn *add;
+    batch_binary_fn *sub;
+    batch_binary_fn *mul;
+    batch_binary_fn *div;
+    batch_unary_fn *neg;
+    batch_unary_fn *sqrt;
+} BatchKernels;
+
+extern BatchKernels batch_kernels;
+
+void batch_init(void);
+int is_batchable(Program *prog);
+void batch_run(Program *prog, double *env_vars, const double **lanes,
+               double *out);
+double batch_sum(Program *body, long long start, long long end,
+                 double *env_vars);
+double reduce_lanes(double *acc);
+
+#endif
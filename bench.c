@@ -0,0 +1,432 @@
+#include "bench.h"
+#include "corpus.h"
+#include "cse.h"
+#include "evaluator.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "resolver.h"
+#include "util.h"
+#include "vm.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+atomic_size_t num_allocations;
+
+volatile double bench_sink; // keeps results alive
+
+void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-n tokens] [-d depth] [-b percent] [-s seed] "
+            "[-t ms] [-g [-l lines]]\n",
+            name);
+    fprintf(stderr, "  -n  largest corpus, from 10 tokens up by 10x\n");
+    fprintf(stderr, "  -d  nesting depth of calls and groups\n");
+    fprintf(stderr, "  -b  share of operands that are builtin calls, %%\n");
+    fprintf(stderr, "  -s  random seed, the same seed gives the same corpus\n");
+    fprintf(stderr, "  -t  shortest timed run of one benchmark\n");
+    fprintf(stderr, "  -g  print the corpus instead, one expression of -n "
+                    "tokens per line\n");
+}
+
+// Benchmarks lexing, parsing and evaluation on generated expressions from
+// 10 tokens up to -n, then the sum() loop, and prints the results as JSON.
+int main(int argc, char **argv) {
+    CorpusOptions opts = corpus_options;
+    size_t max_tokens = BENCH_MAX_TOKENS;
+    long long min_time_ms = BENCH_MIN_TIME_MS;
+    int generate = 0;
+    int lines = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:b:s:t:gl:")) != -1) {
+        switch (opt) {
+        case 'n':
+            max_tokens = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            opts.max_depth = atoi(optarg);
+            break;
+        case 'b':
+            opts.call_percent = atoi(optarg);
+            break;
+        case 's':
+            opts.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            min_time_ms = atoll(optarg);
+            break;
+        case 'g':
+            generate = 1;
+            break;
+        case 'l':
+            lines = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    corpus_options = opts;
+    if (generate) {
+        // input for bin/main, e.g. bin/bench -g -n 100 -l 1000 | bin/main
+        for (int k = 0; k < lines; k++) {
+            CorpusOptions line_opts = opts;
+            line_opts.num_tokens = max_tokens;
+            line_opts.seed = opts.seed + k;
+            size_t length;
+            char *text = generate_expression(&line_opts, &length, NULL);
+            fwrite(text, 1, length, stdout);
+            fputc('\n', stdout);
+            free(text);
+        }
+        return 0;
+    }
+
+    BenchReport r = {stdout, min_time_ms * 1000000, 0};
+    fprintf(r.out,
+            "{\n  \"seed\": %llu,\n  \"max_depth\": %d,\n"
+            "  \"call_percent\": %d,\n  \"sum_percent\": %d,\n"
+            "  \"benchmarks\": [\n",
+            opts.seed, opts.max_depth, opts.call_percent, opts.sum_percent);
+    bench_sizes(&r, max_tokens);
+    bench_sums(&r);
+    bench_math(&r);
+    fprintf(r.out, "\n  ]\n}\n");
+    return 0;
+}
+
+void bench_sizes(BenchReport *r, size_t max_tokens) {
+    for (size_t n = 10; n <= max_tokens; n *= 10) {
+        CorpusOptions opts = corpus_options;
+        opts.num_tokens = n;
+        BenchCase c;
+        size_t length;
+        char *text = generate_expression(&opts, &length, NULL);
+        if (!prepare_case(&c, text, length)) {
+            fprintf(stderr, "Error: Generated an invalid expression.\n");
+            free(text);
+            continue;
+        }
+        run_benchmark(r, "lex", bench_lex, &c, 0);
+        run_benchmark(r, "parse", bench_parse, &c, 0);
+        run_benchmark(r, "eval", bench_eval, &c, 0);
+        run_benchmark(r, "vm", bench_vm, &c, 0);
+        run_benchmark(r, "flat", bench_flat, &c, 0);
+        free_case(&c);
+        free(text);
+    }
+}
+
+// sum(1, BENCH_SUM_ITERATIONS, BENCH_SUM_BODY) on the tree walker, the VM,
+// native code and the flat tree. The body is fixed rather than generated:
+// one that happens not to read i is hoisted out of the loop by all but the
+// flat tree, and builtin calls are left to the batch VM by native code.
+void bench_sums(BenchReport *r) {
+    char text[64];
+    size_t length = snprintf(text, sizeof(text), "sum(1, %d, %s)",
+                             BENCH_SUM_ITERATIONS, BENCH_SUM_BODY);
+    BenchCase c;
+    if (!prepare_case(&c, text, length)) {
+        fprintf(stderr, "Error: Invalid sum() benchmark.\n");
+    } else {
+        long long threshold = jit_options.threshold;
+        run_benchmark(r, "sum_eval", bench_eval, &c, BENCH_SUM_ITERATIONS);
+        jit_options.threshold = -1;
+        run_benchmark(r, "sum_vm", bench_vm, &c, BENCH_SUM_ITERATIONS);
+        jit_options.threshold = 0;
+        if (c.prog->num_bodies == 1 && jit_ready(c.prog->bodies[0])) {
+            run_benchmark(r, "sum_jit", bench_vm, &c, BENCH_SUM_ITERATIONS);
+        } else {
+            fprintf(stderr, "Error: No native code for the sum() body, "
+                            "sum_jit skipped.\n");
+        }
+        run_benchmark(r, "sum_flat", bench_flat, &c, BENCH_SUM_ITERATIONS);
+        jit_options.threshold = threshold;
+        free_case(&c);
+    }
+}
+
+// Dense sweeps of the batch VM's transcendental kernels: the largest error
+// in ULP against libm and the time per value of both.
+void bench_math(BenchReport *r) {
+    const VecMathKernels *k = &vecmath_kernels;
+    const MathSweep sweeps[] = {
+        {"sin", k->sin, sin, NULL, NULL, -10, 10, 1, 0},
+        {"sin", k->sin, sin, NULL, NULL, -VECMATH_TRIG_MAX, VECMATH_TRIG_MAX,
+         1, 0},
+        {"cos", k->cos, cos, NULL, NULL, -10, 10, 1, 0},
+        {"cos", k->cos, cos, NULL, NULL, -VECMATH_TRIG_MAX, VECMATH_TRIG_MAX,
+         1, 0},
+        {"tan", k->tan, tan, NULL, NULL, -10, 10, 2, 0},
+        {"tan", k->tan, tan, NULL, NULL, -VECMATH_TRIG_MAX, VECMATH_TRIG_MAX,
+         2, 0},
+        {"sin", k->sin, sin, NULL, NULL, -VECMATH_TRIG_MAX, VECMATH_TRIG_MAX,
+         1, 1},
+        {"cos", k->cos, cos, NULL, NULL, -VECMATH_TRIG_MAX, VECMATH_TRIG_MAX,
+         1, 1},
+        {"tan", k->tan, tan, NULL, NULL, -VECMATH_TRIG_MAX, VECMATH_TRIG_MAX,
+         2, 1},
+        {"asin", k->asin, asin, NULL, NULL, -1, 1, 1, 0},
+        {"acos", k->acos, acos, NULL, NULL, -1, 1, 1, 0},
+        {"atan", k->atan, atan, NULL, NULL, -100, 100, 1, 0},
+        {"ln", k->ln, log, NULL, NULL, 0, 4, 1, 0},
+        {"ln", k->ln, log, NULL, NULL, 0, 1e300, 1, 0},
+        {"log", k->log, vecmath_ref_log, NULL, NULL, 0, 1e6, 2, 0},
+        {"exp", k->exp, vecmath_ref_exp, NULL, NULL, -VECMATH_EXP_MAX,
+         VECMATH_EXP_MAX, 1, 0},
+        {"rootn", NULL, NULL, k->rootn, vecmath_ref_rootn, 0, 1e6, 1, 0},
+    };
+    double *in = (double *)malloc(BENCH_MATH_VALUES * sizeof(double));
+    double *out = (double *)malloc(BENCH_MATH_VALUES * sizeof(double));
+    double *second = (double *)malloc(BENCH_MATH_VALUES * sizeof(double));
+    assertNotNull(in);
+    assertNotNull(out);
+    assertNotNull(second);
+    for (size_t n = 0; n < sizeof(sweeps) / sizeof(sweeps[0]); n++) {
+        run_sweep(r, &sweeps[n], in, out, second);
+    }
+    free(in);
+    free(out);
+    free(second);
+}
+
+void run_sweep(BenchReport *r, const MathSweep *s, double *in, double *out,
+               double *second) {
+    double step = (s->max - s->min) / (BENCH_MATH_VALUES - 1);
+    for (long long k = 0; k < BENCH_MATH_VALUES; k++) {
+        in[k] = s->min + k * step;
+        second[k] = 2 + k % 7;
+    }
+    if (s->near_pio2) {
+        long long groups = BENCH_MATH_VALUES / BENCH_PIO2_NEIGHBOURS;
+        double first = ceil(s->min / M_PI_2);
+        double multiples = floor(s->max / M_PI_2) - first + 1;
+        for (long long g = 0; g < groups; g++) {
+            // the nearest double to m pi/2, or one ULP off
+            double m = first + floor(g * (multiples / groups));
+            double x = (double)(m * 1.57079632679489661923132169163975144L);
+            for (int j = 0; j < BENCH_PIO2_NEIGHBOURS / 2; j++) {
+                x = nextafter(x, -INFINITY);
+            }
+            for (int j = 0; j < BENCH_PIO2_NEIGHBOURS; j++) {
+                in[g * BENCH_PIO2_NEIGHBOURS + j] = x;
+                x = nextafter(x, INFINITY);
+            }
+        }
+    }
+    size_t bytes = BENCH_MATH_VALUES * sizeof(double);
+    long long max_ulp = 0;
+    double worst = s->min;
+    memcpy(out, in, bytes);
+    if (s->fn != NULL) {
+        s->fn(out, BENCH_MATH_VALUES);
+    } else {
+        s->fn2(out, second, BENCH_MATH_VALUES);
+    }
+    for (long long k = 0; k < BENCH_MATH_VALUES; k++) {
+        double ref = s->ref != NULL ? s->ref(in[k]) : s->ref2(in[k], second[k]);
+        long long ulp = ulp_distance(out[k], ref);
+        if (ulp > max_ulp) {
+            max_ulp = ulp;
+            worst = in[k];
+        }
+    }
+    if (max_ulp > s->max_ulp) {
+        fprintf(stderr, "Error: %s(%.17g) is %lld ULP from libm.\n", s->name,
+                worst, max_ulp);
+    }
+
+    // one pass each, repeated until the kernels have run long enough
+    long long passes = 0;
+    long long start = now_ns();
+    long long elapsed;
+    do {
+        memcpy(out, in, bytes);
+        if (s->fn != NULL) {
+            s->fn(out, BENCH_MATH_VALUES);
+        } else {
+            s->fn2(out, second, BENCH_MATH_VALUES);
+        }
+        passes++;
+        elapsed = now_ns() - start;
+    } while (elapsed < r->min_time_ns);
+    double kernel_ns = (double)elapsed / passes / BENCH_MATH_VALUES;
+    passes = 0;
+    start = now_ns();
+    do {
+        for (long long k = 0; k < BENCH_MATH_VALUES; k++) {
+            out[k] = s->ref != NULL ? s->ref(in[k])
+                                    : s->ref2(in[k], second[k]);
+        }
+        passes++;
+        elapsed = now_ns() - start;
+    } while (elapsed < r->min_time_ns);
+    double libm_ns = (double)elapsed / passes / BENCH_MATH_VALUES;
+    bench_sink = out[BENCH_MATH_VALUES / 2];
+
+    fprintf(r->out,
+            "%s    {\"name\": \"math_%s\", \"kernels\": \"%s\", "
+            "\"min\": %g, \"max\": %g, \"inputs\": \"%s\", "
+            "\"values\": %d, "
+            "\"max_ulp\": %lld, \"ns_per_value\": %.2f, "
+            "\"libm_ns_per_value\": %.2f}",
+            r->num_results++ > 0 ? ",\n" : "", s->name, vecmath_kernels.name,
+            s->min, s->max, s->near_pio2 ? "near k pi/2" : "even",
+            BENCH_MATH_VALUES, max_ulp, kernel_ns, libm_ns);
+    fflush(r->out);
+}
+
+// Representable doubles between x and y, 0 when both are the same NaN
+// class, LLONG_MAX when only one of them is NaN.
+long long ulp_distance(double x, double y) {
+    if (isnan(x) || isnan(y)) {
+        return isnan(x) && isnan(y) ? 0 : LLONG_MAX;
+    }
+    int64_t a = (int64_t)vecmath_bits(x);
+    int64_t b = (int64_t)vecmath_bits(y);
+    // order negative values below positive ones, with -0 == +0
+    a = a < 0 ? INT64_MIN - a : a;
+    b = b < 0 ? INT64_MIN - b : b;
+    return a > b ? a - b : b - a;
+}
+
+// Builds the tree and program the same way the REPL does, then sets up a
+// buffered parser on input for the lex and parse benchmarks.
+int prepare_case(BenchCase *c, char *input, size_t length) {
+    assertNotNull(c);
+    memset(c, 0, sizeof(BenchCase));
+    c->input = input;
+    c->length = length;
+    c->tree_arena = new_arena(ARENA_BLOCK_SIZE);
+    init_flat_tree(&c->flat);
+    Lexer l;
+    Parser p;
+    init_lexer(&l, c->tree_arena, input, length);
+    init_buffered_parser(&p, &l);
+    c->expr = parse_expression_statement(&p);
+    if (c->expr == NULL || !resolve_expression(c->expr) ||
+        !flat_from_expression(&c->flat, c->expr)) {
+        free_flat_tree(&c->flat);
+        free_arena(&c->tree_arena);
+        return 0;
+    }
+    int num_slots = hoist_invariants(c->expr, NUM_ENV_VARS, c->tree_arena);
+    c->expr = hash_cons(c->expr, c->tree_arena);
+    c->env_vars = (double *)calloc(NUM_ENV_VARS + num_slots, sizeof(double));
+    assertNotNull(c->env_vars);
+    c->prog = compile(c->expr);
+    assertNotNull(c->prog);
+
+    c->arena = new_arena(ARENA_BLOCK_SIZE);
+    init_lexer(&c->l, c->arena, input, length);
+    init_buffered_parser(&c->p, &c->l);
+    c->num_tokens = c->p.tokens.num_tokens - 1; // without TOKEN_EOF
+    return 1;
+}
+
+void free_case(BenchCase *c) {
+    assertNotNull(c);
+    free_program(&c->prog);
+    free_flat_tree(&c->flat);
+    safe_free((void **)&c->env_vars);
+    free_arena(&c->arena);
+    free_arena(&c->tree_arena);
+}
+
+// Runs fn until one batch of calls takes at least r->min_time_ns and
+// reports that batch. iterations > 0 marks a sum() benchmark, whose time
+// is also given per iteration.
+void run_benchmark(BenchReport *r, const char *name, bench_fn *fn,
+                   BenchCase *c, long long iterations) {
+    fn(c); // warm up caches, arena blocks and lazily compiled code
+    long long ops = 1;
+    long long elapsed;
+    size_t allocations;
+    while (1) {
+        size_t before = atomic_load(&num_allocations);
+        long long start = now_ns();
+        for (long long k = 0; k < ops; k++) {
+            fn(c);
+        }
+        elapsed = now_ns() - start;
+        allocations = atomic_load(&num_allocations) - before;
+        if (elapsed >= r->min_time_ns) {
+            break;
+        }
+        // aim past the minimum, growing at most 100x per round
+        long long next = elapsed > 0 ? ops * 1.2 * r->min_time_ns / elapsed
+                                     : ops * 100;
+        ops = next > ops * 100 ? ops * 100 : next + 1;
+    }
+
+    double ns_per_op = (double)elapsed / ops;
+    fprintf(r->out, "%s    {\"name\": \"%s\", \"tokens\": %zu, ",
+            r->num_results++ > 0 ? ",\n" : "", name, c->num_tokens);
+    if (iterations > 0) {
+        fprintf(r->out, "\"iterations\": %lld, \"ns_per_iteration\": %.3f, ",
+                iterations, ns_per_op / iterations);
+    }
+    fprintf(r->out,
+            "\"ops\": %lld, \"ns_per_op\": %.1f, \"tokens_per_s\": %.0f, "
+            "\"allocs_per_op\": %.2f}",
+            ops, ns_per_op, c->num_tokens * 1e9 / ns_per_op,
+            (double)allocations / ops);
+    fflush(r->out);
+}
+
+void bench_lex(BenchCase *c) {
+    lexer_reset(&c->l, c->input, c->length);
+    while (lexer_next_token(&c->l).type != TOKEN_EOF) {
+    }
+}
+
+void bench_parse(BenchCase *c) {
+    arena_reset(c->arena);
+    lexer_reset(&c->l, c->input, c->length);
+    parser_reset(&c->p);
+    bench_sink = parse_expression_statement(&c->p) != NULL;
+}
+
+void bench_eval(BenchCase *c) {
+    eval_epoch++; // a fresh evaluation, not the memoized last one
+    c->env_vars[ENV_ANS] = 0.0;
+    c->env_vars[ENV_I] = 0.0;
+    bench_sink = eval(c->expr, c->env_vars);
+}
+
+void bench_vm(BenchCase *c) {
+    c->env_vars[ENV_ANS] = 0.0;
+    c->env_vars[ENV_I] = 0.0;
+    bench_sink = vm_run(c->prog, c->env_vars);
+}
+
+void bench_flat(BenchCase *c) {
+    c->env_vars[ENV_ANS] = 0.0;
+    c->env_vars[ENV_I] = 0.0;
+    bench_sink = flat_eval(&c->flat, c->env_vars);
+}
+
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void *__wrap_malloc(size_t size) {
+    atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
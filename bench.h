@@ -0,0 +1,94 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "arena.h"
+#include "ast.h"
+#include "compiler.h"
+#include "flat.h"
+#include "lexer.h"
+#include "parser.h"
+#include "vecmath.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define BENCH_MIN_TIME_MS 200
+#define BENCH_MAX_TOKENS 1000000 // largest corpus size, -n changes it
+#define BENCH_SUM_ITERATIONS (1 << 18)
+// Reads i in every operation and stays finite, so no part is hoisted out of
+// the loop and all evaluators do the same work per iteration.
+#define BENCH_SUM_BODY "i * 0.5 + i / 3 - 2"
+#define BENCH_MATH_VALUES (1 << 20) // evenly spaced inputs per sweep
+#define BENCH_PIO2_NEIGHBOURS 16   // doubles around each multiple of pi/2
+
+// One input and everything the benchmarks need to run on it. The tree and
+// program are built once in tree_arena, the flat tree from the resolved
+// tree; arena is reset by every lex or parse operation.
+typedef struct {
+    char *input;
+    size_t length;
+    size_t num_tokens;
+    Arena *arena;
+    Arena *tree_arena;
+    Lexer l;
+    Parser p;
+    Expression *expr;
+    Program *prog;
+    FlatTree flat;
+    double *env_vars;
+} BenchCase;
+
+typedef void bench_fn(BenchCase *c);
+
+// One vecmath kernel over [min, max], against libm. Binary kernels (fn2)
+// take 2 + k % 7 as the second operand of value k. With near_pio2 the
+// inputs are the BENCH_PIO2_NEIGHBOURS doubles around multiples of pi/2
+// spread over [min, max] rather than evenly spaced values, to check the
+// argument reduction where it cancels the most.
+typedef struct {
+    const char *name;
+    vecmath_unary_fn *fn;
+    double (*ref)(double);
+    vecmath_binary_fn *fn2;
+    double (*ref2)(double, double);
+    double min;
+    double max;
+    int max_ulp; // documented bound, see vecmath.h
+    int near_pio2;
+} MathSweep;
+
+typedef struct {
+    FILE *out;
+    long long min_time_ns;
+    int num_results; // for the commas between JSON objects
+} BenchReport;
+
+// malloc, calloc and realloc calls since the start, counted by the
+// wrappers that -Wl,--wrap links in place of the libc functions
+extern atomic_size_t num_allocations;
+
+int prepare_case(BenchCase *c, char *input, size_t length);
+void free_case(BenchCase *c);
+void run_benchmark(BenchReport *r, const char *name, bench_fn *fn,
+                   BenchCase *c, long long iterations);
+void bench_lex(BenchCase *c);
+void bench_parse(BenchCase *c);
+void bench_eval(BenchCase *c);
+void bench_vm(BenchCase *c);
+void bench_flat(BenchCase *c);
+void bench_sizes(BenchReport *r, size_t max_tokens);
+void bench_sums(BenchReport *r);
+void bench_math(BenchReport *r);
+void run_sweep(BenchReport *r, const MathSweep *s, double *in, double *out,
+               double *second);
+long long ulp_distance(double x, double y);
+long long now_ns(void);
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t count, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+
+#endif
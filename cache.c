@@ -0,0 +1,180 @@
+#include "cache.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+ProgramCache *new_program_cache(int capacity) {
+    if (capacity <= 0) {
+        return NULL;
+    }
+    ProgramCache *cache = (ProgramCache *)calloc(1, sizeof(ProgramCache));
+    assertNotNull(cache);
+    cache->capacity = capacity;
+    cache->entries = (CacheEntry *)calloc(capacity, sizeof(CacheEntry));
+    assertNotNull(cache->entries);
+    cache->num_buckets = 1;
+    while (cache->num_buckets < 2 * (size_t)capacity) {
+        cache->num_buckets *= 2;
+    }
+    cache->buckets =
+        (CacheEntry **)calloc(cache->num_buckets, sizeof(CacheEntry *));
+    assertNotNull(cache->buckets);
+    return cache;
+}
+
+void free_program_cache(ProgramCache **cache) {
+    if (cache == NULL || *cache == NULL) {
+        return;
+    }
+    for (int i = 0; i < (*cache)->num_entries; i++) {
+        safe_free((void **)&(*cache)->entries[i].key);
+        free_program(&(*cache)->entries[i].prog);
+    }
+    safe_free((void **)&(*cache)->entries);
+    safe_free((void **)&(*cache)->buckets);
+    safe_free((void **)cache);
+}
+
+// Drops whitespace except a single space between two word characters,
+// where it separates tokens ("1 2" stays apart from "12"). out needs room
+// for n characters. Stops at a NUL like the lexer does.
+size_t normalize_expression(const char *line, size_t n, char *out) {
+    size_t length = 0;
+    int pending_space = 0;
+    for (size_t k = 0; k < n && line[k] != '\0'; k++) {
+        char ch = line[k];
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            pending_space = length > 0;
+            continue;
+        }
+        if (pending_space &&
+            ((is_token_char(out[length - 1]) && is_token_char(ch)) ||
+             splits_exponent(out, length, ch))) {
+            out[length++] = ' ';
+        }
+        pending_space = 0;
+        out[length++] = ch;
+    }
+    return length;
+}
+
+// Characters that can continue an identifier or a number.
+int is_token_char(char ch) { return is_letter(ch) || is_num(ch); }
+
+// Whether a space before ch separates an exponent from its sign or digits,
+// which keeps the malformed "2e - 5" and "2e- 5" apart from "2e-5".
+int splits_exponent(const char *out, size_t length, char ch) {
+    char last = out[length - 1];
+    if (last == 'e' || last == 'E') {
+        return ch == '+' || ch == '-';
+    }
+    return length >= 2 && (last == '+' || last == '-') &&
+           (out[length - 2] == 'e' || out[length - 2] == 'E') &&
+           is_digit(ch);
+}
+
+// 64-bit FNV-1a.
+uint64_t fnv1a_hash(const char *str, size_t n) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (size_t k = 0; k < n; k++) {
+        hash ^= (unsigned char)str[k];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Returns the entry for key and marks it most recently used, or NULL.
+CacheEntry *cache_lookup(ProgramCache *cache, const char *key, size_t length,
+                         uint64_t hash) {
+    assertNotNull(cache);
+    CacheEntry *entry = cache->buckets[hash & (cache->num_buckets - 1)];
+    for (; entry != NULL; entry = entry->bucket_next) {
+        if (entry->hash == hash && entry->key_length == length &&
+            memcmp(entry->key, key, length) == 0) {
+            cache->hits++;
+            cache_unlink(cache, entry);
+            cache_push_front(cache, entry);
+            return entry;
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+// Takes ownership of prog. When the cache is full the least recently used
+// entry is evicted and reused.
+CacheEntry *cache_insert(ProgramCache *cache, const char *key, size_t length,
+                         uint64_t hash, Program *prog, int uses_ans) {
+    assertNotNull(cache);
+    assertNotNull(prog);
+    CacheEntry *entry;
+    if (cache->num_entries < cache->capacity) {
+        entry = &cache->entries[cache->num_entries++];
+    } else {
+        entry = cache->lru_tail;
+        cache_unlink(cache, entry);
+        CacheEntry **link =
+            &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+        while (*link != entry) {
+            link = &(*link)->bucket_next;
+        }
+        *link = entry->bucket_next;
+        safe_free((void **)&entry->key);
+        free_program(&entry->prog);
+        cache->evictions++;
+    }
+    entry->key = (char *)malloc(length > 0 ? length : 1);
+    assertNotNull(entry->key);
+    memcpy(entry->key, key, length);
+    entry->key_length = length;
+    entry->hash = hash;
+    entry->prog = prog;
+    entry->uses_ans = uses_ans;
+    CacheEntry **bucket = &cache->buckets[hash & (cache->num_buckets - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    cache_push_front(cache, entry);
+    return entry;
+}
+
+void cache_unlink(ProgramCache *cache, CacheEntry *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+void cache_push_front(ProgramCache *cache, CacheEntry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != NULL) {
+        cache->lru_head->lru_prev = entry;
+    }
+    cache->lru_head = entry;
+    if (cache->lru_tail == NULL) {
+        cache->lru_tail = entry;
+    }
+}
+
+void print_cache_stats(FILE *out, ProgramCache *cache) {
+    assertNotNull(out);
+    if (cache == NULL) {
+        fprintf(out, "cache      disabled\n");
+        return;
+    }
+    fprintf(out, "cache      %d/%d entries, %lu hits, %lu misses, "
+                 "%lu evictions\n",
+            cache->num_entries, cache->capacity, cache->hits, cache->misses,
+            cache->evictions);
+}
@@ -0,0 +1,54 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "compiler.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#define DEFAULT_CACHE_SIZE 4096
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+typedef struct CacheEntry {
+    char *key; // normalized input text, not NUL-terminated
+    size_t key_length;
+    uint64_t hash;
+    Program *prog; // owned by the cache, never modified once inserted
+    int uses_ans;
+    struct CacheEntry *bucket_next;
+    struct CacheEntry *lru_prev; // towards the most recently used
+    struct CacheEntry *lru_next;
+} CacheEntry;
+
+// Bounded LRU map from normalized expression text to its compiled program.
+// Programs read ans from env_vars, so a hit still evaluates with the
+// current ans.
+typedef struct {
+    CacheEntry *entries;
+    int capacity;
+    int num_entries;
+    CacheEntry **buckets;
+    size_t num_buckets; // power of two
+    CacheEntry *lru_head;
+    CacheEntry *lru_tail;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+} ProgramCache;
+
+ProgramCache *new_program_cache(int capacity);
+void free_program_cache(ProgramCache **cache);
+size_t normalize_expression(const char *line, size_t n, char *out);
+int is_token_char(char ch);
+int splits_exponent(const char *out, size_t length, char ch);
+uint64_t fnv1a_hash(const char *str, size_t n);
+CacheEntry *cache_lookup(ProgramCache *cache, const char *key, size_t length,
+                         uint64_t hash);
+CacheEntry *cache_insert(ProgramCache *cache, const char *key, size_t length,
+                         uint64_t hash, Program *prog, int uses_ans);
+void cache_unlink(ProgramCache *cache, CacheEntry *entry);
+void cache_push_front(ProgramCache *cache, CacheEntry *entry);
+void print_cache_stats(FILE *out, ProgramCache *cache);
+
+#endif
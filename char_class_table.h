@@ -0,0 +1,51 @@
+// Generated by gen_char_class_table.py, do not edit.
+#ifndef CHAR_CLASS_TABLE_H
+#define CHAR_CLASS_TABLE_H
+
+#include "token.h"
+
+#define CHAR_LETTER 1
+#define CHAR_DIGIT 2
+#define CHAR_DOT 4
+#define CHAR_SPACE 8
+#define CHAR_NEWLINE 16
+#define CHAR_NUMBER (CHAR_DIGIT | CHAR_DOT)
+
+// Byte -> CHAR_ bits, 16 bytes per row.
+static const unsigned char char_classes[256] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  8, 16,  0,  0,  8,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     8,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  4,  0,
+     2,  2,  2,  2,  2,  2,  2,  2,  2,  2,  0,  0,  0,  0,  0,  0,
+     0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  0,  0,  0,  0,  1,
+     0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+};
+
+// Byte -> type of the one-byte token it starts.
+static const unsigned char char_tokens[256] = {
+    ['\0'] = TOKEN_EOF,
+    ['\n'] = TOKEN_EOF,
+    ['+'] = PLUS,
+    ['-'] = MINUS,
+    ['*'] = ASTERISK,
+    ['/'] = SLASH,
+    ['^'] = CARET,
+    ['('] = LPAREN,
+    [')'] = RPAREN,
+    ['{'] = LBRACE,
+    ['}'] = RBRACE,
+    [','] = COMMA,
+    ['='] = ASSIGN,
+};
+
+#endif
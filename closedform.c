@@ -0,0 +1,406 @@
+#include "closedform.h"
+#include "ast.h"
+#include "evaluator.h"
+#include "util.h"
+#include <math.h>
+#include <string.h>
+
+ClosedFormOptions closed_form_options = {1, 0};
+
+// B_k, with B_1 = +1/2, as exact fractions for Faulhaber's formula.
+const double bernoulli_numerators[CLOSED_FORM_MAX_DEGREE + 1] = {
+    1, 1, 1, 0, -1, 0, 1, 0, -1, 0, 5, 0, -691, 0, 7, 0, -3617};
+const double bernoulli_denominators[CLOSED_FORM_MAX_DEGREE + 1] = {
+    1, 2, 6, 1, 30, 1, 42, 1, 30, 1, 66, 1, 2730, 1, 6, 1, 510};
+
+// Gives every sum() in the tree whose body is a polynomial in i plus
+// geometric terms its ClosedForm, from arena. Other bodies keep the loop.
+// Runs before hoist_invariants, while bodies are still plain trees.
+void find_closed_forms(Expression *expr, Arena *arena) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        Expression *node = s.frames[--s.num_frames].expr;
+        for (int k = 0; k < expression_num_children(node); k++) {
+            expression_stack_push(&s, expression_child(node, k));
+        }
+        if (node->type != CALL_EXPRESSION) {
+            continue;
+        }
+        CallExpression *call = node->expression.call_expression;
+        ClosedForm f;
+        if (call->keyword != KW_SUM || call->num_arguments != 3 ||
+            call->arguments[2]->depth > CLOSED_FORM_MAX_DEPTH ||
+            !closed_form_of(call->arguments[2], &f)) {
+            continue;
+        }
+        call->closed_form = (ClosedForm *)arena_alloc(arena, sizeof(f));
+        assertNotNull(call->closed_form);
+        *call->closed_form = f;
+    }
+    free_expression_stack(&s);
+}
+
+// Puts expr in the closed form f. Returns 0 when it is not of that form:
+// it reads ans, a variable or a nested sum(), raises i to a power other
+// than a small natural number, divides by i, or has a non-finite
+// coefficient.
+int closed_form_of(Expression *expr, ClosedForm *f) {
+    assertNotNull(expr);
+    switch (expr->type) {
+    case NUMBER_LITERAL:
+        closed_form_constant(f, expr->expression.number_literal->value);
+        return closed_form_is_finite(f);
+    case IDENTIFIER:
+        if (expr->slot >= 0) {
+            return 0; // a named variable, not a constant
+        }
+        switch (expr->expression.identifier->keyword) {
+        case PI:
+            closed_form_constant(f, M_PI);
+            return 1;
+        case E:
+            closed_form_constant(f, M_E);
+            return 1;
+        case I:
+            closed_form_constant(f, 0.0);
+            f->degree = 1;
+            f->coefficients[1] = 1.0;
+            return 1;
+        default:
+            return 0;
+        }
+    case PREFIX_EXPRESSION:
+        return closed_form_of(expr->expression.prefix_expression->right, f) &&
+               closed_form_scale(f, -1.0);
+    case INFIX_EXPRESSION:
+        return closed_form_of_infix(expr->expression.infix_expression, f);
+    case CALL_EXPRESSION:
+        return closed_form_of_call(expr->expression.call_expression, f);
+    default:
+        return 0;
+    }
+}
+
+int closed_form_of_infix(InfixExpression *expr, ClosedForm *f) {
+    assertNotNull(expr);
+    ClosedForm g;
+    if (!closed_form_of(expr->left, f) || !closed_form_of(expr->right, &g)) {
+        return 0;
+    }
+    if (closed_form_is_constant(f) && closed_form_is_constant(&g)) {
+        // computed as the loop would
+        closed_form_constant(f, eval_operator(expr->operation,
+                                              f->coefficients[0],
+                                              g.coefficients[0]));
+        return closed_form_is_finite(f);
+    }
+    switch (expr->operation) {
+    case ADD:
+        return closed_form_add(f, &g, 1.0);
+    case SUBTRACT:
+        return closed_form_add(f, &g, -1.0);
+    case MULTIPLY:
+        return closed_form_multiply(f, &g);
+    case DIVIDE:
+        if (!closed_form_is_constant(&g) || g.coefficients[0] == 0) {
+            return 0;
+        }
+        return closed_form_scale(f, 1 / g.coefficients[0]);
+    case POWER:
+        return closed_form_power(f, &g);
+    default:
+        return 0;
+    }
+}
+
+// Builtins of constants are constants; e(x) is e^x.
+int closed_form_of_call(CallExpression *expr, ClosedForm *f) {
+    assertNotNull(expr);
+    if ((int)expr->keyword < 0 || expr->keyword == KW_SUM ||
+        expr->num_arguments > MAX_BUILTIN_ARGS) {
+        return 0;
+    }
+    ClosedForm args[MAX_BUILTIN_ARGS];
+    double values[MAX_BUILTIN_ARGS];
+    int constant = 1;
+    for (int k = 0; k < expr->num_arguments; k++) {
+        if (!closed_form_of(expr->arguments[k], &args[k])) {
+            return 0;
+        }
+        constant = constant && closed_form_is_constant(&args[k]);
+        values[k] = args[k].coefficients[0];
+    }
+    if (constant) {
+        closed_form_constant(f, eval_builtin(expr->keyword, values));
+        return closed_form_is_finite(f);
+    }
+    if (expr->keyword == E) {
+        return closed_form_exponential(f, M_E, &args[0]);
+    }
+    return 0;
+}
+
+void closed_form_constant(ClosedForm *f, double value) {
+    assertNotNull(f);
+    memset(f, 0, sizeof(ClosedForm));
+    f->coefficients[0] = value;
+}
+
+int closed_form_is_constant(const ClosedForm *f) {
+    return f->degree == 0 && f->num_terms == 0;
+}
+
+// f += sign * g
+int closed_form_add(ClosedForm *f, const ClosedForm *g, double sign) {
+    assertNotNull(f);
+    assertNotNull((void *)g);
+    // coefficients past the degree are kept at 0
+    for (int k = 0; k <= g->degree; k++) {
+        f->coefficients[k] += sign * g->coefficients[k];
+    }
+    if (g->degree > f->degree) {
+        f->degree = g->degree;
+    }
+    while (f->degree > 0 && f->coefficients[f->degree] == 0) {
+        f->degree--;
+    }
+    for (int j = 0; j < g->num_terms; j++) {
+        if (!closed_form_add_term(f, sign * g->scales[j], g->ratios[j])) {
+            return 0;
+        }
+    }
+    return closed_form_is_finite(f);
+}
+
+// f += scale * ratio^i, merged with a term of the same ratio. Terms whose
+// scale is or cancels to 0 are not kept, since summing one whose ratio
+// overflows would give 0 * inf. Returns 0 when there are too many terms.
+int closed_form_add_term(ClosedForm *f, double scale, double ratio) {
+    assertNotNull(f);
+    if (scale == 0) {
+        return 1;
+    }
+    if (ratio == 1) {
+        f->coefficients[0] += scale;
+        return 1;
+    }
+    for (int j = 0; j < f->num_terms; j++) {
+        if (f->ratios[j] == ratio) {
+            f->scales[j] += scale;
+            if (f->scales[j] == 0) {
+                f->num_terms--;
+                f->scales[j] = f->scales[f->num_terms];
+                f->ratios[j] = f->ratios[f->num_terms];
+            }
+            return 1;
+        }
+    }
+    if (f->num_terms == CLOSED_FORM_MAX_TERMS) {
+        return 0;
+    }
+    f->scales[f->num_terms] = scale;
+    f->ratios[f->num_terms++] = ratio;
+    return 1;
+}
+
+int closed_form_scale(ClosedForm *f, double factor) {
+    assertNotNull(f);
+    for (int k = 0; k <= f->degree; k++) {
+        f->coefficients[k] *= factor;
+    }
+    for (int j = 0; j < f->num_terms; j++) {
+        f->scales[j] *= factor;
+    }
+    return closed_form_is_finite(f);
+}
+
+// f *= g. A geometric term times a polynomial is only in the form when the
+// polynomial is a constant.
+int closed_form_multiply(ClosedForm *f, const ClosedForm *g) {
+    assertNotNull(f);
+    assertNotNull((void *)g);
+    if (f->degree + g->degree > CLOSED_FORM_MAX_DEGREE ||
+        (f->num_terms > 0 && g->degree > 0) ||
+        (g->num_terms > 0 && f->degree > 0)) {
+        return 0;
+    }
+    ClosedForm r;
+    closed_form_constant(&r, 0.0);
+    for (int k = 0; k <= f->degree; k++) {
+        for (int m = 0; m <= g->degree; m++) {
+            r.coefficients[k + m] += f->coefficients[k] * g->coefficients[m];
+        }
+    }
+    r.degree = f->degree + g->degree;
+    while (r.degree > 0 && r.coefficients[r.degree] == 0) {
+        r.degree--;
+    }
+    int ok = 1;
+    for (int j = 0; ok && j < g->num_terms; j++) {
+        ok = closed_form_add_term(&r, f->coefficients[0] * g->scales[j],
+                                  g->ratios[j]);
+    }
+    for (int j = 0; ok && j < f->num_terms; j++) {
+        ok = closed_form_add_term(&r, f->scales[j] * g->coefficients[0],
+                                  f->ratios[j]);
+        for (int m = 0; ok && m < g->num_terms; m++) {
+            ok = closed_form_add_term(&r, f->scales[j] * g->scales[m],
+                                      f->ratios[j] * g->ratios[m]);
+        }
+    }
+    *f = r;
+    return ok && closed_form_is_finite(f);
+}
+
+// f = f^g, for a natural number g up to the maximum degree or a constant
+// f raised to a linear g.
+int closed_form_power(ClosedForm *f, const ClosedForm *g) {
+    assertNotNull(f);
+    assertNotNull((void *)g);
+    if (!closed_form_is_constant(g)) {
+        return closed_form_is_constant(f) &&
+               closed_form_exponential(f, f->coefficients[0], g);
+    }
+    double n = g->coefficients[0];
+    if (n < 0 || n > CLOSED_FORM_MAX_DEGREE || n != floor(n)) {
+        return 0;
+    }
+    ClosedForm base = *f;
+    closed_form_constant(f, 1.0);
+    for (int k = 0; k < n; k++) {
+        if (!closed_form_multiply(f, &base)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// f = base^g for g = a*i + b, which is the geometric term
+// base^b * (base^a)^i. A negative base needs integer a and b, like pow.
+int closed_form_exponential(ClosedForm *f, double base, const ClosedForm *g) {
+    assertNotNull(f);
+    assertNotNull((void *)g);
+    if (g->degree > 1 || g->num_terms > 0) {
+        return 0;
+    }
+    double a = g->degree == 1 ? g->coefficients[1] : 0.0;
+    double b = g->coefficients[0];
+    if (!(base > 0) && !(base < 0 && a == floor(a) && b == floor(b))) {
+        return 0;
+    }
+    closed_form_constant(f, 0.0);
+    return closed_form_add_term(f, pow(base, b), pow(base, a)) &&
+           closed_form_is_finite(f);
+}
+
+// Also rejects a ratio that underflowed to 0, which pow would not match.
+int closed_form_is_finite(const ClosedForm *f) {
+    for (int k = 0; k <= f->degree; k++) {
+        if (!isfinite(f->coefficients[k])) {
+            return 0;
+        }
+    }
+    for (int j = 0; j < f->num_terms; j++) {
+        if (!isfinite(f->scales[j]) || !isfinite(f->ratios[j]) ||
+            f->ratios[j] == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The sum of f(i) for i in [first, last]. The polynomial is shifted to
+// j = i - first, which keeps a range far from 0 from cancelling, and each
+// power of j summed by Faulhaber's formula.
+double closed_form_sum(const ClosedForm *f, long long first, long long last) {
+    assertNotNull((void *)f);
+    if (last < first) {
+        return 0.0;
+    }
+    double q[CLOSED_FORM_MAX_DEGREE + 1];
+    memcpy(q, f->coefficients, sizeof(q));
+    double s = (double)first;
+    for (int k = 0; k < f->degree; k++) { // Taylor shift, q(j) = f(s + j)
+        for (int j = f->degree - 1; j >= k; j--) {
+            q[j] += s * q[j + 1];
+        }
+    }
+    double n = (double)(last - first);
+    double x = 0.0;
+    for (int m = f->degree; m >= 0; m--) {
+        x += q[m] * power_sum(m, n);
+    }
+    for (int j = 0; j < f->num_terms; j++) {
+        x += f->scales[j] *
+             geometric_sum(f->ratios[j], first, last - first + 1);
+    }
+    return x;
+}
+
+// Faulhaber's formula: 0^m + 1^m + ... + n^m for an integer n >= 0, as
+// 1/(m+1) * sum over k of C(m+1, k) B_k n^(m+1-k), by Horner's rule.
+double power_sum(int m, double n) {
+    if (m == 0) {
+        return n + 1; // 0^0 is 1, as pow has it
+    }
+    double x = 0.0;
+    double binomial = 1.0; // C(m + 1, k), exact for m <= 16
+    for (int k = 0; k <= m; k++) {
+        x = x * n + binomial * bernoulli_numerators[k] /
+                        bernoulli_denominators[k];
+        binomial = binomial * (m + 1 - k) / (k + 1);
+    }
+    return x * n / (m + 1);
+}
+
+// ratio^first + ... + ratio^(first + n - 1), for ratio != 1.
+double geometric_sum(double ratio, long long first, long long n) {
+    double x = pow(ratio, (double)first);
+    if (ratio > 0) {
+        // expm1 keeps ratios near 1 from cancelling
+        return x * expm1((double)n * log(ratio)) / (ratio - 1);
+    }
+    return x * (pow(ratio, (double)n) - 1) / (ratio - 1);
+}
+
+// Whether a sum() over [first, last] also runs its loop, to check the
+// closed form.
+int closed_form_checks(long long first, long long last) {
+    return closed_form_options.check_limit > 0 &&
+           last - first < closed_form_options.check_limit;
+}
+
+// The loop and the closed form differ by rounding, which grows with the
+// number and the size of the terms, so they must agree to within
+// CLOSED_FORM_TOLERANCE of n times a bound on the largest term. Reports a
+// closed form that does not, and returns the loop's value either way.
+double closed_form_check(const ClosedForm *f, long long first,
+                         long long last, double closed, double loop) {
+    assertNotNull((void *)f);
+    if (last < first || closed == loop || (isnan(closed) && isnan(loop))) {
+        return loop;
+    }
+    double m = fmax(fabs((double)first), fabs((double)last));
+    double largest = 0.0;
+    double power = 1.0;
+    for (int k = 0; k <= f->degree; k++) {
+        largest += fabs(f->coefficients[k]) * power;
+        power *= m;
+    }
+    for (int j = 0; j < f->num_terms; j++) {
+        double r = fabs(f->ratios[j]);
+        largest += fabs(f->scales[j]) *
+                   fmax(pow(r, (double)first), pow(r, (double)last));
+    }
+    double n = (double)(last - first + 1);
+    if (fabs(closed - loop) > CLOSED_FORM_TOLERANCE * n * largest ||
+        isnan(closed) != isnan(loop)) {
+        report_error("Error: sum() closed form %.17g differs from the "
+                     "loop's %.17g.\n",
+                     closed, loop);
+    }
+    return loop;
+}
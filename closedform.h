@@ -0,0 +1,55 @@
+#ifndef CLOSEDFORM_H
+#define CLOSEDFORM_H
+
+#include "arena.h"
+#include "ast.h"
+
+#define CLOSED_FORM_MAX_DEGREE 16 // highest power of i, see power_sum
+#define CLOSED_FORM_MAX_TERMS 8   // geometric terms per body
+#define CLOSED_FORM_MAX_DEPTH 64  // deeper bodies are left to the loop
+#define CLOSED_FORM_TOLERANCE 1e-9 // of n times the largest term, see check
+
+typedef struct {
+    int enabled; // sum() bodies with a closed form skip the loop
+    // Ranges of at most this many iterations also run the loop, and a
+    // closed form that disagrees with it is reported. 0 disables.
+    long long check_limit;
+} ClosedFormOptions;
+
+// A sum() body of the form
+//   coefficients[0] + coefficients[1]*i + ... + coefficients[degree]*i^degree
+//   + scales[0]*ratios[0]^i + ... + scales[num_terms-1]*ratios[num_terms-1]^i
+// with constant coefficients, summed over a range in O(degree + num_terms).
+typedef struct ClosedForm {
+    int degree;
+    double coefficients[CLOSED_FORM_MAX_DEGREE + 1];
+    int num_terms;
+    double scales[CLOSED_FORM_MAX_TERMS];
+    double ratios[CLOSED_FORM_MAX_TERMS];
+} ClosedForm;
+
+extern ClosedFormOptions closed_form_options;
+extern const double bernoulli_numerators[CLOSED_FORM_MAX_DEGREE + 1];
+extern const double bernoulli_denominators[CLOSED_FORM_MAX_DEGREE + 1];
+
+void find_closed_forms(Expression *expr, Arena *arena);
+int closed_form_of(Expression *expr, ClosedForm *f);
+int closed_form_of_infix(InfixExpression *expr, ClosedForm *f);
+int closed_form_of_call(CallExpression *expr, ClosedForm *f);
+void closed_form_constant(ClosedForm *f, double value);
+int closed_form_is_constant(const ClosedForm *f);
+int closed_form_add(ClosedForm *f, const ClosedForm *g, double sign);
+int closed_form_add_term(ClosedForm *f, double scale, double ratio);
+int closed_form_scale(ClosedForm *f, double factor);
+int closed_form_multiply(ClosedForm *f, const ClosedForm *g);
+int closed_form_power(ClosedForm *f, const ClosedForm *g);
+int closed_form_exponential(ClosedForm *f, double base, const ClosedForm *g);
+int closed_form_is_finite(const ClosedForm *f);
+double closed_form_sum(const ClosedForm *f, long long first, long long last);
+double power_sum(int m, double n);
+double geometric_sum(double ratio, long long first, long long n);
+int closed_form_checks(long long first, long long last);
+double closed_form_check(const ClosedForm *f, long long first,
+                         long long last, double closed, double loop);
+
+#endif
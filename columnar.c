@@ -0,0 +1,81 @@
+#include "columnar.h"
+#include "batch.h"
+#include "compiler.h"
+#include "evaluator.h"
+#include "util.h"
+#include "vm.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Evaluates a resolved expression once per row, reading the variables
+// bound by columns from the row and writing out[row]. Unbound variables
+// are 0. Returns 0 if the expression does not compile or a column is
+// bound to something other than a variable slot.
+int eval_columns(Expression *expr, const Column *columns, int num_columns,
+                 size_t num_rows, double *out) {
+    assertNotNull(expr);
+    Program *prog = compile(expr);
+    if (prog == NULL) {
+        return 0;
+    }
+    int ok = run_columns(prog, columns, num_columns, num_rows, out);
+    free_program(&prog);
+    return ok;
+}
+
+// Batchable programs run BATCH_SIZE rows at a time on the batch VM, which
+// reads each block straight out of the columns; one block of every column
+// and the operand stack stay in L1. Programs with sums run row by row.
+int run_columns(Program *prog, const Column *columns, int num_columns,
+                size_t num_rows, double *out) {
+    assertNotNull(prog);
+    assertNotNull(out);
+    for (int c = 0; c < num_columns; c++) {
+        if (columns[c].slot < 0 || columns[c].slot >= NUM_ENV_VARS ||
+            columns[c].values == NULL) {
+            report_error("Error: Invalid column %d.\n", c);
+            errno = EINVAL;
+            return 0;
+        }
+    }
+    double *env_vars = (double *)calloc(prog->env_size, sizeof(double));
+    assertNotNull(env_vars);
+
+    if (!prog->batchable) {
+        for (size_t row = 0; row < num_rows; row++) {
+            for (int c = 0; c < num_columns; c++) {
+                env_vars[columns[c].slot] = columns[c].values[row];
+            }
+            out[row] = vm_run(prog, env_vars);
+        }
+        free(env_vars);
+        return 1;
+    }
+
+    const double *lanes[NUM_ENV_VARS] = {NULL};
+    _Alignas(32) double tail[NUM_ENV_VARS][BATCH_SIZE];
+    _Alignas(32) double tail_out[BATCH_SIZE];
+    size_t row = 0;
+    for (; row + BATCH_SIZE <= num_rows; row += BATCH_SIZE) {
+        for (int c = 0; c < num_columns; c++) {
+            lanes[columns[c].slot] = columns[c].values + row;
+        }
+        batch_run(prog, env_vars, lanes, out + row);
+    }
+    if (row < num_rows) {
+        // last partial block, padded with copies of its first row
+        size_t n = num_rows - row;
+        for (int c = 0; c < num_columns; c++) {
+            double *lane = tail[columns[c].slot];
+            for (size_t k = 0; k < BATCH_SIZE; k++) {
+                lane[k] = columns[c].values[row + (k < n ? k : 0)];
+            }
+            lanes[columns[c].slot] = lane;
+        }
+        batch_run(prog, env_vars, lanes, tail_out);
+        memcpy(out + row, tail_out, n * sizeof(double));
+    }
+    free(env_vars);
+    return 1;
+}
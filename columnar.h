@@ -0,0 +1,19 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include "ast.h"
+#include "compiler.h"
+#include <stddef.h>
+
+// Input column: one value per row for an env_vars slot (ENV_ANS, ENV_I).
+typedef struct {
+    int slot;
+    const double *values;
+} Column;
+
+int eval_columns(Expression *expr, const Column *columns, int num_columns,
+                 size_t num_rows, double *out);
+int run_columns(Program *prog, const Column *columns, int num_columns,
+                size_t num_rows, double *out);
+
+#endif
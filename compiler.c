@@ -0,0 +1,390 @@
+#include "compiler.h"
+#include "ast.h"
+#include "batch.h"
+#include "cache.h"
+#include "closedform.h"
+#include "cse.h"
+#include "jit.h"
+#include "evaluator.h"
+#include "util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char opcode_names[NUM_OPCODES][MAX_KEYWORD_LEN + 1] = {
+    "const", "load", "store", "tee",  "temp", "neg", "add",  "sub",
+    "mul",   "div",  "pow",   "sqrt", "rootn", "log", "logn", "ln",
+    "sin",   "cos",  "tan",   "asin", "acos", "atan", "exp",  "sum",
+    "return"};
+
+Program *new_program(void) {
+    Program *prog = (Program *)calloc(1, sizeof(Program));
+    assertNotNull(prog);
+    prog->env_size = NUM_ENV_VARS;
+    return prog;
+}
+
+void free_program(Program **prog) {
+    if (prog == NULL || *prog == NULL) {
+        return;
+    }
+    Program *p = *prog;
+    for (int i = 0; i < p->num_bodies; i++) {
+        free_program(&p->bodies[i]);
+    }
+    safe_free((void **)&p->bodies);
+    safe_free((void **)&p->closed_form);
+    jit_free(p);
+    safe_free((void **)&p->code);
+    safe_free((void **)&p->constants);
+    safe_free((void **)&p->constant_slots);
+    safe_free((void **)prog);
+}
+
+Program *compile(Expression *expr) {
+    assertNotNull(expr);
+    Program *prog = new_program();
+    if (!compile_expression(prog, expr)) {
+        free_program(&prog);
+        return NULL;
+    }
+    emit(prog, OP_RETURN, 0);
+    prog->batchable = is_batchable(prog);
+    return prog;
+}
+
+int compile_expression(Program *prog, Expression *expr) {
+    return compile_walk(prog, expr, 0);
+}
+
+// Compiles expr itself even when it is a hoisted invariant or shared, for
+// the code that stores it.
+int compile_uncached(Program *prog, Expression *expr) {
+    return compile_walk(prog, expr, 1);
+}
+
+// Emits the code of expr in post-order with an explicit stack, so any
+// depth compiles; only a sum() body, compiled into a Program of its own,
+// takes a level of C stack. uncached applies to expr, not its operands.
+int compile_walk(Program *prog, Expression *expr, int uncached) {
+    assertNotNull(prog);
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    int ok = 1;
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        Expression *node = f->expr;
+        int cached = s.num_frames > 1 || !uncached;
+        if (f->step == 0 && cached && node->slot >= 0) {
+            // named variable, or hoisted loop invariant stored before the
+            // enclosing sum runs
+            emit(prog, OP_LOAD, node->slot);
+            s.num_frames--;
+            continue;
+        }
+        // common subexpression: the first occurrence in this program
+        // computes it, later ones reuse it (code runs straight through, no
+        // branches)
+        int shared = cached && is_shared(node);
+        if (f->step == 0 && shared && node->shared->temp_scope == prog) {
+            emit(prog, OP_TEMP, node->shared->temp);
+            s.num_frames--;
+            continue;
+        }
+        if (f->step < compile_num_operands(node)) {
+            expression_stack_push(&s, expression_child(node, f->step++));
+            continue;
+        }
+        if (!compile_node(prog, node)) {
+            ok = 0;
+            break;
+        }
+        if (shared) {
+            node->shared->temp = prog->num_temps++;
+            node->shared->temp_scope = prog;
+            emit(prog, OP_TEE, node->shared->temp);
+        }
+        s.num_frames--;
+    }
+    free_expression_stack(&s);
+    return ok;
+}
+
+// Operands compiled onto the stack before the node; a sum() compiles its
+// invariants and body itself.
+int compile_num_operands(Expression *expr) {
+    if (expr->type == CALL_EXPRESSION &&
+        expr->expression.call_expression->keyword == KW_SUM) {
+        return 2;
+    }
+    return expression_num_children(expr);
+}
+
+// Emits the instructions of expr after its operands.
+int compile_node(Program *prog, Expression *expr) {
+    switch (expr->type) {
+    case NUMBER_LITERAL:
+        emit(prog, OP_CONST,
+             add_constant(prog, expr->expression.number_literal->value));
+        return 1;
+    case IDENTIFIER:
+        return compile_identifier(prog, expr->expression.identifier);
+    case PREFIX_EXPRESSION:
+        // only MINUS operator
+        emit(prog, OP_NEG, 0);
+        return 1;
+    case INFIX_EXPRESSION:
+        return compile_infix_expression(prog,
+                                        expr->expression.infix_expression);
+    case CALL_EXPRESSION:
+        return compile_call_expression(prog, expr->expression.call_expression);
+    default:
+        report_error("Error: Invalid Expression node.\n");
+        errno = EINVAL;
+        return 0;
+    }
+}
+
+int compile_identifier(Program *prog, Identifier *expr) {
+    assertNotNull(expr);
+    switch (expr->keyword) {
+    case PI:
+        emit(prog, OP_CONST, add_constant(prog, M_PI));
+        return 1;
+    case E:
+        emit(prog, OP_CONST, add_constant(prog, M_E));
+        return 1;
+    case ANS:
+        emit(prog, OP_LOAD, ENV_ANS);
+        return 1;
+    case I:
+        emit(prog, OP_LOAD, ENV_I);
+        return 1;
+    default:
+        report_error("Error: Invalid Identifier node.\n");
+        errno = EINVAL;
+        return 0;
+    }
+}
+
+int compile_infix_expression(Program *prog, InfixExpression *expr) {
+    assertNotNull(expr);
+    Opcode op;
+    switch (expr->operation) {
+    case ADD:
+        op = OP_ADD;
+        break;
+    case SUBTRACT:
+        op = OP_SUB;
+        break;
+    case MULTIPLY:
+        op = OP_MUL;
+        break;
+    case DIVIDE:
+        op = OP_DIV;
+        break;
+    case POWER:
+        op = OP_POW;
+        break;
+    default:
+        report_error("Error: Invalid infix expression.\n");
+        errno = EINVAL;
+        return 0;
+    }
+    emit(prog, op, 0);
+    return 1;
+}
+
+int compile_call_expression(Program *prog, CallExpression *expr) {
+    assertNotNull(expr);
+    // keyword and arity were checked by resolve_expression
+    Opcode op;
+    switch (expr->keyword) {
+    case SQRT:
+        op = OP_SQRT;
+        break;
+    case ROOTN:
+        op = OP_ROOTN;
+        break;
+    case LOG:
+        op = OP_LOG;
+        break;
+    case LOGN:
+        op = OP_LOGN;
+        break;
+    case LN:
+        op = OP_LN;
+        break;
+    case E:
+        op = OP_EXP;
+        break;
+    case SIN:
+        op = OP_SIN;
+        break;
+    case COS:
+        op = OP_COS;
+        break;
+    case TAN:
+        op = OP_TAN;
+        break;
+    case ASIN:
+        op = OP_ASIN;
+        break;
+    case ACOS:
+        op = OP_ACOS;
+        break;
+    case ATAN:
+        op = OP_ATAN;
+        break;
+    case KW_SUM:
+        op = OP_SUM;
+        break;
+    default:
+        report_error("Error: Invalid call expression node.\n");
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (op == OP_SUM) {
+        // start and end are on the stack
+        for (int i = 0; i < expr->num_invariants; i++) {
+            if (!compile_uncached(prog, expr->invariants[i])) {
+                return 0;
+            }
+            emit(prog, OP_STORE, expr->invariants[i]->slot);
+        }
+        Program *body = compile(expr->arguments[2]);
+        if (body == NULL) {
+            return 0;
+        }
+        if (expr->closed_form != NULL) {
+            body->closed_form = (ClosedForm *)malloc(sizeof(ClosedForm));
+            assertNotNull(body->closed_form);
+            *body->closed_form = *expr->closed_form;
+        }
+        if (body->env_size > prog->env_size) {
+            prog->env_size = body->env_size;
+        }
+        if (prog->num_bodies >= prog->bodies_cap) {
+            prog->bodies_cap = prog->bodies_cap ? 2 * prog->bodies_cap : 2;
+            prog->bodies = (Program **)realloc(
+                prog->bodies, prog->bodies_cap * sizeof(Program *));
+            assertNotNull(prog->bodies);
+        }
+        prog->bodies[prog->num_bodies] = body;
+        emit(prog, OP_SUM, prog->num_bodies++);
+        return 1;
+    }
+    emit(prog, op, 0);
+    return 1;
+}
+
+void emit(Program *prog, Opcode op, int arg) {
+    assertNotNull(prog);
+    if (prog->num_code >= prog->code_cap) {
+        prog->code_cap = prog->code_cap ? 2 * prog->code_cap : 16;
+        prog->code = (Instruction *)realloc(
+            prog->code, prog->code_cap * sizeof(Instruction));
+        assertNotNull(prog->code);
+    }
+    prog->code[prog->num_code].op = op;
+    prog->code[prog->num_code].arg = arg;
+    prog->num_code++;
+
+    switch (op) {
+    case OP_CONST:
+    case OP_LOAD:
+    case OP_TEMP:
+        prog->depth++;
+        break;
+    case OP_STORE:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_POW:
+    case OP_ROOTN:
+    case OP_LOGN:
+    case OP_SUM:
+        prog->depth--;
+        break;
+    default:
+        break;
+    }
+    if (prog->depth > prog->max_stack) {
+        prog->max_stack = prog->depth;
+    }
+    if ((op == OP_LOAD || op == OP_STORE) && arg >= prog->env_size) {
+        prog->env_size = arg + 1;
+    }
+}
+
+static size_t constant_slot(uint64_t bits, int cap) {
+    return (size_t)(((bits ^ (bits >> 29)) * FNV_PRIME) >> 17) & (cap - 1);
+}
+
+// Constants are deduplicated by bit pattern (so 0 and -0 stay apart)
+// through an open-addressed table kept at most half full.
+int add_constant(Program *prog, double value) {
+    assertNotNull(prog);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(double));
+    if (2 * (prog->num_constants + 1) > prog->constant_slots_cap) {
+        int cap = prog->constant_slots_cap ? 2 * prog->constant_slots_cap : 16;
+        int *slots = (int *)calloc(cap, sizeof(int));
+        assertNotNull(slots);
+        for (int i = 0; i < prog->num_constants; i++) {
+            uint64_t b;
+            memcpy(&b, &prog->constants[i], sizeof(double));
+            size_t k = constant_slot(b, cap);
+            while (slots[k] != 0) {
+                k = (k + 1) & (cap - 1);
+            }
+            slots[k] = i + 1;
+        }
+        free(prog->constant_slots);
+        prog->constant_slots = slots;
+        prog->constant_slots_cap = cap;
+    }
+    size_t mask = prog->constant_slots_cap - 1;
+    size_t k = constant_slot(bits, prog->constant_slots_cap);
+    for (; prog->constant_slots[k] != 0; k = (k + 1) & mask) {
+        int i = prog->constant_slots[k] - 1;
+        if (memcmp(&prog->constants[i], &value, sizeof(double)) == 0) {
+            return i;
+        }
+    }
+    if (prog->num_constants >= prog->constants_cap) {
+        prog->constants_cap = prog->constants_cap ? 2 * prog->constants_cap : 8;
+        prog->constants = (double *)realloc(
+            prog->constants, prog->constants_cap * sizeof(double));
+        assertNotNull(prog->constants);
+    }
+    prog->constants[prog->num_constants] = value;
+    prog->constant_slots[k] = prog->num_constants + 1;
+    return prog->num_constants++;
+}
+
+void print_program(FILE *out, Program *prog) {
+    assertNotNull(out);
+    assertNotNull(prog);
+    for (int i = 0; i < prog->num_code; i++) {
+        Instruction ins = prog->code[i];
+        fprintf(out, "%4d  %-6s", i, opcode_names[ins.op]);
+        if (ins.op == OP_CONST) {
+            fprintf(out, " %g", prog->constants[ins.arg]);
+        } else if (ins.op == OP_LOAD || ins.op == OP_STORE ||
+                   ins.op == OP_TEE || ins.op == OP_TEMP || ins.op == OP_SUM) {
+            fprintf(out, " %d", ins.arg);
+        }
+        fprintf(out, "\n");
+    }
+    for (int i = 0; i < prog->num_bodies; i++) {
+        fprintf(out, "body %d:\n", i);
+        print_program(out, prog->bodies[i]);
+    }
+}
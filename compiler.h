@@ -0,0 +1,91 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+#include "evaluator.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef enum {
+    OP_CONST, // push constants[arg]
+    OP_LOAD,  // push env_vars[arg]
+    OP_STORE, // pop into env_vars[arg]
+    OP_TEE,   // copy the top of the stack into temps[arg]
+    OP_TEMP,  // push temps[arg]
+
+    // Operators
+    OP_NEG,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+
+    // Builtins, one per callable KeywordType
+    OP_SQRT,
+    OP_ROOTN,
+    OP_LOG,
+    OP_LOGN,
+    OP_LN,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ASIN,
+    OP_ACOS,
+    OP_ATAN,
+    OP_EXP,
+    OP_SUM, // pop end and start, push the sum of bodies[arg] over the range
+
+    OP_RETURN,
+    NUM_OPCODES,
+} Opcode;
+
+typedef struct {
+    Opcode op;
+    int arg;
+} Instruction;
+
+// Linear bytecode for one expression. The body of every sum() call is
+// compiled into its own Program so the VM can run it once per iteration.
+// Programs own all their memory and do not reference the AST.
+typedef struct Program {
+    Instruction *code;
+    int num_code;
+    int code_cap;
+    double *constants;
+    int num_constants;
+    int constants_cap;
+    int *constant_slots; // open-addressed index+1 of each constant, by bits
+    int constant_slots_cap;
+    struct Program **bodies;
+    int num_bodies;
+    int bodies_cap;
+    int max_stack;
+    int env_size; // env_vars entries read or written, at least NUM_ENV_VARS
+    int num_temps; // common subexpressions kept for the rest of one run
+    int batchable; // can run on the lane-wise batch VM, see is_batchable
+    struct ClosedForm *closed_form; // of a sum() body, summed without a loop
+    atomic_int jit_state; // JitState, native code is compiled on demand
+    void *jit_code;
+    size_t jit_size;
+    int depth;    // stack depth while compiling
+} Program;
+
+extern char opcode_names[NUM_OPCODES][MAX_KEYWORD_LEN + 1];
+
+Program *new_program(void);
+void free_program(Program **prog);
+Program *compile(Expression *expr);
+int compile_expression(Program *prog, Expression *expr);
+int compile_uncached(Program *prog, Expression *expr);
+int compile_walk(Program *prog, Expression *expr, int uncached);
+int compile_num_operands(Expression *expr);
+int compile_node(Program *prog, Expression *expr);
+int compile_identifier(Program *prog, Identifier *expr);
+int compile_infix_expression(Program *prog, InfixExpression *expr);
+int compile_call_expression(Program *prog, CallExpression *expr);
+void emit(Program *prog, Opcode op, int arg);
+int add_constant(Program *prog, double value);
+void print_program(FILE *out, Program *prog);
+
+#endif
@@ -0,0 +1,161 @@
+#include "corpus.h"
+#include "keyword.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+CorpusOptions corpus_options = {1000, 4, 20, 10, 0, 1};
+
+char binary_operators[] = "+-*/^";
+
+// Returns a NUL-terminated expression of at least opts->num_tokens tokens,
+// the same one for the same options. The caller frees it.
+char *generate_expression(CorpusOptions *opts, size_t *length,
+                          size_t *num_tokens) {
+    assertNotNull(opts);
+    CorpusGenerator g = {0};
+    g.opts = *opts;
+    g.state = opts->seed ? opts->seed : 1;
+    g.capacity = 8 * opts->num_tokens + 64;
+    g.text = (char *)malloc(g.capacity);
+    assertNotNull(g.text);
+    gen_expression(&g, opts->num_tokens > 0 ? opts->num_tokens : 1,
+                   opts->use_i);
+    g.text[g.length] = '\0';
+    if (length != NULL) {
+        *length = g.length;
+    }
+    if (num_tokens != NULL) {
+        *num_tokens = g.num_tokens;
+    }
+    return g.text;
+}
+
+void gen_expression(CorpusGenerator *g, size_t num_tokens, int in_sum) {
+    if (num_tokens <= 2 * CORPUS_CHAIN_TOKENS) {
+        gen_chain(g, num_tokens, 0, in_sum);
+        return;
+    }
+    // (left) op (right), 5 tokens of grouping and operator
+    size_t left = (num_tokens - 5) / 2;
+    gen_token(g, "(", 1);
+    gen_expression(g, left, in_sum);
+    gen_token(g, ")", 1);
+    gen_token(g, &binary_operators[gen_random(g, 3)], 1); // + - *
+    gen_token(g, "(", 1);
+    gen_expression(g, num_tokens - 5 - left, in_sum);
+    gen_token(g, ")", 1);
+}
+
+// operand op operand op ... until num_tokens are written
+void gen_chain(CorpusGenerator *g, size_t num_tokens, int depth, int in_sum) {
+    size_t start = g->num_tokens;
+    gen_operand(g, depth, in_sum);
+    while (g->num_tokens - start < num_tokens) {
+        gen_token(g, &binary_operators[gen_random(g, 5)], 1);
+        gen_operand(g, depth, in_sum);
+    }
+}
+
+void gen_operand(CorpusGenerator *g, int depth, int in_sum) {
+    if (depth >= g->opts.max_depth) {
+        gen_leaf(g, in_sum);
+        return;
+    }
+    unsigned r = gen_random(g, 100);
+    if (r < (unsigned)g->opts.call_percent) {
+        gen_call(g, depth, in_sum);
+    } else if (r < (unsigned)g->opts.call_percent + 10) {
+        gen_token(g, "(", 1);
+        gen_chain(g, 1 + gen_random(g, CORPUS_CHAIN_TOKENS), depth + 1,
+                  in_sum);
+        gen_token(g, ")", 1);
+    } else if (r < (unsigned)g->opts.call_percent + 15) {
+        gen_token(g, "-", 1);
+        gen_operand(g, depth + 1, in_sum);
+    } else {
+        gen_leaf(g, in_sum);
+    }
+}
+
+void gen_call(CorpusGenerator *g, int depth, int in_sum) {
+    if (gen_random(g, 100) < (unsigned)g->opts.sum_percent) {
+        char range[32];
+        gen_token(g, keywords[KW_SUM], strlen(keywords[KW_SUM]));
+        gen_token(g, "(", 1);
+        gen_token(g, "1", 1);
+        gen_token(g, ",", 1);
+        int n = snprintf(range, sizeof(range), "%u",
+                         1 + gen_random(g, CORPUS_MAX_RANGE));
+        gen_token(g, range, n);
+        gen_token(g, ",", 1);
+        gen_chain(g, 1 + gen_random(g, CORPUS_CHAIN_TOKENS), depth + 1, 1);
+        gen_token(g, ")", 1);
+        return;
+    }
+    KeywordType kw;
+    do {
+        kw = (KeywordType)gen_random(g, NUM_KEYWORDS);
+    } while (keyword_num_args[kw] == 0 || kw == KW_SUM);
+    gen_token(g, keywords[kw], strlen(keywords[kw]));
+    gen_token(g, "(", 1);
+    for (int i = 0; i < keyword_num_args[kw]; i++) {
+        if (i > 0) {
+            gen_token(g, ",", 1);
+        }
+        gen_chain(g, 1 + gen_random(g, 4), depth + 1, in_sum);
+    }
+    gen_token(g, ")", 1);
+}
+
+void gen_leaf(CorpusGenerator *g, int in_sum) {
+    unsigned r = gen_random(g, 100);
+    if (r < 70) {
+        char number[32];
+        int n = r < 50 ? snprintf(number, sizeof(number), "%u",
+                                  gen_random(g, 1000))
+                       : snprintf(number, sizeof(number), "%u.%u",
+                                  gen_random(g, 100), gen_random(g, 1000));
+        gen_token(g, number, n);
+    } else if (r < 80 && in_sum) {
+        gen_token(g, keywords[I], strlen(keywords[I]));
+    } else if (r < 90) {
+        gen_token(g, keywords[PI], strlen(keywords[PI]));
+    } else if (r < 95) {
+        gen_token(g, keywords[E], strlen(keywords[E]));
+    } else {
+        gen_token(g, keywords[ANS], strlen(keywords[ANS]));
+    }
+}
+
+// Appends one token, with a space before binary operators and after them
+// so the text reads like typed input.
+void gen_token(CorpusGenerator *g, const char *text, size_t n) {
+    int spaced = n == 1 && strchr(binary_operators, text[0]) != NULL &&
+                 g->length > 0 && g->text[g->length - 1] != '(' &&
+                 g->text[g->length - 1] != ',' &&
+                 g->text[g->length - 1] != ' ';
+    if (g->length + n + 3 > g->capacity) {
+        g->capacity *= 2;
+        g->text = (char *)realloc(g->text, g->capacity);
+        assertNotNull(g->text);
+    }
+    if (spaced) {
+        g->text[g->length++] = ' ';
+    }
+    memcpy(g->text + g->length, text, n);
+    g->length += n;
+    if (spaced) {
+        g->text[g->length++] = ' ';
+    }
+    g->num_tokens++;
+}
+
+// xorshift64*, uniform enough for picking among a few choices
+unsigned gen_random(CorpusGenerator *g, unsigned n) {
+    g->state ^= g->state >> 12;
+    g->state ^= g->state << 25;
+    g->state ^= g->state >> 27;
+    return (unsigned)((g->state * 0x2545F4914F6CDD1DULL) >> 32) % n;
+}
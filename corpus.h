@@ -0,0 +1,43 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+
+#define CORPUS_CHAIN_TOKENS 16 // longest operator chain without grouping
+#define CORPUS_MAX_RANGE 16    // sum() ranges are 1..n for n up to this
+
+typedef struct {
+    size_t num_tokens; // stop once at least this many tokens are written
+    int max_depth;     // nesting of calls, groups and prefix minus
+    int call_percent;  // share of operands that are builtin calls
+    int sum_percent;   // share of those calls that are sum()
+    int use_i;         // operands may read i, for sum() bodies
+    unsigned long long seed;
+} CorpusOptions;
+
+// Writes one random, valid expression. Long expressions are split into
+// parenthesized halves, so the tree stays about log2(num_tokens) groups
+// deep whatever the size and max_depth only bounds the operands.
+typedef struct {
+    CorpusOptions opts;
+    unsigned long long state;
+    char *text;
+    size_t length;
+    size_t capacity;
+    size_t num_tokens;
+} CorpusGenerator;
+
+extern CorpusOptions corpus_options;
+extern char binary_operators[];
+
+char *generate_expression(CorpusOptions *opts, size_t *length,
+                          size_t *num_tokens);
+void gen_expression(CorpusGenerator *g, size_t num_tokens, int in_sum);
+void gen_chain(CorpusGenerator *g, size_t num_tokens, int depth, int in_sum);
+void gen_operand(CorpusGenerator *g, int depth, int in_sum);
+void gen_call(CorpusGenerator *g, int depth, int in_sum);
+void gen_leaf(CorpusGenerator *g, int in_sum);
+void gen_token(CorpusGenerator *g, const char *text, size_t n);
+unsigned gen_random(CorpusGenerator *g, unsigned n);
+
+#endif
@@ -0,0 +1,233 @@
+#include "cse.h"
+#include "ast.h"
+#include "cache.h"
+#include "util.h"
+#include <stdint.h>
+#include <string.h>
+
+// Common subexpression elimination. hash_cons rebuilds the tree bottom-up
+// so that structurally identical subtrees become one node, turning it into
+// a DAG, then counts the parents of every node. Interior nodes with more
+// than one parent are computed once per evaluation (or per sum iteration):
+// the compiler keeps them in a temporary, the tree walker memoizes them,
+// both in the SharedNode each such node gets from arena.
+//
+// Runs after hoist_invariants: the slot is part of a node's identity, so a
+// hoisted invariant is never merged with an occurrence outside its sum.
+Expression *hash_cons(Expression *expr, Arena *arena) {
+    assertNotNull(expr);
+    ConsTable table;
+    table.capacity = 16;
+    while (table.capacity < 2 * count_nodes(expr)) {
+        table.capacity *= 2;
+    }
+    table.entries = (Expression **)arena_alloc(
+        arena, table.capacity * sizeof(Expression *));
+    assertNotNull(table.entries);
+    memset(table.entries, 0, table.capacity * sizeof(Expression *));
+
+    Expression *root = cons_node(expr, &table);
+    root->refs = 1;
+    count_references(root, arena);
+    if (arena == NULL) {
+        safe_free((void **)&table.entries);
+    }
+    return root;
+}
+
+// Returns the canonical node for expr after making its children canonical,
+// children first with an explicit stack so any depth is merged.
+Expression *cons_node(Expression *expr, ConsTable *table) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        Expression *node = f->expr;
+        if (f->step < expression_num_children(node)) {
+            expression_stack_push(&s, expression_child(node, f->step++));
+            continue;
+        }
+        if (node->type == CALL_EXPRESSION) {
+            // invariants are nodes of the body, whose children have just
+            // been made canonical; walking them again would take time
+            // exponential in the nesting of sums
+            CallExpression *call = node->expression.call_expression;
+            for (int i = 0; i < call->num_invariants; i++) {
+                call->invariants[i] = cons_lookup(call->invariants[i], table);
+            }
+        }
+        Expression *canonical = cons_lookup(node, table);
+        s.num_frames--;
+        if (s.num_frames == 0) {
+            expr = canonical;
+        } else {
+            ExpressionFrame *parent = &s.frames[s.num_frames - 1];
+            *expression_child_slot(parent->expr, parent->step - 1) = canonical;
+        }
+    }
+    free_expression_stack(&s);
+    return expr;
+}
+
+// The node in table equal to expr, whose children are canonical, after
+// adding expr when there is none.
+Expression *cons_lookup(Expression *expr, ConsTable *table) {
+    size_t mask = table->capacity - 1;
+    for (size_t k = expression_hash(expr) & mask;; k = (k + 1) & mask) {
+        if (table->entries[k] == NULL) {
+            table->entries[k] = expr;
+            return expr;
+        }
+        if (table->entries[k] == expr ||
+            expressions_equal(table->entries[k], expr)) {
+            return table->entries[k];
+        }
+    }
+}
+
+// Children are hashed by address, which is enough once they are canonical.
+uint64_t expression_hash(Expression *expr) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    uint64_t fields[3] = {expr->type, (uint64_t)(int64_t)expr->slot, 0};
+    switch (expr->type) {
+    case NUMBER_LITERAL:
+        memcpy(&fields[2], &expr->expression.number_literal->value,
+               sizeof(double));
+        break;
+    case IDENTIFIER:
+        fields[2] = expr->expression.identifier->keyword;
+        break;
+    case PREFIX_EXPRESSION:
+        fields[2] = (uintptr_t)expr->expression.prefix_expression->right;
+        break;
+    case INFIX_EXPRESSION: {
+        InfixExpression *infix = expr->expression.infix_expression;
+        fields[2] = ((uintptr_t)infix->left * FNV_PRIME) ^
+                    (uintptr_t)infix->right ^ infix->operation;
+        break;
+    }
+    case CALL_EXPRESSION: {
+        CallExpression *call = expr->expression.call_expression;
+        fields[2] = call->keyword;
+        for (int i = 0; i < call->num_arguments; i++) {
+            fields[2] = (fields[2] * FNV_PRIME) ^ (uintptr_t)call->arguments[i];
+        }
+        break;
+    }
+    }
+    for (int i = 0; i < 3; i++) {
+        hash = (hash ^ fields[i]) * FNV_PRIME;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+int expressions_equal(Expression *a, Expression *b) {
+    if (a->type != b->type || a->slot != b->slot) {
+        return 0;
+    }
+    switch (a->type) {
+    case NUMBER_LITERAL:
+        return memcmp(&a->expression.number_literal->value,
+                      &b->expression.number_literal->value,
+                      sizeof(double)) == 0;
+    case IDENTIFIER:
+        return a->expression.identifier->keyword ==
+               b->expression.identifier->keyword;
+    case PREFIX_EXPRESSION:
+        return a->expression.prefix_expression->operation ==
+                   b->expression.prefix_expression->operation &&
+               a->expression.prefix_expression->right ==
+                   b->expression.prefix_expression->right;
+    case INFIX_EXPRESSION: {
+        InfixExpression *x = a->expression.infix_expression;
+        InfixExpression *y = b->expression.infix_expression;
+        return x->operation == y->operation && x->left == y->left &&
+               x->right == y->right;
+    }
+    case CALL_EXPRESSION: {
+        CallExpression *x = a->expression.call_expression;
+        CallExpression *y = b->expression.call_expression;
+        if (x->keyword != y->keyword || x->num_arguments != y->num_arguments ||
+            x->num_invariants != y->num_invariants) {
+            return 0;
+        }
+        for (int i = 0; i < x->num_arguments; i++) {
+            if (x->arguments[i] != y->arguments[i]) {
+                return 0;
+            }
+        }
+        for (int i = 0; i < x->num_invariants; i++) {
+            if (x->invariants[i] != y->invariants[i]) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    default:
+        return 0;
+    }
+}
+
+size_t count_nodes(Expression *expr) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    size_t n = 0;
+    while (s.num_frames > 0) {
+        Expression *node = s.frames[--s.num_frames].expr;
+        n++;
+        for (int k = 0; k < expression_num_children(node); k++) {
+            expression_stack_push(&s, expression_child(node, k));
+        }
+    }
+    free_expression_stack(&s);
+    return n;
+}
+
+// Adds one reference per parent edge; each node's children are visited
+// on its first reference only. A sum's invariant list counts as a parent.
+// Interior nodes get their SharedNode from arena on their second.
+void count_references(Expression *expr, Arena *arena) {
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        Expression *node = s.frames[--s.num_frames].expr;
+        for (int k = 0; k < expression_num_children(node); k++) {
+            Expression *child = expression_child(node, k);
+            add_reference(child, arena);
+            if (child->refs == 1) {
+                expression_stack_push(&s, child);
+            }
+        }
+        if (node->type == CALL_EXPRESSION) {
+            // invariants are also reached through the body, after which
+            // their children have been counted
+            CallExpression *call = node->expression.call_expression;
+            for (int i = 0; i < call->num_invariants; i++) {
+                add_reference(call->invariants[i], arena);
+            }
+        }
+    }
+    free_expression_stack(&s);
+}
+
+// Leaves are as cheap to evaluate again as to reuse, so they are never
+// shared.
+void add_reference(Expression *expr, Arena *arena) {
+    if (++expr->refs != 2 || expr->type == NUMBER_LITERAL ||
+        expr->type == IDENTIFIER) {
+        return;
+    }
+    expr->shared = (SharedNode *)arena_alloc(arena, sizeof(SharedNode));
+    assertNotNull(expr->shared);
+    expr->shared->temp = -1;
+    expr->shared->temp_scope = NULL;
+    expr->shared->memo_epoch = 0;
+}
+
+int is_shared(Expression *expr) { return expr->shared != NULL; }
@@ -0,0 +1,24 @@
+#ifndef CSE_H
+#define CSE_H
+
+#include "arena.h"
+#include "ast.h"
+#include <stdint.h>
+
+// Open-addressing set of canonical nodes, keyed by structure.
+typedef struct {
+    Expression **entries;
+    size_t capacity; // power of two
+} ConsTable;
+
+Expression *hash_cons(Expression *expr, Arena *arena);
+Expression *cons_node(Expression *expr, ConsTable *table);
+Expression *cons_lookup(Expression *expr, ConsTable *table);
+uint64_t expression_hash(Expression *expr);
+int expressions_equal(Expression *a, Expression *b);
+size_t count_nodes(Expression *expr);
+void count_references(Expression *expr, Arena *arena);
+void add_reference(Expression *expr, Arena *arena);
+int is_shared(Expression *expr);
+
+#endif
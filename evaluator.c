@@ -1,31 +1,152 @@
 #include "evaluator.h"
 #include "ast.h"
+#include "closedform.h"
+#include "cse.h"
+#include "parallel.h"
+#include "stats.h"
 #include "util.h"
 #include <errno.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
-char keywords[NUM_KEYWORDS][MAX_KEYWORD_LEN] = {
-    "sqrt", "rootn", "log",  "logn", "ln", "sin", "cos", "tan",
-    "asin", "acos",  "atan", "sum",  "pi", "e",   "ans", "i"};
-KeywordType keyword_types[NUM_KEYWORDS] = {
-    SQRT, ROOTN, LOG,  LOGN,   LN, SIN, COS, TAN,
-    ASIN, ACOS,  ATAN, KW_SUM, PI, E,   ANS, I};
-int keyword_num_args[NUM_KEYWORDS] = {1, 2, 1, 2, 1, 1, 1, 1,
-                                      1, 1, 1, 3, 0, 1, 0, 0};
+// Bumped whenever i changes, which invalidates memoized common
+// subexpressions; starts past the 0 that new nodes carry.
+_Thread_local unsigned long eval_epoch = 1;
 
-KeywordType lookup_keyword(char *keyword, size_t length) {
-    for (int i = 0; i < NUM_KEYWORDS; i++) {
-        char *kw = keywords[i];
-        if (strncmp(keyword, kw, length) == 0) {
-            return keyword_types[i];
-        }
+double eval(Expression *expr, double env_vars[NUM_ENV_VARS]) {
+    assertNotNull(expr);
+    if (expr->slot >= 0) {
+        return env_vars[expr->slot]; // variable or hoisted invariant
+    }
+    if (!is_shared(expr)) {
+        return eval_uncached(expr, env_vars);
     }
-    return -1;
+    SharedNode *shared = expr->shared;
+    if (shared->memo_epoch == eval_epoch) {
+        return shared->memo; // common subexpression, already computed
+    }
+    double x = eval_uncached(expr, env_vars);
+    shared->memo = x;
+    shared->memo_epoch = eval_epoch;
+    return x;
 }
 
-double eval(Expression *expr, double env_vars[NUM_ENV_VARS]) {
+// Trees up to EVAL_RECURSION_DEPTH deep are walked recursively, which is
+// the fastest for the common small expression; deeper ones by eval_deep.
+double eval_uncached(Expression *expr, double env_vars[NUM_ENV_VARS]) {
     assertNotNull(expr);
+    if (expr->depth > EVAL_RECURSION_DEPTH) {
+        return eval_deep(expr, env_vars);
+    }
+    double operands[MAX_BUILTIN_ARGS];
+    int n = 0;
+    Expression *operand;
+    while (n < MAX_BUILTIN_ARGS &&
+           (operand = eval_next_operand(expr, n)) != NULL) {
+        operands[n++] = eval(operand, env_vars);
+    }
+    return eval_node(expr, operands, env_vars);
+}
+
+// Post-order walk with explicit stacks: a node's frame stays on s.nodes
+// while its operands are evaluated one by one onto s.values, so the depth
+// of the tree costs heap memory instead of C stack. Shallow operands are
+// left to eval, and sum() bodies to nested calls, one level of C stack per
+// nested sum().
+double eval_deep(Expression *expr, double env_vars[NUM_ENV_VARS]) {
+    EvalStack s;
+    init_expression_stack(&s.nodes);
+    s.values = s.small;
+    s.num_values = 0;
+    s.capacity = EXPRESSION_STACK_SIZE;
+    expression_stack_push(&s.nodes, expr);
+    while (s.nodes.num_frames > 0) {
+        ExpressionFrame *f = &s.nodes.frames[s.nodes.num_frames - 1];
+        Expression *node = f->expr;
+        Expression *operand = eval_next_operand(node, f->step);
+        while (operand != NULL && eval_operand(&s, operand, env_vars)) {
+            operand = eval_next_operand(node, ++f->step);
+        }
+        if (operand != NULL) {
+            f->step++;
+            expression_stack_push(&s.nodes, operand);
+            continue;
+        }
+        s.num_values -= f->step;
+        double x = eval_node(node, s.values + s.num_values, env_vars);
+        s.nodes.num_frames--;
+        if (s.nodes.num_frames > 0 && is_shared(node)) {
+            node->shared->memo = x;
+            node->shared->memo_epoch = eval_epoch;
+        }
+        eval_push_value(&s, x);
+    }
+    free_expression_stack(&s.nodes);
+    double x = s.values[0];
+    if (s.values != s.small) {
+        safe_free((void **)&s.values);
+    }
+    return x;
+}
+
+// Operand number k of expr, NULL after the last one. sum() has none here,
+// eval_sum evaluates its own arguments.
+Expression *eval_next_operand(Expression *expr, int k) {
+    switch (expr->type) {
+    case PREFIX_EXPRESSION:
+        return k == 0 ? expr->expression.prefix_expression->right : NULL;
+    case INFIX_EXPRESSION:
+        return k == 0   ? expr->expression.infix_expression->left
+               : k == 1 ? expr->expression.infix_expression->right
+                        : NULL;
+    case CALL_EXPRESSION:
+        return expr->expression.call_expression->keyword != KW_SUM &&
+                       k < expr->expression.call_expression->num_arguments
+                   ? expr->expression.call_expression->arguments[k]
+                   : NULL;
+    default:
+        return NULL;
+    }
+}
+
+// Pushes the value of an operand that is known without walking it or
+// shallow enough for eval. Returns 0 for one that needs a frame of its own.
+int eval_operand(EvalStack *s, Expression *expr,
+                 double env_vars[NUM_ENV_VARS]) {
+    double x;
+    if (expr->slot >= 0) {
+        x = env_vars[expr->slot]; // variable or hoisted invariant
+    } else if (is_shared(expr) && expr->shared->memo_epoch == eval_epoch) {
+        x = expr->shared->memo; // common subexpression, already computed
+    } else if (expr->depth <= EVAL_RECURSION_DEPTH) {
+        x = eval(expr, env_vars);
+    } else {
+        return 0;
+    }
+    eval_push_value(s, x);
+    return 1;
+}
+
+void eval_push_value(EvalStack *s, double x) {
+    if (s->num_values == s->capacity) {
+        size_t size = s->capacity * sizeof(double);
+        double *values =
+            (double *)(s->values == s->small ? malloc(2 * size)
+                                             : realloc(s->values, 2 * size));
+        assertNotNull(values);
+        if (s->values == s->small) {
+            memcpy(values, s->small, size);
+        }
+        s->values = values;
+        s->capacity *= 2;
+    }
+    s->values[s->num_values++] = x;
+}
+
+// Value of expr from the values of its operands.
+double eval_node(Expression *expr, double *operands,
+                 double env_vars[NUM_ENV_VARS]) {
     switch (expr->type) {
     case NUMBER_LITERAL:
         return expr->expression.number_literal->value;
@@ -34,14 +155,18 @@ double eval(Expression *expr, double env_vars[NUM_ENV_VARS]) {
                                           env_vars);
     case PREFIX_EXPRESSION:
         // only MINUS operator
-        return -eval(expr->expression.prefix_expression->right, env_vars);
+        return -operands[0];
     case INFIX_EXPRESSION:
-        return eval_infix_expression(expr->expression.infix_expression,
-                                     env_vars);
+        return eval_operator(expr->expression.infix_expression->operation,
+                             operands[0], operands[1]);
     case CALL_EXPRESSION:
-        return eval_call_expression(expr->expression.call_expression, env_vars);
+        if (expr->expression.call_expression->keyword == KW_SUM) {
+            return eval_sum(expr->expression.call_expression, env_vars);
+        }
+        return eval_builtin(expr->expression.call_expression->keyword,
+                            operands);
     default:
-        printf("Error: Invalid Expression node.\n");
+        report_error("Error: Invalid Expression node.\n");
         errno = EINVAL;
         return 0.0;
     }
@@ -50,8 +175,11 @@ double eval(Expression *expr, double env_vars[NUM_ENV_VARS]) {
 double eval_identifier_expression(Identifier *expr,
                                   double env_vars[NUM_ENV_VARS]) {
     assertNotNull(expr);
-    KeywordType kw = lookup_keyword(expr->value, expr->length);
-    switch (kw) {
+    return eval_keyword(expr->keyword, env_vars);
+}
+
+double eval_keyword(KeywordType keyword, double env_vars[NUM_ENV_VARS]) {
+    switch (keyword) {
     case PI:
         return M_PI;
     case E:
@@ -61,7 +189,7 @@ double eval_identifier_expression(Identifier *expr,
     case I:
         return env_vars[ENV_I];
     default:
-        printf("Error: Invalid Identifier node.\n");
+        report_error("Error: Invalid Identifier node.\n");
         errno = EINVAL;
         return 0.0;
     }
@@ -72,85 +200,100 @@ double eval_infix_expression(InfixExpression *expr,
     assertNotNull(expr);
     double left = eval(expr->left, env_vars);
     double right = eval(expr->right, env_vars);
-    char *op = expr->op;
-    int op_len = expr->token->length;
-    if (strncmp(op, "+", op_len) == 0) {
-        return left + right;
-    } else if (strncmp(op, "-", op_len) == 0) {
-        return left - right;
-    } else if (strncmp(op, "*", op_len) == 0) {
-        return left * right;
-    } else if (strncmp(op, "/", op_len) == 0) {
-        return left / right;
-    } else if (strncmp(op, "^", op_len) == 0) {
-        return pow(left, right);
-    }
-    printf("Error: Invalid infix expression.\n");
-    errno = EINVAL;
-    return 0.0;
+    return eval_operator(expr->operation, left, right);
 }
 
 double eval_call_expression(CallExpression *expr,
                             double env_vars[NUM_ENV_VARS]) {
     assertNotNull(expr);
-    double x, n;
-    KeywordType kw =
-        lookup_keyword(expr->function->expression.identifier->token->literal,
-                       expr->function->expression.identifier->token->length);
-    if ((int)kw == -1) {
-        printf("Error: Invalid call expression '%s'.\n",
-               expr->function->expression.identifier->token->literal);
-        errno = EINVAL;
-        return 0.0;
+    if (expr->keyword == KW_SUM) {
+        return eval_sum(expr, env_vars);
     }
-    if (expr->num_arguments != keyword_num_args[kw]) {
-        printf("Error: Invalid number of arguments in %s call expression.\n",
-               keywords[kw]);
+    double args[MAX_BUILTIN_ARGS] = {0.0, 0.0};
+    for (int i = 0; i < expr->num_arguments && i < MAX_BUILTIN_ARGS; i++) {
+        args[i] = eval(expr->arguments[i], env_vars);
+    }
+    return eval_builtin(expr->keyword, args);
+}
+
+double eval_operator(Operator op, double left, double right) {
+    switch (op) {
+    case ADD:
+        return left + right;
+    case SUBTRACT:
+        return left - right;
+    case MULTIPLY:
+        return left * right;
+    case DIVIDE:
+        return left / right;
+    case POWER:
+        return pow(left, right);
+    default:
+        report_error("Error: Invalid infix expression.\n");
         errno = EINVAL;
         return 0.0;
     }
+}
 
-    switch (kw) {
+double eval_builtin(KeywordType keyword, double *args) {
+    // keyword and arity were checked by resolve_expression
+    switch (keyword) {
     case SQRT:
-        return sqrt(eval(expr->arguments[0], env_vars));
+        return sqrt(args[0]);
     case ROOTN:
-        x = eval(expr->arguments[0], env_vars);
-        n = eval(expr->arguments[1], env_vars);
-        return pow(x, 1 / n);
+        return pow(args[0], 1 / args[1]);
     case LOG:
-        return log(eval(expr->arguments[0], env_vars)) / log(10);
+        return log(args[0]) / log(10);
     case LOGN:
-        x = eval(expr->arguments[0], env_vars);
-        n = eval(expr->arguments[1], env_vars);
-        return log(x) / log(n);
+        return log(args[0]) / log(args[1]);
     case LN:
-        return log(eval(expr->arguments[0], env_vars));
+        return log(args[0]);
     case E:
-        return pow(M_E, eval(expr->arguments[0], env_vars));
+        return pow(M_E, args[0]);
     case SIN:
-        return sin(eval(expr->arguments[0], env_vars));
+        return sin(args[0]);
     case COS:
-        return cos(eval(expr->arguments[0], env_vars));
+        return cos(args[0]);
     case TAN:
-        return tan(eval(expr->arguments[0], env_vars));
+        return tan(args[0]);
     case ASIN:
-        return asin(eval(expr->arguments[0], env_vars));
+        return asin(args[0]);
     case ACOS:
-        return acos(eval(expr->arguments[0], env_vars));
+        return acos(args[0]);
     case ATAN:
-        return atan(eval(expr->arguments[0], env_vars));
-    case KW_SUM:
-        x = 0;
-        int start = (int)eval(expr->arguments[0], env_vars);
-        int end = (int)eval(expr->arguments[1], env_vars);
-        for (int i = start; i <= end; i++) {
-            env_vars[ENV_I] = i;
-            x += eval(expr->arguments[2], env_vars);
-        }
-        return x;
+        return atan(args[0]);
     default:
-        printf("Error: Invalid call expression node.\n");
+        report_error("Error: Invalid call expression node.\n");
         errno = EINVAL;
         return 0.0;
     }
 }
+
+double eval_sum(CallExpression *expr, double env_vars[NUM_ENV_VARS]) {
+    assertNotNull(expr);
+    double x = 0;
+    double n = env_vars[ENV_I]; // restored so nested sums keep the outer i
+    long long start = sum_bound(eval(expr->arguments[0], env_vars));
+    long long end = sum_bound(eval(expr->arguments[1], env_vars));
+    ClosedForm *f = expr->closed_form;
+    if (f != NULL && !closed_form_checks(start, end)) {
+        return closed_form_sum(f, start, end);
+    }
+    STATS_COUNT(COUNTER_ITERATIONS, end >= start ? end - start + 1 : 0);
+    for (int k = 0; k < expr->num_invariants; k++) {
+        Expression *invariant = expr->invariants[k];
+        env_vars[invariant->slot] = eval_uncached(invariant, env_vars);
+    }
+    for (long long i = start; i <= end; i++) {
+        env_vars[ENV_I] = (double)i;
+        eval_epoch++; // memoized values may depend on i
+        x += eval(expr->arguments[2], env_vars);
+    }
+    env_vars[ENV_I] = n;
+    eval_epoch++;
+    if (f != NULL) {
+        return closed_form_check(f, start, end,
+                                 closed_form_sum(f, start, end), x);
+    }
+    return x;
+}
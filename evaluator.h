@@ -4,42 +4,42 @@
 #include "ast.h"
 
 #define NUM_ENV_VARS 2
-#define NUM_KEYWORDS 16
-#define MAX_KEYWORD_LEN 6
-
-typedef enum {
-    SQRT,
-    ROOTN,
-    LOG,
-    LOGN,
-    LN,
-    SIN,
-    COS,
-    TAN,
-    ASIN,
-    ACOS,
-    ATAN,
-    KW_SUM,
-    PI,
-    E,
-    ANS,
-    I,
-} KeywordType;
-
-extern char keywords[NUM_KEYWORDS][MAX_KEYWORD_LEN];
-extern KeywordType keyword_types[NUM_KEYWORDS];
-extern int keyword_num_args[NUM_KEYWORDS];
-
-KeywordType lookup_keyword(char *keyword, size_t length);
+#define MAX_BUILTIN_ARGS 2 // of every builtin but sum()
+#define EVAL_RECURSION_DEPTH 64 // deeper trees are walked by eval_deep
+
+// Nodes waiting for their operands and the operand values computed so far.
+// Like the frames, the first EXPRESSION_STACK_SIZE values are kept in the
+// struct.
+typedef struct {
+    ExpressionStack nodes;
+    double *values;
+    size_t num_values;
+    size_t capacity;
+    double small[EXPRESSION_STACK_SIZE];
+} EvalStack;
 
 double eval(Expression *expr, double env_vars[NUM_ENV_VARS]);
+double eval_uncached(Expression *expr, double env_vars[NUM_ENV_VARS]);
+double eval_deep(Expression *expr, double env_vars[NUM_ENV_VARS]);
+Expression *eval_next_operand(Expression *expr, int k);
+int eval_operand(EvalStack *s, Expression *expr,
+                 double env_vars[NUM_ENV_VARS]);
+double eval_node(Expression *expr, double *operands,
+                 double env_vars[NUM_ENV_VARS]);
 double eval_identifier_expression(Identifier *expr,
                                   double env_vars[NUM_ENV_VARS]);
+double eval_keyword(KeywordType keyword, double env_vars[NUM_ENV_VARS]);
 double eval_infix_expression(InfixExpression *expr,
                              double env_vars[NUM_ENV_VARS]);
 double eval_call_expression(CallExpression *expr,
                             double env_vars[NUM_ENV_VARS]);
+double eval_operator(Operator op, double left, double right);
+double eval_builtin(KeywordType keyword, double *args);
+double eval_sum(CallExpression *expr, double env_vars[NUM_ENV_VARS]);
+void eval_push_value(EvalStack *s, double x);
 
 typedef enum { ENV_ANS, ENV_I } Environment;
 
+extern _Thread_local unsigned long eval_epoch;
+
 #endif
@@ -0,0 +1,294 @@
+#include "flat.h"
+#include "parallel.h"
+#include "util.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+void init_flat_tree(FlatTree *t) {
+    assertNotNull(t);
+    memset(t, 0, sizeof(FlatTree));
+    t->root = FLAT_NONE;
+}
+
+// Empties the pool but keeps its arrays for the next tree.
+void flat_tree_reset(FlatTree *t) {
+    assertNotNull(t);
+    t->num_nodes = 0;
+    t->num_values = 0;
+    t->num_args = 0;
+    t->root = FLAT_NONE;
+    t->max_stack = 0;
+}
+
+void free_flat_tree(FlatTree *t) {
+    if (t == NULL) {
+        return;
+    }
+    safe_free((void **)&t->kinds);
+    safe_free((void **)&t->ops);
+    safe_free((void **)&t->lhs);
+    safe_free((void **)&t->rhs);
+    safe_free((void **)&t->values);
+    safe_free((void **)&t->args);
+    safe_free((void **)&t->stack);
+    init_flat_tree(t);
+}
+
+// Appends a node; returns FLAT_NONE once the pool has as many nodes as a
+// NodeIndex can address.
+NodeIndex flat_add_node(FlatTree *t, ExpressionType kind, int op,
+                        NodeIndex lhs, NodeIndex rhs) {
+    assertNotNull(t);
+    if (t->num_nodes >= FLAT_NONE) {
+        report_error("Error: Expression too large.\n");
+        errno = EINVAL;
+        return FLAT_NONE;
+    }
+    if (t->num_nodes == t->capacity) {
+        size_t cap = t->capacity > 0 ? 2 * t->capacity : FLAT_INITIAL_CAPACITY;
+        t->kinds = (unsigned char *)realloc(t->kinds, cap);
+        t->ops = (unsigned char *)realloc(t->ops, cap);
+        t->lhs = (NodeIndex *)realloc(t->lhs, cap * sizeof(NodeIndex));
+        t->rhs = (NodeIndex *)realloc(t->rhs, cap * sizeof(NodeIndex));
+        assertNotNull(t->kinds);
+        assertNotNull(t->ops);
+        assertNotNull(t->lhs);
+        assertNotNull(t->rhs);
+        t->capacity = cap;
+    }
+    NodeIndex k = (NodeIndex)t->num_nodes++;
+    t->kinds[k] = (unsigned char)kind;
+    t->ops[k] = (unsigned char)op;
+    t->lhs[k] = lhs;
+    t->rhs[k] = rhs;
+    return k;
+}
+
+// Index of a new literal value, for a NUMBER_LITERAL node's lhs.
+NodeIndex flat_add_value(FlatTree *t, double value) {
+    assertNotNull(t);
+    if (t->num_values == t->values_capacity) {
+        size_t cap = t->values_capacity > 0 ? 2 * t->values_capacity
+                                            : FLAT_INITIAL_CAPACITY;
+        t->values = (double *)realloc(t->values, cap * sizeof(double));
+        assertNotNull(t->values);
+        t->values_capacity = cap;
+    }
+    t->values[t->num_values] = value;
+    return (NodeIndex)t->num_values++;
+}
+
+// Index of the first of n new call arguments, for a CALL_EXPRESSION
+// node's lhs.
+NodeIndex flat_add_args(FlatTree *t, const NodeIndex *args, int n) {
+    assertNotNull(t);
+    while (t->num_args + n > t->args_capacity) {
+        size_t cap = t->args_capacity > 0 ? 2 * t->args_capacity
+                                          : FLAT_INITIAL_CAPACITY;
+        t->args = (NodeIndex *)realloc(t->args, cap * sizeof(NodeIndex));
+        assertNotNull(t->args);
+        t->args_capacity = cap;
+    }
+    memcpy(t->args + t->num_args, args, n * sizeof(NodeIndex));
+    t->num_args += n;
+    return (NodeIndex)(t->num_args - n);
+}
+
+// Appends the node for expr, whose operands are already in the pool. A
+// sum() gets its start and end; its body is set by flat_from_expression.
+NodeIndex flat_add_expression(FlatTree *t, Expression *expr,
+                              const NodeIndex *operands) {
+    assertNotNull(t);
+    assertNotNull(expr);
+    switch (expr->type) {
+    case NUMBER_LITERAL:
+        return flat_add_node(
+            t, NUMBER_LITERAL, 0,
+            flat_add_value(t, expr->expression.number_literal->value), 0);
+    case IDENTIFIER:
+        if (expr->slot >= 0) { // named variable
+            return flat_add_node(t, FLAT_ENV_SLOT, 0, (NodeIndex)expr->slot,
+                                 0);
+        }
+        if ((int)expr->expression.identifier->keyword < 0) {
+            break; // resolve_expression has reported it
+        }
+        return flat_add_node(t, IDENTIFIER,
+                             expr->expression.identifier->keyword, 0, 0);
+    case PREFIX_EXPRESSION:
+        return flat_add_node(t, PREFIX_EXPRESSION,
+                             expr->expression.prefix_expression->operation,
+                             operands[0], 0);
+    case INFIX_EXPRESSION:
+        return flat_add_node(t, INFIX_EXPRESSION,
+                             expr->expression.infix_expression->operation,
+                             operands[0], operands[1]);
+    case CALL_EXPRESSION: {
+        CallExpression *call = expr->expression.call_expression;
+        if ((int)call->keyword < 0 ||
+            (call->keyword == KW_SUM && call->num_arguments != 3)) {
+            break;
+        }
+        if (call->keyword != KW_SUM) {
+            return flat_add_node(
+                t, CALL_EXPRESSION, call->keyword,
+                flat_add_args(t, operands, call->num_arguments),
+                call->num_arguments);
+        }
+        // the body and its last node come later
+        NodeIndex args[4] = {operands[0], operands[1], FLAT_NONE, FLAT_NONE};
+        return flat_add_node(t, CALL_EXPRESSION, KW_SUM,
+                             flat_add_args(t, args, 4), 3);
+    }
+    default:
+        break;
+    }
+    report_error("Error: Invalid Expression node.\n");
+    errno = EINVAL;
+    return FLAT_NONE;
+}
+
+// Converts a resolved tree into t, replacing what it held, with an
+// explicit stack so any depth converts. Hoisted invariants are evaluated
+// in place and common subexpressions get a copy per use. Returns 0 on an
+// invalid node.
+int flat_from_expression(FlatTree *t, Expression *expr) {
+    assertNotNull(t);
+    assertNotNull(expr);
+    flat_tree_reset(t);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    // converted operands not yet used by their parent
+    NodeIndex *done = NULL;
+    size_t num_done = 0;
+    size_t done_capacity = 0;
+    size_t height = 0; // of flat_eval's stack after the nodes so far
+    int ok = 1;
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        Expression *node = f->expr;
+        int is_sum = node->type == CALL_EXPRESSION &&
+                     node->expression.call_expression->keyword == KW_SUM;
+        int n = is_sum ? 2 : expression_num_children(node);
+        if (f->step < n) {
+            expression_stack_push(&s, expression_child(node, f->step++));
+            continue;
+        }
+        if (is_sum && f->step > n) { // the body follows the call
+            NodeIndex *args = t->args + t->lhs[done[num_done - 2]];
+            args[2] = done[--num_done];
+            args[3] = (NodeIndex)(t->num_nodes - 1);
+            height--; // added into the sum
+            s.num_frames--;
+            continue;
+        }
+        num_done -= n;
+        NodeIndex k = flat_add_expression(t, node, done + num_done);
+        if (k == FLAT_NONE) {
+            ok = 0;
+            break;
+        }
+        if (num_done == done_capacity) {
+            done_capacity =
+                done_capacity > 0 ? 2 * done_capacity : FLAT_INITIAL_CAPACITY;
+            done = (NodeIndex *)realloc(done,
+                                        done_capacity * sizeof(NodeIndex));
+            assertNotNull(done);
+        }
+        done[num_done++] = k;
+        height = height + 1 - n;
+        if (height > t->max_stack) {
+            t->max_stack = height;
+        }
+        if (is_sum) {
+            f->step++;
+            expression_stack_push(&s, expression_child(node, 2));
+            continue;
+        }
+        s.num_frames--;
+    }
+    free_expression_stack(&s);
+    if (ok) {
+        t->root = done[0];
+        t->stack = (double *)realloc(t->stack, t->max_stack * sizeof(double));
+        assertNotNull(t->stack);
+    } else {
+        flat_tree_reset(t);
+    }
+    safe_free((void **)&done);
+    return ok;
+}
+
+double flat_eval(FlatTree *t, double env_vars[NUM_ENV_VARS]) {
+    assertNotNull(t);
+    if (t->num_nodes == 0) {
+        report_error("Error: Empty flat tree.\n");
+        errno = EINVAL;
+        return 0.0;
+    }
+    flat_eval_range(t, 0, (NodeIndex)(t->num_nodes - 1), 0, env_vars);
+    return t->stack[0];
+}
+
+// Evaluates nodes first to last in order on t->stack, which holds sp
+// values before them. Returns the height after, one more when the range
+// is a whole subtree.
+size_t flat_eval_range(FlatTree *t, NodeIndex first, NodeIndex last,
+                       size_t sp, double env_vars[NUM_ENV_VARS]) {
+    double *stack = t->stack;
+    for (NodeIndex k = first; k <= last; k++) {
+        switch (t->kinds[k]) {
+        case NUMBER_LITERAL:
+            stack[sp++] = t->values[t->lhs[k]];
+            break;
+        case IDENTIFIER:
+            stack[sp++] = eval_keyword(t->ops[k], env_vars);
+            break;
+        case FLAT_ENV_SLOT:
+            stack[sp++] = env_vars[t->lhs[k]];
+            break;
+        case PREFIX_EXPRESSION:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        case INFIX_EXPRESSION:
+            sp--;
+            stack[sp - 1] = eval_operator(t->ops[k], stack[sp - 1], stack[sp]);
+            break;
+        case CALL_EXPRESSION:
+            if (t->ops[k] == KW_SUM) {
+                sp -= 2;
+                stack[sp] = flat_eval_sum(t, k, sp, env_vars);
+                sp++;
+                k = t->args[t->lhs[k] + 3]; // past the body
+                break;
+            }
+            sp -= t->rhs[k];
+            stack[sp] = eval_builtin(t->ops[k], stack + sp);
+            sp++;
+            break;
+        default:
+            break;
+        }
+    }
+    return sp;
+}
+
+// Loops over the body after the sum() node call, whose start and end are
+// at stack[sp] and stack[sp + 1]; one level of C stack per nested sum().
+double flat_eval_sum(FlatTree *t, NodeIndex call, size_t sp,
+                     double env_vars[NUM_ENV_VARS]) {
+    double x = 0;
+    double n = env_vars[ENV_I]; // restored so nested sums keep the outer i
+    long long start = sum_bound(t->stack[sp]);
+    long long end = sum_bound(t->stack[sp + 1]);
+    NodeIndex last = t->args[t->lhs[call] + 3];
+    for (long long i = start; i <= end; i++) {
+        env_vars[ENV_I] = (double)i;
+        flat_eval_range(t, call + 1, last, sp, env_vars);
+        x += t->stack[sp];
+    }
+    env_vars[ENV_I] = n;
+    return x;
+}
@@ -0,0 +1,62 @@
+#ifndef FLAT_H
+#define FLAT_H
+
+#include "ast.h"
+#include "evaluator.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLAT_NONE UINT32_MAX
+#define FLAT_INITIAL_CAPACITY 64
+#define FLAT_ENV_SLOT (CALL_EXPRESSION + 1) // node kind, see FlatTree
+
+typedef uint32_t NodeIndex;
+
+// An expression tree as parallel arrays in one growable pool. Node k is
+// kinds[k] (an ExpressionType), ops[k], lhs[k] and rhs[k]:
+//   NUMBER_LITERAL     lhs indexes values
+//   IDENTIFIER         op is the keyword
+//   FLAT_ENV_SLOT      lhs is the env_vars slot of a named variable
+//   PREFIX_EXPRESSION  op is NEGATE, lhs the operand
+//   INFIX_EXPRESSION   op is the Operator, lhs and rhs the operands
+//   CALL_EXPRESSION    op is the keyword, args[lhs...] its rhs arguments
+// Operands come before the node that uses them, so the nodes evaluate in
+// index order on a value stack. A sum() body comes right after its call
+// node instead, for the call to loop over: args[lhs + 2] is the body and
+// args[lhs + 3] the last node after the call that belongs to it.
+// A node takes 10 bytes, an Expression and its payload 80 to 120.
+typedef struct {
+    unsigned char *kinds;
+    unsigned char *ops;
+    NodeIndex *lhs;
+    NodeIndex *rhs;
+    size_t num_nodes;
+    size_t capacity;
+    double *values; // of the number literals
+    size_t num_values;
+    size_t values_capacity;
+    NodeIndex *args; // of the calls
+    size_t num_args;
+    size_t args_capacity;
+    NodeIndex root;
+    double *stack; // for flat_eval, max_stack values
+    size_t max_stack;
+} FlatTree;
+
+void init_flat_tree(FlatTree *t);
+void flat_tree_reset(FlatTree *t);
+void free_flat_tree(FlatTree *t);
+NodeIndex flat_add_node(FlatTree *t, ExpressionType kind, int op,
+                        NodeIndex lhs, NodeIndex rhs);
+NodeIndex flat_add_value(FlatTree *t, double value);
+NodeIndex flat_add_args(FlatTree *t, const NodeIndex *args, int n);
+NodeIndex flat_add_expression(FlatTree *t, Expression *expr,
+                              const NodeIndex *operands);
+int flat_from_expression(FlatTree *t, Expression *expr);
+double flat_eval(FlatTree *t, double env_vars[NUM_ENV_VARS]);
+size_t flat_eval_range(FlatTree *t, NodeIndex first, NodeIndex last,
+                       size_t sp, double env_vars[NUM_ENV_VARS]);
+double flat_eval_sum(FlatTree *t, NodeIndex call, size_t sp,
+                     double env_vars[NUM_ENV_VARS]);
+
+#endif
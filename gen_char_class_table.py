@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Generates char_class_table.h, the lexer's byte classification tables.
+
+char_classes[c] holds the CHAR_ bits of byte c and drives the scalar scan
+and the tails of the vector scans in lexer.c. char_tokens[c] is the type of
+the one-byte token starting with c: ILLEGAL (0) for bytes that start no
+such token, TOKEN_EOF for the NUL that ends the input and for the newline
+that ends a line in streaming mode.
+
+Usage: python3 gen_char_class_table.py > char_class_table.h
+"""
+
+import string
+
+# Must match the vector classification in lexer.c.
+CLASSES = [
+    ("CHAR_LETTER", string.ascii_letters + "_"),
+    ("CHAR_DIGIT", string.digits),
+    ("CHAR_DOT", "."),
+    ("CHAR_SPACE", " \t\r"),
+    ("CHAR_NEWLINE", "\n"),
+]
+
+TOKENS = [
+    ("\\0", "\0", "TOKEN_EOF"),
+    ("\\n", "\n", "TOKEN_EOF"),
+    ("+", "+", "PLUS"),
+    ("-", "-", "MINUS"),
+    ("*", "*", "ASTERISK"),
+    ("/", "/", "SLASH"),
+    ("^", "^", "CARET"),
+    ("(", "(", "LPAREN"),
+    (")", ")", "RPAREN"),
+    ("{", "{", "LBRACE"),
+    ("}", "}", "RBRACE"),
+    (",", ",", "COMMA"),
+    ("=", "=", "ASSIGN"),
+]
+
+
+def main():
+    print("// Generated by gen_char_class_table.py, do not edit.")
+    print("#ifndef CHAR_CLASS_TABLE_H")
+    print("#define CHAR_CLASS_TABLE_H")
+    print()
+    print('#include "token.h"')
+    print()
+    for bit, (name, _) in enumerate(CLASSES):
+        print(f"#define {name} {1 << bit}")
+    print("#define CHAR_NUMBER (CHAR_DIGIT | CHAR_DOT)")
+    print()
+    classes = [0] * 256
+    for bit, (_, chars) in enumerate(CLASSES):
+        for ch in chars:
+            classes[ord(ch)] |= 1 << bit
+    print("// Byte -> CHAR_ bits, 16 bytes per row.")
+    print("static const unsigned char char_classes[256] = {")
+    for row in range(0, 256, 16):
+        cells = ", ".join(f"{c:2d}" for c in classes[row:row + 16])
+        print(f"    {cells},")
+    print("};")
+    print()
+    print("// Byte -> type of the one-byte token it starts.")
+    print("static const unsigned char char_tokens[256] = {")
+    for literal, _, name in TOKENS:
+        print(f"    ['{literal}'] = {name},")
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
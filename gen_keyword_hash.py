@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Generates keyword_hash.h, a perfect hash over the builtin keywords.
+
+The hash is (len * A + s[0] * B + s[1] * C + s[len - 1]) % KEYWORD_HASH_SIZE
+with s[1] taken as 0 for one-letter keywords. The first multipliers that map
+every keyword to a distinct slot are emitted, so lookup_keyword needs a
+single table probe plus one memcmp.
+
+Usage: python3 gen_keyword_hash.py > keyword_hash.h
+"""
+
+# Must match the order of KeywordType in keyword.h.
+KEYWORDS = ["sqrt", "rootn", "log", "logn", "ln", "sin", "cos", "tan",
+            "asin", "acos", "atan", "sum", "pi", "e", "ans", "i"]
+SIZES = [16, 32, 64]
+
+
+def keyword_hash(k, a, b, c, size):
+    second = ord(k[1]) if len(k) > 1 else 0
+    return (len(k) * a + ord(k[0]) * b + second * c + ord(k[-1])) % size
+
+
+def search():
+    for size in SIZES:
+        for a in range(32):
+            for b in range(32):
+                for c in range(32):
+                    slots = [keyword_hash(k, a, b, c, size) for k in KEYWORDS]
+                    if len(set(slots)) == len(KEYWORDS):
+                        return size, a, b, c, slots
+    raise SystemExit("no perfect hash found")
+
+
+def main():
+    size, a, b, c, slots = search()
+    table = [-1] * size
+    for index, slot in enumerate(slots):
+        table[slot] = index
+    print("// Generated by gen_keyword_hash.py, do not edit.")
+    print("#ifndef KEYWORD_HASH_H")
+    print("#define KEYWORD_HASH_H")
+    print()
+    print(f"#define KEYWORD_HASH_SIZE {size}")
+    print(f"#define KEYWORD_HASH_LEN_MUL {a}")
+    print(f"#define KEYWORD_HASH_FIRST_MUL {b}")
+    print(f"#define KEYWORD_HASH_SECOND_MUL {c}")
+    print()
+    print("// Slot -> index into keywords[], -1 for empty slots.")
+    print("static const signed char keyword_hash_table[KEYWORD_HASH_SIZE] = {")
+    for i in range(0, size, 8):
+        row = ", ".join(f"{v:2d}" for v in table[i:i + 8])
+        print(f"    {row},")
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Generates pow5_table.h, 128-bit approximations of the powers of five.
+
+Entry q holds 5^q scaled by a power of two so that bit 127 is set, split
+into its high and low 64 bits. Nonnegative powers are truncated; negative
+ones are one more than the truncated reciprocal, which is what the
+Eisel-Lemire algorithm in number.c expects. Exponents outside the table
+round to zero or overflow to infinity for any 19-digit mantissa.
+
+Usage: python3 gen_pow5_table.py > pow5_table.h
+"""
+
+MIN_EXPONENT = -342
+MAX_EXPONENT = 308
+
+
+def approximation(q):
+    if q >= 0:
+        power = 5 ** q
+        while power < (1 << 127):
+            power *= 2
+        while power >= (1 << 128):
+            power //= 2
+        return power
+    power = 5 ** -q
+    z = power.bit_length()
+    if q >= -27:
+        return (1 << (z + 127)) // power + 1
+    c = (1 << (2 * z + 128)) // power + 1
+    while c >= (1 << 128):
+        c //= 2
+    return c
+
+
+def main():
+    print("// Generated by gen_pow5_table.py, do not edit.")
+    print("#ifndef POW5_TABLE_H")
+    print("#define POW5_TABLE_H")
+    print()
+    print("#include <stdint.h>")
+    print()
+    print(f"#define POW5_MIN_EXPONENT {MIN_EXPONENT}")
+    print(f"#define POW5_MAX_EXPONENT {MAX_EXPONENT}")
+    print()
+    print("// 5^q scaled to 128 bits as high, low for q = POW5_MIN_EXPONENT...")
+    print("static const uint64_t pow5_table[] = {")
+    for q in range(MIN_EXPONENT, MAX_EXPONENT + 1):
+        c = approximation(q)
+        high, low = c >> 64, c & ((1 << 64) - 1)
+        print(f"    0x{high:016x}, 0x{low:016x}, // {q}")
+    print("};")
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
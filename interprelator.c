@@ -0,0 +1,164 @@
+#include "interprelator.h"
+#include "arena.h"
+#include "closedform.h"
+#include "columnar.h"
+#include "compiler.h"
+#include "cse.h"
+#include "evaluator.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "resolver.h"
+#include "util.h"
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct InterpProgram {
+    Program *prog; // only read after interp_compile returns
+    int uses_ans;
+};
+
+void interp_context_init(InterpContext *ctx) {
+    assertNotNull(ctx);
+    ctx->ans = 0.0;
+    ctx->status = INTERP_OK;
+    ctx->error[0] = '\0';
+}
+
+// Messages reported while the call runs land in errors instead of stdout.
+static void interp_begin(ErrorBuffer *errors) {
+    errors->length = 0;
+    error_buffer = errors;
+}
+
+static InterpStatus interp_end(InterpContext *ctx, ErrorBuffer *errors,
+                               InterpStatus status) {
+    error_buffer = NULL;
+    ctx->status = status;
+    size_t n = status == INTERP_OK ? 0 : errors->length;
+    if (n >= INTERP_ERROR_SIZE) {
+        n = INTERP_ERROR_SIZE - 1;
+    }
+    memcpy(ctx->error, errors->text, n);
+    ctx->error[n] = '\0';
+    return status;
+}
+
+// Runs the same passes as the REPL on its own arena, which is released
+// before returning; the Program owns all its memory. source need not be
+// NUL-terminated.
+InterpProgram *interp_compile(const char *source, size_t length, int flags,
+                              InterpContext *ctx) {
+    assertNotNull((void *)source);
+    assertNotNull(ctx);
+    ErrorBuffer errors;
+    interp_begin(&errors);
+    Arena *arena = new_arena(ARENA_BLOCK_SIZE);
+    Lexer l;
+    Parser p;
+    // the lexer never writes to its input
+    init_lexer(&l, arena, (char *)source, length);
+    init_buffered_parser(&p, &l);
+
+    InterpStatus status = INTERP_OK;
+    InterpProgram *program = NULL;
+    Expression *expr = parse_expression_statement(&p);
+    if (expr == NULL) {
+        if (!p.error_reported) {
+            report_error("Error: Invalid calculator input.\n");
+        }
+        status = INTERP_SYNTAX_ERROR;
+    } else if (!resolve_expression(expr)) {
+        status = INTERP_INVALID;
+    } else {
+        if (flags & INTERP_OPTIMIZE) {
+            expr = fold_expression(expr, arena);
+        }
+        if (closed_form_options.enabled) {
+            find_closed_forms(expr, arena);
+        }
+        hoist_invariants(expr, NUM_ENV_VARS, arena);
+        expr = hash_cons(expr, arena);
+        Program *prog = compile(expr);
+        if (prog == NULL) {
+            status = INTERP_INVALID;
+        } else {
+            program = (InterpProgram *)malloc(sizeof(InterpProgram));
+            assertNotNull(program);
+            program->prog = prog;
+            program->uses_ans = uses_keyword(expr, ANS);
+        }
+    }
+    free_arena(&arena);
+    interp_end(ctx, &errors, status);
+    return program;
+}
+
+InterpStatus interp_eval(const InterpProgram *program, InterpContext *ctx,
+                         double *result) {
+    assertNotNull((void *)program);
+    assertNotNull(ctx);
+    assertNotNull(result);
+    ErrorBuffer errors;
+    interp_begin(&errors);
+    double small[NUM_ENV_VARS + 16];
+    double *env_vars = small;
+    if (program->prog->env_size > NUM_ENV_VARS + 16) {
+        env_vars = (double *)malloc(program->prog->env_size * sizeof(double));
+        assertNotNull(env_vars);
+    }
+    env_vars[ENV_ANS] = ctx->ans;
+    env_vars[ENV_I] = 0.0;
+    *result = vm_run(program->prog, env_vars);
+    ctx->ans = *result;
+    if (env_vars != small) {
+        free(env_vars);
+    }
+    return interp_end(ctx, &errors, INTERP_OK);
+}
+
+// One row per entry of the ans and i columns; either may be NULL, in which
+// case ctx->ans (or 0 for i) is used for every row. ctx->ans is unchanged.
+InterpStatus interp_eval_columns(const InterpProgram *program,
+                                 InterpContext *ctx, const double *ans,
+                                 const double *i, size_t num_rows,
+                                 double *out) {
+    assertNotNull((void *)program);
+    assertNotNull(ctx);
+    ErrorBuffer errors;
+    interp_begin(&errors);
+    Column columns[NUM_ENV_VARS];
+    int num_columns = 0;
+    double *fill = NULL;
+    if (ans == NULL && program->uses_ans && num_rows > 0) {
+        fill = (double *)malloc(num_rows * sizeof(double));
+        assertNotNull(fill);
+        for (size_t row = 0; row < num_rows; row++) {
+            fill[row] = ctx->ans;
+        }
+        ans = fill;
+    }
+    if (ans != NULL) {
+        columns[num_columns++] = (Column){ENV_ANS, ans};
+    }
+    if (i != NULL) {
+        columns[num_columns++] = (Column){ENV_I, i};
+    }
+    int ok = run_columns(program->prog, columns, num_columns, num_rows, out);
+    free(fill);
+    return interp_end(ctx, &errors, ok ? INTERP_OK : INTERP_EVAL_ERROR);
+}
+
+int interp_uses_ans(const InterpProgram *program) {
+    assertNotNull((void *)program);
+    return program->uses_ans;
+}
+
+void interp_free(InterpProgram **program) {
+    if (program == NULL || *program == NULL) {
+        return;
+    }
+    free_program(&(*program)->prog);
+    safe_free((void **)program);
+}
@@ -0,0 +1,48 @@
+#ifndef INTERPRELATOR_H
+#define INTERPRELATOR_H
+
+// Public API of libinterprelator. All functions are reentrant: compiled
+// programs are immutable and may be shared between threads, while each
+// thread evaluates with its own InterpContext.
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define INTERP_API __attribute__((visibility("default")))
+#else
+#define INTERP_API
+#endif
+
+#define INTERP_ERROR_SIZE 512
+#define INTERP_OPTIMIZE 1 // fold constants and simplify, like -O
+
+typedef enum {
+    INTERP_OK,
+    INTERP_SYNTAX_ERROR, // the text is not an expression
+    INTERP_INVALID,      // unknown identifier, wrong arity, ...
+    INTERP_EVAL_ERROR,
+} InterpStatus;
+
+typedef struct InterpProgram InterpProgram;
+
+// Caller-owned evaluation state.
+typedef struct {
+    double ans;            // read by `ans`, set by every successful eval
+    InterpStatus status;   // of the last call
+    char error[INTERP_ERROR_SIZE]; // its messages, "" on success
+} InterpContext;
+
+INTERP_API void interp_context_init(InterpContext *ctx);
+INTERP_API InterpProgram *interp_compile(const char *source, size_t length,
+                                         int flags, InterpContext *ctx);
+INTERP_API InterpStatus interp_eval(const InterpProgram *program,
+                                    InterpContext *ctx, double *result);
+INTERP_API InterpStatus interp_eval_columns(const InterpProgram *program,
+                                            InterpContext *ctx,
+                                            const double *ans,
+                                            const double *i, size_t num_rows,
+                                            double *out);
+INTERP_API int interp_uses_ans(const InterpProgram *program);
+INTERP_API void interp_free(InterpProgram **program);
+
+#endif
@@ -0,0 +1,336 @@
+#include "jit.h"
+#include "batch.h"
+#include "compiler.h"
+#include "evaluator.h"
+#include "util.h"
+#include "vm.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+JitOptions jit_options = {JIT_DEFAULT_THRESHOLD};
+
+// Compiles body the first time a long enough sum needs it. Bodies can be
+// shared between threads (parallel chunks, cached programs), so one thread
+// compiles and the others use the batch VM until the code is published.
+int jit_ready(Program *body) {
+    assertNotNull(body);
+    int state = atomic_load_explicit(&body->jit_state, memory_order_acquire);
+    if (state == JIT_NONE) {
+        int expected = JIT_NONE;
+        if (atomic_compare_exchange_strong(&body->jit_state, &expected,
+                                           JIT_COMPILING)) {
+            state = jit_compile(body) ? JIT_READY : JIT_FAILED;
+            atomic_store_explicit(&body->jit_state, state,
+                                  memory_order_release);
+        }
+    }
+    return state == JIT_READY;
+}
+
+// Same lanes and the same pairwise reduction as batch_sum, and the same
+// operations per lane, so the result is bit-identical to the batch VM.
+double jit_range_sum(void *ctx, long long first, long long last,
+                     double *env_vars) {
+    Program *body = (Program *)ctx;
+    if (last - first + 1 < BATCH_SIZE) {
+        return vm_range_sum(ctx, first, last, env_vars);
+    }
+    _Alignas(32) double acc[BATCH_SIZE] = {0};
+    ((jit_fn *)body->jit_code)(env_vars, acc, first, last);
+    return reduce_lanes(acc);
+}
+
+void jit_free(Program *body) {
+    if (body->jit_code != NULL) {
+        munmap(body->jit_code, body->jit_size);
+        body->jit_code = NULL;
+    }
+}
+
+#if JIT_AVAILABLE
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, R12 = 12,
+       R13 = 13, R14 = 14, R15 = 15 };
+
+#define SSE_F2 0xF2 // scalar double
+#define SSE_66 0x66 // packed double
+#define SSE_MOVSD_LOAD 0x10
+#define SSE_MOVSD_STORE 0x11
+#define SSE_MOVAPD 0x28
+#define SSE_SQRT 0x51
+#define SSE_XOR 0x57
+#define SSE_ADD 0x58
+#define SSE_MUL 0x59
+#define SSE_SUB 0x5C
+#define SSE_DIV 0x5E
+
+// Stack depth d lives in xmm<d>, so the operand stack never touches memory
+// except around libm calls, which clobber every xmm register. Registers:
+// rbx = i, rbp = lane, r12 = constants, r13 = env_vars, r14 = acc,
+// r15 = last. Frame: [rsp + 8d] spills depth d, [rsp + 128 + 8t] holds
+// temporary t.
+int jit_compile(Program *body) {
+    assertNotNull(body);
+    if (!body->batchable || body->max_stack > JIT_MAX_STACK ||
+        body->num_temps > BATCH_MAX_TEMPS) {
+        return 0;
+    }
+    CodeBuffer buf = {NULL, 0, 0};
+    static const unsigned char prologue[] = {
+        0x53,                   // push rbx
+        0x55,                   // push rbp
+        0x41, 0x54,             // push r12
+        0x41, 0x55,             // push r13
+        0x41, 0x56,             // push r14
+        0x41, 0x57,             // push r15
+        0x48, 0x81, 0xEC,       // sub rsp, imm32
+    };
+    emit_bytes(&buf, prologue, sizeof(prologue));
+    emit_u32(&buf, JIT_FRAME_SIZE);
+    static const unsigned char setup[] = {
+        0x49, 0x89, 0xFD, // mov r13, rdi
+        0x49, 0x89, 0xF6, // mov r14, rsi
+        0x48, 0x89, 0xD3, // mov rbx, rdx
+        0x49, 0x89, 0xCF, // mov r15, rcx
+        0x31, 0xED,       // xor ebp, ebp
+        0x49, 0xBC,       // mov r12, imm64
+    };
+    emit_bytes(&buf, setup, sizeof(setup));
+    emit_u64(&buf, (uintptr_t)body->constants);
+    size_t loop = buf.length;
+
+    int d = 0;
+    int ok = 1;
+    for (int k = 0; ok && k < body->num_code; k++) {
+        Instruction ins = body->code[k];
+        switch (ins.op) {
+        case OP_CONST:
+            d++;
+            emit_sse_rm(&buf, SSE_F2, SSE_MOVSD_LOAD, d, R12, 8 * ins.arg);
+            break;
+        case OP_LOAD:
+            d++;
+            if (ins.arg == ENV_I) {
+                emit_sse_rr(&buf, SSE_66, SSE_XOR, d, d);
+                // cvtsi2sd xmm<d>, rbx
+                emit_byte(&buf, 0xF2);
+                emit_byte(&buf, 0x48 | (d >= 8 ? 0x04 : 0));
+                emit_byte(&buf, 0x0F);
+                emit_byte(&buf, 0x2A);
+                emit_byte(&buf, 0xC0 | (d & 7) << 3 | RBX);
+            } else {
+                emit_sse_rm(&buf, SSE_F2, SSE_MOVSD_LOAD, d, R13,
+                            8 * ins.arg);
+            }
+            break;
+        case OP_TEE:
+            emit_sse_rm(&buf, SSE_F2, SSE_MOVSD_STORE, d, RSP,
+                        JIT_TEMPS_OFFSET + 8 * ins.arg);
+            break;
+        case OP_TEMP:
+            d++;
+            emit_sse_rm(&buf, SSE_F2, SSE_MOVSD_LOAD, d, RSP,
+                        JIT_TEMPS_OFFSET + 8 * ins.arg);
+            break;
+        case OP_NEG: {
+            // flip the sign bit, 0 - x would turn -0 into +0
+            unsigned char rex = 0x48 | (d >= 8 ? 0x04 : 0);
+            unsigned char modrm = 0xC0 | (d & 7) << 3 | RAX;
+            unsigned char neg[] = {
+                0x66, rex, 0x0F, 0x7E, modrm, // movq rax, xmm<d>
+                0x48, 0x0F, 0xBA, 0xF8, 0x3F, // btc rax, 63
+                0x66, rex, 0x0F, 0x6E, modrm, // movq xmm<d>, rax
+            };
+            emit_bytes(&buf, neg, sizeof(neg));
+            break;
+        }
+        case OP_ADD:
+            emit_sse_rr(&buf, SSE_F2, SSE_ADD, d - 1, d);
+            d--;
+            break;
+        case OP_SUB:
+            emit_sse_rr(&buf, SSE_F2, SSE_SUB, d - 1, d);
+            d--;
+            break;
+        case OP_MUL:
+            emit_sse_rr(&buf, SSE_F2, SSE_MUL, d - 1, d);
+            d--;
+            break;
+        case OP_DIV:
+            emit_sse_rr(&buf, SSE_F2, SSE_DIV, d - 1, d);
+            d--;
+            break;
+        case OP_POW:
+            if (k > 0 && body->code[k - 1].op == OP_CONST &&
+                body->constants[body->code[k - 1].arg] == 2) {
+                emit_sse_rr(&buf, SSE_F2, SSE_MUL, d - 1, d - 1);
+            } else {
+                emit_call(&buf, (void *)pow, d, 2);
+            }
+            d--;
+            break;
+        case OP_SQRT:
+            emit_sse_rr(&buf, SSE_F2, SSE_SQRT, d, d);
+            break;
+        case OP_ROOTN:
+        case OP_LOG:
+        case OP_LOGN:
+        case OP_LN:
+        case OP_SIN:
+        case OP_COS:
+        case OP_TAN:
+        case OP_ASIN:
+        case OP_ACOS:
+        case OP_ATAN:
+        case OP_EXP:
+            // The batch VM runs these through the vecmath kernels a whole
+            // block at a time, which beats a call per lane from here.
+            ok = 0;
+            break;
+        case OP_RETURN: {
+            // acc[lane] += xmm1; lane = (lane + 1) % 64; loop while i <= last
+            emit_bytes(&buf, (const unsigned char[]){0xF2, 0x41, 0x0F, SSE_ADD,
+                                                     0x0C, 0xEE},
+                       6); // addsd xmm1, [r14 + rbp*8]
+            emit_bytes(&buf, (const unsigned char[]){0xF2, 0x41, 0x0F,
+                                                     SSE_MOVSD_STORE, 0x0C,
+                                                     0xEE},
+                       6); // movsd [r14 + rbp*8], xmm1
+            static const unsigned char step[] = {
+                0xFF, 0xC5,       // inc ebp
+                0x83, 0xE5, 0x3F, // and ebp, 63
+                0x48, 0xFF, 0xC3, // inc rbx
+                0x4C, 0x39, 0xFB, // cmp rbx, r15
+                0x0F, 0x8E,       // jle rel32
+            };
+            emit_bytes(&buf, step, sizeof(step));
+            emit_u32(&buf, (uint32_t)(loop - (buf.length + 4)));
+            emit_bytes(&buf, (const unsigned char[]){0x48, 0x81, 0xC4}, 3);
+            emit_u32(&buf, JIT_FRAME_SIZE); // add rsp, imm32
+            static const unsigned char epilogue[] = {
+                0x41, 0x5F, // pop r15
+                0x41, 0x5E, // pop r14
+                0x41, 0x5D, // pop r13
+                0x41, 0x5C, // pop r12
+                0x5D,       // pop rbp
+                0x5B,       // pop rbx
+                0xC3,       // ret
+            };
+            emit_bytes(&buf, epilogue, sizeof(epilogue));
+            break;
+        }
+        default:
+            ok = 0; // OP_STORE, OP_SUM: rejected by is_batchable anyway
+            break;
+        }
+    }
+    if (!ok || d != 1) {
+        free(buf.code);
+        return 0;
+    }
+
+    // W^X: write the code, then make it executable and read-only
+    void *code = mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(buf.code);
+        return 0;
+    }
+    memcpy(code, buf.code, buf.length);
+    free(buf.code);
+    if (mprotect(code, buf.length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, buf.length);
+        return 0;
+    }
+    body->jit_code = code;
+    body->jit_size = buf.length;
+    return 1;
+}
+
+void emit_byte(CodeBuffer *buf, unsigned char byte) {
+    if (buf->length >= buf->capacity) {
+        buf->capacity = buf->capacity ? 2 * buf->capacity : 256;
+        buf->code = (unsigned char *)realloc(buf->code, buf->capacity);
+        assertNotNull(buf->code);
+    }
+    buf->code[buf->length++] = byte;
+}
+
+void emit_bytes(CodeBuffer *buf, const unsigned char *bytes, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        emit_byte(buf, bytes[k]);
+    }
+}
+
+void emit_u32(CodeBuffer *buf, uint32_t value) {
+    for (int k = 0; k < 4; k++) {
+        emit_byte(buf, (value >> (8 * k)) & 0xFF);
+    }
+}
+
+void emit_u64(CodeBuffer *buf, uint64_t value) {
+    for (int k = 0; k < 8; k++) {
+        emit_byte(buf, (value >> (8 * k)) & 0xFF);
+    }
+}
+
+// op xmm<reg>, xmm<rm>
+void emit_sse_rr(CodeBuffer *buf, unsigned char prefix, unsigned char op,
+                 int reg, int rm) {
+    emit_byte(buf, prefix);
+    if (reg >= 8 || rm >= 8) {
+        emit_byte(buf, 0x40 | (reg >= 8 ? 0x04 : 0) | (rm >= 8 ? 0x01 : 0));
+    }
+    emit_byte(buf, 0x0F);
+    emit_byte(buf, op);
+    emit_byte(buf, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op xmm<reg>, [base + disp32]
+void emit_sse_rm(CodeBuffer *buf, unsigned char prefix, unsigned char op,
+                 int reg, int base, int32_t disp) {
+    emit_byte(buf, prefix);
+    if (reg >= 8 || base >= 8) {
+        emit_byte(buf, 0x40 | (reg >= 8 ? 0x04 : 0) | (base >= 8 ? 0x01 : 0));
+    }
+    emit_byte(buf, 0x0F);
+    emit_byte(buf, op);
+    emit_byte(buf, 0x80 | (reg & 7) << 3 | (base & 7));
+    if ((base & 7) == RSP) {
+        emit_byte(buf, 0x24); // SIB: no index
+    }
+    emit_u32(buf, (uint32_t)disp);
+}
+
+// Calls fn on the top args stack entries (in xmm0, xmm1), leaving the
+// result in their place. Everything below them is spilled around the call.
+void emit_call(CodeBuffer *buf, void *fn, int depth, int args) {
+    int live = depth - args;
+    for (int k = 1; k <= live; k++) {
+        emit_sse_rm(buf, SSE_F2, SSE_MOVSD_STORE, k, RSP, 8 * k);
+    }
+    emit_sse_rr(buf, SSE_66, SSE_MOVAPD, 0, depth - args + 1);
+    if (args == 2) {
+        emit_sse_rr(buf, SSE_66, SSE_MOVAPD, 1, depth);
+    }
+    emit_bytes(buf, (const unsigned char[]){0x48, 0xB8}, 2); // mov rax, imm64
+    emit_u64(buf, (uintptr_t)fn);
+    emit_bytes(buf, (const unsigned char[]){0xFF, 0xD0}, 2); // call rax
+    emit_sse_rr(buf, SSE_66, SSE_MOVAPD, live + 1, 0);
+    for (int k = 1; k <= live; k++) {
+        emit_sse_rm(buf, SSE_F2, SSE_MOVSD_LOAD, k, RSP, 8 * k);
+    }
+}
+
+#else
+
+int jit_compile(Program *body) {
+    (void)body;
+    return 0;
+}
+
+#endif
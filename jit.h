@@ -0,0 +1,55 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "compiler.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Native code for sum() bodies, x86-64 System V only; everywhere else
+// jit_compile fails and sums stay on the batch VM.
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define JIT_AVAILABLE 1
+#else
+#define JIT_AVAILABLE 0
+#endif
+
+#define JIT_DEFAULT_THRESHOLD (1 << 20)
+#define JIT_MAX_STACK 15 // xmm1..xmm15, xmm0 is scratch
+#define JIT_FRAME_SIZE 200 // spills, temporaries, 16-byte alignment
+#define JIT_TEMPS_OFFSET 128
+
+typedef enum { JIT_NONE, JIT_COMPILING, JIT_READY, JIT_FAILED } JitState;
+
+// Adds body(i) to acc[(i - first) % BATCH_SIZE] for i in [first, last].
+typedef void jit_fn(double *env_vars, double *acc, long long first,
+                    long long last);
+
+typedef struct {
+    long long threshold; // shortest sum() range worth compiling, -1 for never
+} JitOptions;
+
+typedef struct {
+    unsigned char *code;
+    size_t length;
+    size_t capacity;
+} CodeBuffer;
+
+extern JitOptions jit_options;
+
+int jit_ready(Program *body);
+int jit_compile(Program *body);
+void jit_free(Program *body);
+double jit_range_sum(void *ctx, long long first, long long last,
+                     double *env_vars);
+
+void emit_byte(CodeBuffer *buf, unsigned char byte);
+void emit_bytes(CodeBuffer *buf, const unsigned char *bytes, size_t n);
+void emit_u32(CodeBuffer *buf, uint32_t value);
+void emit_u64(CodeBuffer *buf, uint64_t value);
+void emit_sse_rr(CodeBuffer *buf, unsigned char prefix, unsigned char op,
+                 int reg, int rm);
+void emit_sse_rm(CodeBuffer *buf, unsigned char prefix, unsigned char op,
+                 int reg, int base, int32_t disp);
+void emit_call(CodeBuffer *buf, void *fn, int depth, int args);
+
+#endif
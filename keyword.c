@@ -0,0 +1,33 @@
+#include "keyword.h"
+#include "keyword_hash.h"
+#include <string.h>
+
+char keywords[NUM_KEYWORDS][MAX_KEYWORD_LEN] = {
+    "sqrt", "rootn", "log",  "logn", "ln", "sin", "cos", "tan",
+    "asin", "acos",  "atan", "sum",  "pi", "e",   "ans", "i"};
+KeywordType keyword_types[NUM_KEYWORDS] = {
+    SQRT, ROOTN, LOG,  LOGN,   LN, SIN, COS, TAN,
+    ASIN, ACOS,  ATAN, KW_SUM, PI, E,   ANS, I};
+int keyword_num_args[NUM_KEYWORDS] = {1, 2, 1, 2, 1, 1, 1, 1,
+                                      1, 1, 1, 3, 0, 1, 0, 0};
+
+// Perfect hash lookup, see gen_keyword_hash.py. Returns -1 if the slice is
+// not exactly a keyword.
+KeywordType lookup_keyword(char *keyword, size_t length) {
+    if (length == 0 || length >= MAX_KEYWORD_LEN) {
+        return -1;
+    }
+    unsigned char first = keyword[0];
+    unsigned char second = length > 1 ? keyword[1] : 0;
+    unsigned char last = keyword[length - 1];
+    unsigned int slot =
+        (length * KEYWORD_HASH_LEN_MUL + first * KEYWORD_HASH_FIRST_MUL +
+         second * KEYWORD_HASH_SECOND_MUL + last) %
+        KEYWORD_HASH_SIZE;
+    int index = keyword_hash_table[slot];
+    if (index < 0 || keywords[index][length] != '\0' ||
+        memcmp(keyword, keywords[index], length) != 0) {
+        return -1;
+    }
+    return keyword_types[index];
+}
@@ -0,0 +1,34 @@
+#ifndef KEYWORD_H
+#define KEYWORD_H
+
+#include <stddef.h>
+
+#define NUM_KEYWORDS 16
+#define MAX_KEYWORD_LEN 6
+
+typedef enum {
+    SQRT,
+    ROOTN,
+    LOG,
+    LOGN,
+    LN,
+    SIN,
+    COS,
+    TAN,
+    ASIN,
+    ACOS,
+    ATAN,
+    KW_SUM,
+    PI,
+    E,
+    ANS,
+    I,
+} KeywordType;
+
+extern char keywords[NUM_KEYWORDS][MAX_KEYWORD_LEN];
+extern KeywordType keyword_types[NUM_KEYWORDS];
+extern int keyword_num_args[NUM_KEYWORDS];
+
+KeywordType lookup_keyword(char *keyword, size_t length);
+
+#endif
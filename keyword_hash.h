@@ -0,0 +1,18 @@
+// Generated by gen_keyword_hash.py, do not edit.
+#ifndef KEYWORD_HASH_H
+#define KEYWORD_HASH_H
+
+#define KEYWORD_HASH_SIZE 32
+#define KEYWORD_HASH_LEN_MUL 0
+#define KEYWORD_HASH_FIRST_MUL 1
+#define KEYWORD_HASH_SECOND_MUL 3
+
+// Slot -> index into keywords[], -1 for empty slots.
+static const signed char keyword_hash_table[KEYWORD_HASH_SIZE] = {
+     2, -1, -1,  6,  4,  7, -1,  3,
+     8, -1, 13, 10, -1,  1, -1, -1,
+    -1, -1, 15, -1, 12, -1, -1, -1,
+    -1, -1,  0, -1,  5,  9, 14, 11,
+};
+
+#endif
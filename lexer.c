@@ -1,153 +1,462 @@
 #include "lexer.h"
+#include "char_class_table.h"
+#include "number.h"
 #include "token.h"
 #include "util.h"
 #include <assert.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define LEXER_X86 1
+#include <immintrin.h>
+#else
+#define LEXER_X86 0
+#endif
+
+lexer_scan_fn *lexer_scan_run = scalar_scan_run;
 
 Lexer *new_lexer(char *input, size_t n) {
-    Lexer *l = (Lexer *)calloc(1, sizeof(Lexer));
+    return new_arena_lexer(NULL, input, n);
+}
+
+Lexer *new_arena_lexer(Arena *arena, char *input, size_t n) {
+    Lexer *l = (Lexer *)arena_alloc(arena, sizeof(Lexer));
+    assertNotNull(l);
+    return init_lexer(l, arena, input, n);
+}
+
+Lexer *init_lexer(Lexer *l, Arena *arena, char *input, size_t n) {
+    assertNotNull(l);
+    memset(l, 0, sizeof(Lexer));
+    l->arena = arena;
+    l->fd = -1;
+    lexer_reset(l, input, n);
+    return l;
+}
+
+// Points the lexer at a new input of n bytes, which need not be
+// NUL-terminated (e.g. a line of a memory-mapped file). Lexing stops at the
+// first NUL byte, if any.
+void lexer_reset(Lexer *l, char *input, size_t n) {
     assertNotNull(l);
     l->input = input;
-    l->input_len = strnlen(input, n);
+    l->input_len = n;
+    l->position = 0;
+    l->read_position = 0;
     read_char(l);
+}
+
+// Streaming mode: input is read from fd as the lexer advances, one line at
+// a time, see lexer_next_line. A newline ends the expression (TOKEN_EOF)
+// and token literals are copied into arena, which must not be NULL.
+Lexer *init_stream_lexer(Lexer *l, Arena *arena, int fd) {
+    assertNotNull(l);
+    assertNotNull(arena);
+    memset(l, 0, sizeof(Lexer));
+    l->arena = arena;
+    l->fd = fd;
+    l->capacity = LEXER_CHUNK_SIZE;
+    l->input = (char *)malloc(l->capacity);
+    assertNotNull(l->input);
     return l;
 }
 
+void close_stream_lexer(Lexer *l) {
+    assertNotNull(l);
+    safe_free((void **)&l->input);
+}
+
+// Finds the next line, refilling the window as needed. Returns 1 with the
+// line in *line (without its newline) when it fits in one chunk; it stays
+// valid until the next call. Returns -1 when the line is longer, with
+// *line holding its first chunk: the lexer is then positioned at the start
+// of the line, lexer_next_token streams its tokens and lexer_skip_line
+// moves past it. Returns 0 at the end of the input.
+int lexer_next_line(Lexer *l, char **line, size_t *length) {
+    assertNotNull(l);
+    if (l->read_position > l->base + l->input_len) {
+        l->read_position = l->base + l->input_len; // past the end once
+    }
+    l->last_token = l->read_position; // nothing before the line is needed
+    while (1) {
+        size_t start = l->read_position - l->base;
+        char *newline =
+            (char *)memchr(l->input + start, '\n', l->input_len - start);
+        *line = l->input + start;
+        if (newline != NULL) {
+            *length = newline - *line;
+            l->read_position += *length + 1;
+            return 1;
+        }
+        *length = l->input_len - start;
+        if (*length >= LEXER_CHUNK_SIZE) {
+            read_char(l);
+            return -1;
+        }
+        if (!lexer_refill(l)) {
+            l->read_position += *length;
+            return *length > 0; // a last line without a newline
+        }
+    }
+}
+
+// Moves past the rest of the current line in streaming mode.
+void lexer_skip_line(Lexer *l) {
+    assertNotNull(l);
+    while (l->ch != '\n' && l->position < l->base + l->input_len) {
+        l->last_token = l->position; // nothing on the line is needed
+        read_char(l);
+    }
+}
+
+// Drops the window up to the last token returned and reads more input
+// after what is left, growing the window only for a token longer than a
+// chunk. Returns 0 when fd has no more data.
+int lexer_refill(Lexer *l) {
+    assertNotNull(l);
+    if (l->fd < 0 || l->at_end) {
+        return 0;
+    }
+    size_t keep = l->last_token - l->base;
+    memmove(l->input, l->input + keep, l->input_len - keep);
+    l->input_len -= keep;
+    l->base += keep;
+    if (l->capacity - l->input_len < LEXER_CHUNK_SIZE / 2) {
+        l->capacity *= 2;
+        l->input = (char *)realloc(l->input, l->capacity);
+        assertNotNull(l->input);
+    }
+    ssize_t n;
+    do {
+        n = read(l->fd, l->input + l->input_len, l->capacity - l->input_len);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        l->at_end = 1;
+        return 0;
+    }
+    l->input_len += n;
+    return 1;
+}
+
 void free_lexer(Lexer **l) {
     if (l == NULL || *l == NULL) {
         return;
     }
+    if ((*l)->arena != NULL) {
+        *l = NULL; // released by arena_reset
+        return;
+    }
     safe_free((void **)&(*l)->input);
     safe_free((void **)l);
 }
 
-Token *lexer_next_token(Lexer *l) {
+Token lexer_next_token(Lexer *l) {
+    assertNotNull(l);
+    Token token = lexer_scan_token(l);
+    l->last_token = token.offset; // kept in the window until the next one
+    return token;
+}
+
+Token lexer_scan_token(Lexer *l) {
     assertNotNull(l);
-    Token *token;
     skip_whitespace(l);
-    switch (l->ch) {
-    case '+':
-        token = new_token(PLUS, l->ch);
-        break;
-    case '-':
-        token = new_token(MINUS, l->ch);
-        break;
-    case '*':
-        token = new_token(ASTERISK, l->ch);
-        break;
-    case '/':
-        token = new_token(SLASH, l->ch);
-        break;
-    case '^':
-        token = new_token(CARET, l->ch);
-        break;
-    case '(':
-        token = new_token(LPAREN, l->ch);
-        break;
-    case ')':
-        token = new_token(RPAREN, l->ch);
-        break;
-    case '{':
-        token = new_token(LBRACE, l->ch);
-        break;
-    case '}':
-        token = new_token(RBRACE, l->ch);
-        break;
-    case ',':
-        token = new_token(COMMA, l->ch);
-        break;
-    case 0:
-        token = new_token(TOKEN_EOF, 0);
-        break;
-    default:
-        if (is_letter(l->ch)) {
-            return read_word(l);
-        } else if (is_num(l->ch)) {
-            return read_num(l);
-        } else {
-            token = new_token(ILLEGAL, l->ch);
-        }
-        break;
+    unsigned char ch = (unsigned char)l->ch;
+    if (char_classes[ch] & CHAR_LETTER) {
+        return read_word(l);
+    } else if (char_classes[ch] & CHAR_NUMBER) {
+        return read_num(l);
+    }
+    TokenType type = (TokenType)char_tokens[ch];
+    if (type == TOKEN_EOF) { // '\n' only in streaming mode
+        return new_token(TOKEN_EOF, l->position, 0);
     }
+    Token token = new_token(type, l->position, 1);
     read_char(l);
     return token;
 }
+
+// Lexes the whole input in one pass. The array always ends with a TOKEN_EOF
+// token and lives in the lexer's arena (or on the heap without one).
+TokenArray lexer_tokenize(Lexer *l) {
+    assertNotNull(l);
+    size_t cap = l->input_len / 2 + 2;
+    TokenArray arr;
+    arr.tokens = (Token *)arena_alloc(l->arena, cap * sizeof(Token));
+    assertNotNull(arr.tokens);
+    arr.num_tokens = 0;
+    while (1) {
+        if (arr.num_tokens >= cap) {
+            arr.tokens = (Token *)arena_realloc(l->arena, arr.tokens,
+                                                cap * sizeof(Token),
+                                                2 * cap * sizeof(Token));
+            assertNotNull(arr.tokens);
+            cap *= 2;
+        }
+        Token tok = lexer_next_token(l);
+        arr.tokens[arr.num_tokens++] = tok;
+        if (tok.type == TOKEN_EOF) {
+            return arr;
+        }
+    }
+}
+
+// Literal of a token; not NUL-terminated, use tok.length. In streaming
+// mode the window moves on, so the literal is a copy in the arena; only the
+// last two tokens returned can be looked up.
+char *lexer_token_literal(Lexer *l, Token tok) {
+    assertNotNull(l);
+    if (l->fd < 0) {
+        return l->input + tok.offset;
+    }
+    char *copy = (char *)arena_alloc(l->arena, tok.length + 1);
+    assertNotNull(copy);
+    memcpy(copy, l->input + (tok.offset - l->base), tok.length);
+    copy[tok.length] = '\0';
+    return copy;
+}
+
 // Reads next character into Lexer.
 void read_char(Lexer *l) {
     assertNotNull(l);
-    if (l->read_position >= 0 && (size_t)l->read_position >= l->input_len) {
+    if (l->read_position >= l->base + l->input_len && !lexer_refill(l)) {
         l->ch = 0;
     } else {
-        l->ch = l->input[l->read_position];
+        l->ch = l->input[l->read_position - l->base];
     }
     l->position = l->read_position;
     l->read_position++;
 }
 
-Token *read_word(Lexer *l) {
+// Moves past the run of bytes whose class has one of the classes bits,
+// starting with the current character. Most runs are a few bytes, which
+// the table settles; longer ones go on a vector at a time within the
+// window. In streaming mode a run may go on after a refill.
+void skip_class(Lexer *l, int classes) {
     assertNotNull(l);
-    int position = l->position;
-    while (is_letter(l->ch)) {
+    while (char_classes[(unsigned char)l->ch] & classes) {
+        const char *s = l->input + (l->read_position - l->base);
+        size_t n = l->base + l->input_len - l->read_position;
+        size_t k = 0;
+        while (k < n && k < LEXER_SHORT_RUN &&
+               (char_classes[(unsigned char)s[k]] & classes)) {
+            k++;
+        }
+        if (k == LEXER_SHORT_RUN) {
+            k += lexer_scan_run(s + k, n - k, classes);
+        }
+        l->read_position += k;
+        if (k < n) { // the run ends inside the window, as read_char would
+            l->ch = s[k];
+            l->position = l->read_position++;
+            return;
+        }
         read_char(l);
     }
-    char *out = (char *)malloc((l->position - position + 1) * sizeof(char));
-    assertNotNull(out);
-    slice(l->input, out, position, l->position);
+}
 
-    Token *token = (Token *)malloc(sizeof(Token));
-    assertNotNull(token);
-    token->literal = out;
-    int length = strnlen(token->literal, l->position - position);
-    token->type = IDENT;
-    token->length = length;
-    return token;
+// A letter or '_', then letters, digits and '_' as in "rate2".
+Token read_word(Lexer *l) {
+    assertNotNull(l);
+    size_t position = l->position;
+    skip_class(l, CHAR_LETTER | CHAR_DIGIT);
+    return new_token(IDENT, position, l->position - position);
 }
 
-Token *read_num(Lexer *l) {
+// Scans digits[.digits][(e|E)[+|-]digits], or .digits instead of the
+// first part, converting the literal as it goes. A literal without digits
+// or exponent digits, or followed directly by another '.' or digit as in
+// "1.2.3", is returned whole as an ILLEGAL token.
+Token read_num(Lexer *l) {
     assertNotNull(l);
-    int position = l->position;
-    while (is_num(l->ch)) {
+    size_t position = l->position;
+    Decimal d = {0};
+    size_t num_digits = 0;
+    int valid = 1;
+    for (int is_fraction = 0; is_fraction < 2; is_fraction++) {
+        size_t start = l->position;
+        skip_class(l, CHAR_DIGIT);
+        // the window holds the whole literal, it started after last_token
+        const char *digits = l->input + (start - l->base);
+        for (size_t k = 0; k < l->position - start; k++) {
+            decimal_push_digit(&d, digits[k], is_fraction);
+        }
+        num_digits += l->position - start;
+        if (is_fraction || l->ch != '.') {
+            break;
+        }
         read_char(l);
     }
-    char *out = (char *)malloc((l->position - position + 1) * sizeof(char));
-    assertNotNull(out);
-    slice(l->input, out, position, l->position);
-
-    Token *token = (Token *)malloc(sizeof(Token));
-    assertNotNull(token);
-    token->literal = out;
-    token->length = strnlen(token->literal, l->position - position);
-    token->type = NUMBER;
+    if (l->ch == 'e' || l->ch == 'E') {
+        read_char(l);
+        int negative = l->ch == '-';
+        if (l->ch == '+' || l->ch == '-') {
+            read_char(l);
+        }
+        size_t start = l->position;
+        skip_class(l, CHAR_DIGIT);
+        const char *digits = l->input + (start - l->base);
+        long long exponent = 0;
+        for (size_t k = 0; k < l->position - start; k++) {
+            if (exponent < DECIMAL_MAX_EXPONENT) {
+                exponent = 10 * exponent + (digits[k] - '0');
+            }
+        }
+        valid = l->position > start;
+        d.exponent += negative ? -exponent : exponent;
+    }
+    if (char_classes[(unsigned char)l->ch] & CHAR_NUMBER) {
+        valid = 0;
+        skip_class(l, CHAR_NUMBER);
+    }
+    size_t length = l->position - position;
+    if (!valid || num_digits == 0) {
+        return new_token(ILLEGAL, position, length);
+    }
+    Token token = new_token(NUMBER, position, length);
+    if (!decimal_to_double(&d, &token.value)) {
+        token.value = atod(l->input + (position - l->base), length);
+    }
     return token;
 }
 
 char peek_char(Lexer *l) {
     assertNotNull(l);
-    if (l->read_position >= 0 && (size_t)l->read_position >= l->input_len) {
+    if (l->read_position >= l->base + l->input_len && !lexer_refill(l)) {
         return 0;
     } else {
-        return l->input[l->read_position];
+        return l->input[l->read_position - l->base];
     }
 }
 
 void skip_whitespace(Lexer *l) {
     assertNotNull(l);
-    while (l->ch == ' ' || l->ch == '\t' || l->ch == '\n' || l->ch == '\r') {
-        read_char(l);
-    }
+    skip_class(l, l->fd < 0 ? CHAR_SPACE | CHAR_NEWLINE : CHAR_SPACE);
 }
 
 int is_letter(char ch) {
-    return ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ch == '_';
+    return char_classes[(unsigned char)ch] & CHAR_LETTER;
 }
 
-int is_num(char ch) { return ('0' <= ch && ch <= '9') || ch == '.'; }
+int is_num(char ch) { return char_classes[(unsigned char)ch] & CHAR_NUMBER; }
 
-void slice(const char *str, char *result, size_t start, size_t end) {
-    int n = end - start;
-    strncpy(result, str + start, n);
-    result[n] = '\0';
+int is_digit(char ch) { return char_classes[(unsigned char)ch] & CHAR_DIGIT; }
+
+// Length of the prefix of s[0, n) whose bytes all have one of the classes
+// bits, a byte at a time; also the tail of the vector versions.
+size_t scalar_scan_run(const char *s, size_t n, int classes) {
+    size_t k = 0;
+    while (k < n && (char_classes[(unsigned char)s[k]] & classes)) {
+        k++;
+    }
+    return k;
+}
+
+#if LEXER_X86
+// Bit k is set when byte k of x has one of the classes bits; must match
+// char_classes. Comparisons are signed, so bytes >= 0x80 are in no range.
+int sse2_class_mask(__m128i x, int classes) {
+    __m128i in = _mm_setzero_si128();
+    if (classes & CHAR_LETTER) {
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        in = _mm_or_si128(
+            in, _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                              _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1))));
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+    }
+    if (classes & CHAR_DIGIT) {
+        in = _mm_or_si128(
+            in, _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1))));
+    }
+    if (classes & CHAR_DOT) {
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8('.')));
+    }
+    if (classes & CHAR_SPACE) {
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8('\t')));
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8('\r')));
+    }
+    if (classes & CHAR_NEWLINE) {
+        in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+    }
+    return _mm_movemask_epi8(in);
+}
+
+__attribute__((target("avx2"))) unsigned avx2_class_mask(__m256i x,
+                                                         int classes) {
+    __m256i in = _mm256_setzero_si256();
+    if (classes & CHAR_LETTER) {
+        __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+        __m256i above = _mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1));
+        __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower);
+        in = _mm256_or_si256(in, _mm256_and_si256(above, below));
+        in = _mm256_or_si256(in, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+    }
+    if (classes & CHAR_DIGIT) {
+        in = _mm256_or_si256(
+            in,
+            _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0' - 1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), x)));
+    }
+    if (classes & CHAR_DOT) {
+        in = _mm256_or_si256(in, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.')));
+    }
+    if (classes & CHAR_SPACE) {
+        in = _mm256_or_si256(in, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+        in = _mm256_or_si256(in, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')));
+        in = _mm256_or_si256(in, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r')));
+    }
+    if (classes & CHAR_NEWLINE) {
+        in = _mm256_or_si256(in, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+    }
+    return (unsigned)_mm256_movemask_epi8(in);
+}
+
+// The run ends at the first clear bit of a block's class mask.
+size_t sse2_scan_run(const char *s, size_t n, int classes) {
+    size_t k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(s + k));
+        unsigned out = ~sse2_class_mask(x, classes) & 0xFFFF;
+        if (out != 0) {
+            return k + __builtin_ctz(out);
+        }
+    }
+    return k + scalar_scan_run(s + k, n - k, classes);
+}
+
+__attribute__((target("avx2"))) size_t avx2_scan_run(const char *s, size_t n,
+                                                     int classes) {
+    size_t k = 0;
+    for (; k + 32 <= n; k += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(s + k));
+        unsigned out = ~avx2_class_mask(x, classes);
+        if (out != 0) {
+            _mm256_zeroupper();
+            return k + __builtin_ctz(out);
+        }
+    }
+    // the mask's ymm argument leaves the upper halves dirty, which would
+    // slow down every SSE instruction after the scan
+    _mm256_zeroupper();
+    return k + sse2_scan_run(s + k, n - k, classes);
+}
+
+// Picks the widest scan the CPU supports before main() runs, like
+// batch_init.
+__attribute__((constructor)) void lexer_init(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        lexer_scan_run = avx2_scan_run;
+    } else {
+        lexer_scan_run = sse2_scan_run;
+    }
 }
+#else
+void lexer_init(void) {}
+#endif
@@ -1,27 +1,69 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "arena.h"
 #include "token.h"
 #include <stddef.h>
 
+#define LEXER_CHUNK_SIZE (1 << 16) // bytes read at a time when streaming
+#define LEXER_SHORT_RUN 8 // longer runs of a class are scanned in vectors
+
+// Length of the prefix of s[0, n) whose bytes all have one of the classes
+// bits (CHAR_ in char_class_table.h).
+typedef size_t lexer_scan_fn(const char *s, size_t n, int classes);
+
+// Lexes either an in-memory input or, in streaming mode, a file descriptor
+// read in LEXER_CHUNK_SIZE chunks. Offsets are absolute: in streaming mode
+// input is a window holding input[base, base + input_len), which is
+// compacted and refilled as the lexer advances and only keeps the last
+// token returned, so memory does not grow with the length of a line.
 typedef struct {
     char *input;
     size_t input_len;
-    int position;
-    int read_position;
+    size_t position;
+    size_t read_position;
     char ch;
+    Arena *arena; // NULL when tokens are heap-allocated
+    int fd;       // streaming input, -1 for in-memory input
+    size_t base;
+    size_t capacity;
+    size_t last_token; // offset of the last token returned
+    int at_end;        // fd has no more data
 } Lexer;
 
+typedef struct {
+    Token *tokens;
+    size_t num_tokens; // including the trailing TOKEN_EOF
+} TokenArray;
+
+// The scalar scan is always available; on x86-64 Linux it is replaced at
+// startup with an SSE2 or AVX2 version depending on the CPU.
+extern lexer_scan_fn *lexer_scan_run;
+
 Lexer *new_lexer(char *input, size_t n);
+Lexer *new_arena_lexer(Arena *arena, char *input, size_t n);
+Lexer *init_lexer(Lexer *l, Arena *arena, char *input, size_t n);
+void lexer_reset(Lexer *l, char *input, size_t n);
+Lexer *init_stream_lexer(Lexer *l, Arena *arena, int fd);
+void close_stream_lexer(Lexer *l);
+int lexer_next_line(Lexer *l, char **line, size_t *length);
+void lexer_skip_line(Lexer *l);
+int lexer_refill(Lexer *l);
 void free_lexer(Lexer **l);
-Token *lexer_next_token(Lexer *l);
+Token lexer_next_token(Lexer *l);
+Token lexer_scan_token(Lexer *l);
+TokenArray lexer_tokenize(Lexer *l);
+char *lexer_token_literal(Lexer *l, Token tok);
 void read_char(Lexer *l);
-Token *read_word(Lexer *l);
-Token *read_num(Lexer *l);
+Token read_word(Lexer *l);
+Token read_num(Lexer *l);
 char peek_char(Lexer *l);
 int is_letter(char ch);
 int is_num(char ch);
+int is_digit(char ch);
 void skip_whitespace(Lexer *l);
-void slice(const char *str, char *result, size_t start, size_t end);
+void skip_class(Lexer *l, int classes);
+size_t scalar_scan_run(const char *s, size_t n, int classes);
+void lexer_init(void);
 
 #endif
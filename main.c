@@ -1,11 +1,96 @@
+#include "closedform.h"
+#include "jit.h"
+#include "parallel.h"
+#include "parser.h"
 #include "repl.h"
+#include "stats.h"
 #include "util.h"
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-int main(void) {
-    printf("Calculator\n");
-    start(stdin, stdout);
-    return 0;
+void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-t] [-O] [-p] [-j threads] [-m iterations] "
+            "[-f file] [-w workers] [-c entries] [-J iterations] [-s] "
+            "[-d depth] [-L] [-x iterations]\n",
+            name);
+    fprintf(stderr, "  -t  evaluate with the reference tree walker\n");
+    fprintf(stderr, "  -O  fold constants and simplify expressions\n");
+    fprintf(stderr, "  -p  print each expression before its value\n");
+    fprintf(stderr, "  -j  threads for sum(), default one per CPU\n");
+    fprintf(stderr, "  -m  shortest sum() range run on the thread pool\n");
+    fprintf(stderr, "  -f  evaluate each line of file, without prompts\n");
+    fprintf(stderr, "  -w  evaluate batch input on a pipeline of workers\n");
+    fprintf(stderr, "  -c  compiled expressions to cache, 0 disables\n");
+    fprintf(stderr, "  -J  shortest sum() range compiled to native code, "
+                    "-1 disables\n");
+    fprintf(stderr, "  -s  print statistics to stderr at exit "
+                    "(make STATS=1)\n");
+    fprintf(stderr, "  -d  deepest expression accepted, default %d\n",
+            DEFAULT_MAX_DEPTH);
+    fprintf(stderr, "  -L  always loop, without sum() closed forms\n");
+    fprintf(stderr, "  -x  longest sum() range also looped to check its "
+                    "closed form\n");
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    const char *path = NULL;
+    while ((opt = getopt(argc, argv, "tOpj:m:f:w:c:J:sd:Lx:")) != -1) {
+        switch (opt) {
+        case 't':
+            repl_options.tree_walk = 1;
+            break;
+        case 'O':
+            repl_options.optimize = 1;
+            break;
+        case 'p':
+            repl_options.print_tree = 1;
+            break;
+        case 'j':
+            parallel_options.num_threads = atoi(optarg);
+            break;
+        case 'm':
+            parallel_options.parallel_threshold = atoll(optarg);
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 'w':
+            repl_options.workers = atoi(optarg);
+            break;
+        case 'c':
+            repl_options.cache_size = atoi(optarg);
+            break;
+        case 'J':
+            jit_options.threshold = atoll(optarg);
+            break;
+        case 's':
+            atexit(print_stats_at_exit);
+            break;
+        case 'd':
+            parser_options.max_depth = atoi(optarg);
+            break;
+        case 'L':
+            closed_form_options.enabled = 0;
+            break;
+        case 'x':
+            closed_form_options.check_limit = atoll(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (path == NULL && isatty(STDIN_FILENO)) {
+        printf("Calculator\n");
+        start(stdin, stdout);
+        return 0;
+    }
+    // batch mode: results only, flushed in large blocks
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    int ok = path != NULL ? run_file(path, stdout) : run_batch(stdin, stdout);
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,143 @@
+#include "number.h"
+#include "pow5_table.h"
+#include "util.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every power of ten that is exactly a double.
+double exact_powers_of_ten[23] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+
+void decimal_push_digit(Decimal *d, char ch, int is_fraction) {
+    if (d->num_digits == 0 && ch == '0') {
+        d->exponent -= is_fraction; // leading zeros are not significant
+        return;
+    }
+    if (d->num_digits < DECIMAL_MAX_DIGITS) {
+        d->digits = 10 * d->digits + (ch - '0');
+        d->num_digits++;
+        d->exponent -= is_fraction;
+        return;
+    }
+    d->truncated |= ch != '0';
+    d->exponent += !is_fraction;
+}
+
+// Correctly rounded value of d. Returns 0 when the fast algorithms cannot
+// decide it, and the caller falls back to strtod on the literal.
+int decimal_to_double(Decimal *d, double *value) {
+    assertNotNull(d);
+    assertNotNull(value);
+    if (!d->truncated && d->digits <= (1ULL << 53) && d->exponent >= -22 &&
+        d->exponent <= 22) {
+        // Clinger's fast path: both operands are exact, so the one rounding
+        // of the division or multiplication is the correct one
+        double x = (double)d->digits;
+        *value = d->exponent < 0 ? x / exact_powers_of_ten[-d->exponent]
+                                 : x * exact_powers_of_ten[d->exponent];
+        return 1;
+    }
+    if (!eisel_lemire(d->digits, d->exponent, value)) {
+        return 0;
+    }
+    if (!d->truncated) {
+        return 1;
+    }
+    // the exact value lies between digits and digits + 1 at this exponent
+    double upper;
+    return eisel_lemire(d->digits + 1, d->exponent, &upper) &&
+           upper == *value;
+}
+
+// Eisel-Lemire: w * 10^q rounded to the nearest double, from the 128-bit
+// approximation of 5^q in pow5_table.h (see "Number Parsing at a Gigabyte
+// per Second", Lemire 2021). Returns 0 in the rare cases where the
+// approximation is too close to a rounding boundary to decide.
+int eisel_lemire(uint64_t w, long long q, double *value) {
+    if (w == 0 || q < POW5_MIN_EXPONENT) {
+        *value = 0.0;
+        return 1;
+    }
+    if (q > POW5_MAX_EXPONENT) {
+        *value = INFINITY;
+        return 1;
+    }
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+    size_t index = 2 * (size_t)(q - POW5_MIN_EXPONENT);
+    unsigned __int128 product = (unsigned __int128)w * pow5_table[index];
+    uint64_t high = (uint64_t)(product >> 64);
+    uint64_t low = (uint64_t)product;
+    if ((high & 0x1FF) == 0x1FF) {
+        // the 55 bits kept could still change: add the product with the
+        // low half of the power
+        uint64_t carry = (uint64_t)(((unsigned __int128)w *
+                                     pow5_table[index + 1]) >> 64);
+        low += carry;
+        high += low < carry;
+    }
+    if (low == UINT64_MAX && (q < -27 || q > 55)) {
+        return 0; // the error of the approximation could carry into high
+    }
+
+    int upper_bit = (int)(high >> 63);
+    int shift = upper_bit + 9;
+    uint64_t mantissa = high >> shift;
+    // floor(q * log2(10)) + 63, biased by 1023
+    long long power2 = ((217706 * q) >> 16) + 63 + upper_bit - lz + 1023;
+    if (power2 <= 0) { // subnormal
+        if (-power2 + 1 >= 64) {
+            *value = 0.0;
+            return 1;
+        }
+        mantissa >>= -power2 + 1;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        // rounding up can reach the smallest normal number
+        power2 = mantissa < (1ULL << 52) ? 0 : 1;
+    } else {
+        if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+            (mantissa << shift) == high) {
+            mantissa &= ~1ULL; // exactly halfway: round down to even
+        }
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        if (mantissa >= (2ULL << 52)) {
+            mantissa = 1ULL << 52;
+            power2++;
+        }
+        mantissa &= ~(1ULL << 52);
+        if (power2 >= 0x7FF) {
+            *value = INFINITY;
+            return 1;
+        }
+    }
+    uint64_t bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(value, &bits, sizeof(double));
+    return 1;
+}
+
+// strtod on a literal that is not NUL-terminated, through a bounded copy;
+// the slow path for the few literals decimal_to_double cannot decide.
+double atod(char *str, size_t length) {
+    assertNotNull(str);
+    char small[64];
+    char *buffer = length < sizeof(small) ? small : (char *)malloc(length + 1);
+    assertNotNull(buffer);
+    memcpy(buffer, str, length);
+    buffer[length] = '\0';
+    char *end;
+    errno = 0;
+    double val = strtod(buffer, &end);
+    if (end == buffer) {
+        errno = ERANGE;
+    }
+    if (buffer != small) {
+        free(buffer);
+    }
+    return val;
+}
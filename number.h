@@ -0,0 +1,28 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DECIMAL_MAX_DIGITS 19 // significant digits that fit in a uint64_t
+#define DECIMAL_MAX_EXPONENT 100000 // larger written exponents are clamped
+
+// A decimal literal as the lexer scans it, worth digits * 10^exponent.
+// Significant digits past DECIMAL_MAX_DIGITS are dropped; truncated is set
+// when one of them was not 0, so the value is only bounded by digits and
+// digits + 1.
+typedef struct {
+    uint64_t digits;
+    int num_digits; // significant digits in digits
+    long long exponent;
+    int truncated;
+} Decimal;
+
+extern double exact_powers_of_ten[23];
+
+void decimal_push_digit(Decimal *d, char ch, int is_fraction);
+int decimal_to_double(Decimal *d, double *value);
+int eisel_lemire(uint64_t w, long long q, double *value);
+double atod(char *str, size_t length);
+
+#endif
@@ -0,0 +1,270 @@
+#include "optimizer.h"
+#include "ast.h"
+#include "evaluator.h"
+#include "util.h"
+#include <math.h>
+
+// Constant folding and algebraic simplification over a resolved expression.
+// Subtrees built only from number literals, pi, e and calls on constant
+// arguments collapse into a single NumberLiteral, and x*1, 1*x, x+0, 0+x,
+// x-0, x/1, x^1 and x^0 are simplified. Nodes are rewritten in place where
+// possible; replacement literals come from arena (or the heap without one)
+// and replaced heap nodes are freed. Operands are folded before their
+// parent with an explicit stack, so any depth folds. Returns the new root.
+Expression *fold_expression(Expression *expr, Arena *arena) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        if (f->step < expression_num_children(f->expr)) {
+            expression_stack_push(&s, expression_child(f->expr, f->step++));
+            continue;
+        }
+        Expression *folded = fold_node(f->expr, arena);
+        s.num_frames--;
+        if (s.num_frames == 0) {
+            expr = folded;
+        } else {
+            ExpressionFrame *parent = &s.frames[s.num_frames - 1];
+            *expression_child_slot(parent->expr, parent->step - 1) = folded;
+        }
+    }
+    free_expression_stack(&s);
+    return expr;
+}
+
+// Folds expr, whose operands are already folded.
+Expression *fold_node(Expression *expr, Arena *arena) {
+    switch (expr->type) {
+    case IDENTIFIER:
+        switch (expr->expression.identifier->keyword) {
+        case PI:
+            return replace_with_number(expr, M_PI, arena);
+        case E:
+            return replace_with_number(expr, M_E, arena);
+        default:
+            return expr;
+        }
+    case PREFIX_EXPRESSION:
+        return fold_prefix_expression(expr, arena);
+    case INFIX_EXPRESSION:
+        return fold_infix_expression(expr, arena);
+    case CALL_EXPRESSION:
+        return fold_call_expression(expr, arena);
+    default:
+        return expr;
+    }
+}
+
+Expression *fold_prefix_expression(Expression *expr, Arena *arena) {
+    PrefixExpression *prefix = expr->expression.prefix_expression;
+    if (prefix->right->type == NUMBER_LITERAL) {
+        // only MINUS operator
+        return replace_with_number(
+            expr, -prefix->right->expression.number_literal->value, arena);
+    }
+    return expr;
+}
+
+Expression *fold_infix_expression(Expression *expr, Arena *arena) {
+    InfixExpression *infix = expr->expression.infix_expression;
+    if (infix->left->type == NUMBER_LITERAL &&
+        infix->right->type == NUMBER_LITERAL) {
+        double env_vars[NUM_ENV_VARS] = {0.0, 0.0};
+        return replace_with_number(
+            expr, eval_infix_expression(infix, env_vars), arena);
+    }
+
+    switch (infix->operation) {
+    case ADD:
+        if (is_number_literal(infix->left, 0)) {
+            return replace_with_child(expr, &infix->right);
+        }
+        if (is_number_literal(infix->right, 0)) {
+            return replace_with_child(expr, &infix->left);
+        }
+        break;
+    case SUBTRACT:
+        if (is_number_literal(infix->right, 0)) {
+            return replace_with_child(expr, &infix->left);
+        }
+        break;
+    case MULTIPLY:
+        if (is_number_literal(infix->left, 1)) {
+            return replace_with_child(expr, &infix->right);
+        }
+        if (is_number_literal(infix->right, 1)) {
+            return replace_with_child(expr, &infix->left);
+        }
+        break;
+    case DIVIDE:
+        if (is_number_literal(infix->right, 1)) {
+            return replace_with_child(expr, &infix->left);
+        }
+        break;
+    case POWER:
+        if (is_number_literal(infix->right, 1)) {
+            return replace_with_child(expr, &infix->left);
+        }
+        if (is_number_literal(infix->right, 0)) {
+            // pow(x, 0) is 1 for every x, including NaN
+            return replace_with_number(expr, 1, arena);
+        }
+        break;
+    default:
+        break;
+    }
+    return expr;
+}
+
+Expression *fold_call_expression(Expression *expr, Arena *arena) {
+    CallExpression *call = expr->expression.call_expression;
+    if (call->keyword == KW_SUM) {
+        // a constant range is left to the closed form, the thread pool
+        // and native code rather than looped here
+        return expr;
+    }
+    int constant = 1;
+    for (int i = 0; i < call->num_arguments; i++) {
+        if (call->arguments[i]->type != NUMBER_LITERAL) {
+            constant = 0;
+        }
+    }
+    if (!constant) {
+        return expr;
+    }
+    // builtins are pure, so a call on constants is itself a constant
+    double env_vars[NUM_ENV_VARS] = {0.0, 0.0};
+    return replace_with_number(expr, eval_call_expression(call, env_vars),
+                               arena);
+}
+
+Expression *replace_with_number(Expression *expr, double value, Arena *arena) {
+    Expression *number = new_number_literal(arena, value);
+    free_expression(&expr);
+    return number;
+}
+
+// Detaches *child from expr so it survives freeing the rest of expr.
+Expression *replace_with_child(Expression *expr, Expression **child) {
+    Expression *kept = *child;
+    *child = NULL;
+    free_expression(&expr);
+    return kept;
+}
+
+int is_number_literal(Expression *expr, double value) {
+    assertNotNull(expr);
+    return expr->type == NUMBER_LITERAL &&
+           expr->expression.number_literal->value == value;
+}
+
+// Sets depends_on_i on every node whose value changes with the iterator of
+// the innermost enclosing sum. A sum binds its own iterator, so only its
+// range arguments make it depend on an outer one. Returns the root's.
+int mark_iterator_dependence(Expression *expr) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        Expression *node = f->expr;
+        int n = expression_num_children(node);
+        if (f->step < n) {
+            expression_stack_push(&s, expression_child(node, f->step++));
+            continue;
+        }
+        s.num_frames--;
+        int depends = node->type == IDENTIFIER &&
+                      node->expression.identifier->keyword == I;
+        int is_sum = node->type == CALL_EXPRESSION &&
+                     node->expression.call_expression->keyword == KW_SUM;
+        for (int k = 0; k < n; k++) {
+            if (!is_sum || k != 2) {
+                depends |= expression_child(node, k)->depends_on_i;
+            }
+        }
+        node->depends_on_i = depends;
+    }
+    free_expression_stack(&s);
+    return expr->depends_on_i;
+}
+
+// Whether expr reads the given keyword variable anywhere, e.g. ANS.
+int uses_keyword(Expression *expr, KeywordType keyword) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    int found = 0;
+    while (s.num_frames > 0 && !found) {
+        Expression *node = s.frames[--s.num_frames].expr;
+        found = node->type == IDENTIFIER &&
+                node->expression.identifier->keyword == keyword;
+        for (int k = 0; k < expression_num_children(node); k++) {
+            expression_stack_push(&s, expression_child(node, k));
+        }
+    }
+    free_expression_stack(&s);
+    return found;
+}
+
+// Loop-invariant hoisting for sum() bodies. Every maximal subtree of a body
+// that does not read the iterator gets an env_vars slot from first_slot on
+// and is listed in the outermost enclosing sum, which evaluates it once
+// before looping; inside the loop the node just reads its slot. Leaves are
+// left alone since reading them is as cheap as reading a slot. Returns the
+// number of slots the caller must reserve from first_slot on.
+int hoist_invariants(Expression *expr, int first_slot, Arena *arena) {
+    assertNotNull(expr);
+    mark_iterator_dependence(expr);
+    int next_slot = first_slot;
+    assign_invariant_slots(expr, NULL, &next_slot, arena);
+    return next_slot - first_slot;
+}
+
+// Walks expr in input order with an explicit stack; each frame's data is
+// the sum its node would be hoisted into, NULL outside any loop body.
+void assign_invariant_slots(Expression *expr, CallExpression *loop,
+                            int *next_slot, Arena *arena) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    s.frames[0].data = loop;
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        Expression *node = f->expr;
+        if (f->step == 0 && f->data != NULL && !node->depends_on_i &&
+            node->type != NUMBER_LITERAL && node->type != IDENTIFIER) {
+            CallExpression *owner = (CallExpression *)f->data;
+            int n = owner->num_invariants;
+            if ((n & (n - 1)) == 0) { // grow at powers of two
+                owner->invariants = (Expression **)arena_realloc(
+                    arena, owner->invariants, n * sizeof(Expression *),
+                    (n ? 2 * n : 1) * sizeof(Expression *));
+                assertNotNull(owner->invariants);
+            }
+            owner->invariants[owner->num_invariants++] = node;
+            node->slot = (*next_slot)++;
+            f->data = NULL; // the subtree itself runs once, outside any loop
+        }
+        if (f->step == expression_num_children(node)) {
+            s.num_frames--;
+            continue;
+        }
+        int k = f->step++;
+        void *owner = f->data;
+        if (node->type == CALL_EXPRESSION &&
+            node->expression.call_expression->keyword == KW_SUM && k == 2 &&
+            owner == NULL) {
+            owner = node->expression.call_expression;
+        }
+        expression_stack_push(&s, expression_child(node, k));
+        s.frames[s.num_frames - 1].data = owner;
+    }
+    free_expression_stack(&s);
+}
@@ -0,0 +1,21 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "arena.h"
+#include "ast.h"
+
+Expression *fold_expression(Expression *expr, Arena *arena);
+Expression *fold_node(Expression *expr, Arena *arena);
+Expression *fold_prefix_expression(Expression *expr, Arena *arena);
+Expression *fold_infix_expression(Expression *expr, Arena *arena);
+Expression *fold_call_expression(Expression *expr, Arena *arena);
+Expression *replace_with_number(Expression *expr, double value, Arena *arena);
+Expression *replace_with_child(Expression *expr, Expression **child);
+int is_number_literal(Expression *expr, double value);
+int mark_iterator_dependence(Expression *expr);
+int uses_keyword(Expression *expr, KeywordType keyword);
+int hoist_invariants(Expression *expr, int first_slot, Arena *arena);
+void assign_invariant_slots(Expression *expr, CallExpression *loop,
+                            int *next_slot, Arena *arena);
+
+#endif
@@ -0,0 +1,191 @@
+#include "parallel.h"
+#include "evaluator.h"
+#include "util.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+ParallelOptions parallel_options = {0, 1 << 16};
+
+// Set while a thread is running chunks, so sums nested in a body run their
+// chunks inline instead of waiting on the pool they are part of.
+_Thread_local int in_parallel_sum = 0;
+
+pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+ThreadPool *pool = NULL;
+
+// Clamps a sum() bound to the range where consecutive integers are still
+// exact doubles; NaN maps to 0.
+long long sum_bound(double x) {
+    if (isnan(x)) {
+        return 0;
+    }
+    if (x > SUM_MAX_BOUND) {
+        return (long long)SUM_MAX_BOUND;
+    }
+    if (x < -SUM_MAX_BOUND) {
+        return -(long long)SUM_MAX_BOUND;
+    }
+    return (long long)x;
+}
+
+// Splits [first, last] into chunks whose size depends only on the range,
+// sums each chunk with fn and adds the partial sums pairwise in index order.
+// The result is therefore bit-identical for any number of threads. Ranges
+// shorter than parallel_threshold skip chunking altogether.
+double parallel_sum(range_sum_fn *fn, void *ctx, long long first,
+                    long long last, double *env_vars, int env_size) {
+    if (last < first) {
+        return 0.0;
+    }
+    long long count = last - first + 1;
+    if (count < parallel_options.parallel_threshold) {
+        return fn(ctx, first, last, env_vars);
+    }
+
+    SumJob job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.start = first;
+    job.end = last;
+    job.chunk_size = SUM_CHUNK_SIZE;
+    if (count / SUM_MAX_CHUNKS > job.chunk_size) {
+        job.chunk_size = count / SUM_MAX_CHUNKS + 1;
+    }
+    job.num_chunks = (count + job.chunk_size - 1) / job.chunk_size;
+    job.partials = (double *)malloc(job.num_chunks * sizeof(double));
+    assertNotNull(job.partials);
+    job.env_vars = env_vars;
+    job.env_size = env_size;
+    job.line_stats = stats_line;
+    atomic_init(&job.next_chunk, 0);
+
+    ThreadPool *p = in_parallel_sum ? NULL : get_thread_pool();
+    if (p != NULL && p->num_threads > 0 &&
+        pthread_mutex_trylock(&p->busy) == 0) {
+        pthread_mutex_lock(&p->lock);
+        p->job = &job;
+        p->active = p->num_threads;
+        p->generation++;
+        pthread_cond_broadcast(&p->work_ready);
+        pthread_mutex_unlock(&p->lock);
+
+        run_chunks(&job);
+
+        pthread_mutex_lock(&p->lock);
+        while (p->active > 0) {
+            pthread_cond_wait(&p->work_done, &p->lock);
+        }
+        p->job = NULL;
+        pthread_mutex_unlock(&p->lock);
+        pthread_mutex_unlock(&p->busy);
+    } else {
+        // nested in a running job or the pool is taken: same chunks, inline
+        run_chunks(&job);
+    }
+
+    double x = pairwise_sum(job.partials, job.num_chunks);
+    free(job.partials);
+    return x;
+}
+
+double pairwise_sum(double *values, long long n) {
+    if (n <= 0) {
+        return 0.0;
+    }
+    if (n == 1) {
+        return values[0];
+    }
+    long long half = n / 2;
+    return pairwise_sum(values, half) + pairwise_sum(values + half, n - half);
+}
+
+// Claims chunks until none are left, each with a private copy of the
+// environment since bodies write the iterator and their hoisted slots.
+void run_chunks(SumJob *job) {
+    double small[NUM_ENV_VARS + 32];
+    double *env_vars = small;
+    if (job->env_size > NUM_ENV_VARS + 32) {
+        env_vars = (double *)malloc(job->env_size * sizeof(double));
+        assertNotNull(env_vars);
+    }
+    memcpy(env_vars, job->env_vars, job->env_size * sizeof(double));
+    int nested = in_parallel_sum;
+    in_parallel_sum = 1;
+    LineStats *line_stats = stats_line; // iterations count for the job's line
+    stats_line = job->line_stats;
+    while (1) {
+        long long c = atomic_fetch_add(&job->next_chunk, 1);
+        if (c >= job->num_chunks) {
+            break;
+        }
+        long long first = job->start + c * job->chunk_size;
+        long long last = first + job->chunk_size - 1;
+        if (last > job->end) {
+            last = job->end;
+        }
+        job->partials[c] = job->fn(job->ctx, first, last, env_vars);
+    }
+    in_parallel_sum = nested;
+    stats_line = line_stats;
+    if (env_vars != small) {
+        free(env_vars);
+    }
+}
+
+void init_thread_pool(void) {
+    int n = parallel_options.num_threads;
+    if (n <= 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    pool = (ThreadPool *)calloc(1, sizeof(ThreadPool));
+    assertNotNull(pool);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->busy, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->num_threads = n > 1 ? n - 1 : 0;
+    if (pool->num_threads > 0) {
+        pool->threads =
+            (pthread_t *)malloc(pool->num_threads * sizeof(pthread_t));
+        assertNotNull(pool->threads);
+    }
+    for (int i = 0; i < pool->num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            pool->num_threads = i; // run with the workers we got
+            break;
+        }
+        pthread_detach(pool->threads[i]);
+    }
+}
+
+// The pool is created on first use with parallel_options.num_threads and
+// lives until the process exits.
+ThreadPool *get_thread_pool(void) {
+    pthread_once(&pool_once, init_thread_pool);
+    return pool;
+}
+
+void *worker_main(void *arg) {
+    ThreadPool *p = (ThreadPool *)arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&p->lock);
+    while (1) {
+        while (p->generation == seen) {
+            pthread_cond_wait(&p->work_ready, &p->lock);
+        }
+        seen = p->generation;
+        SumJob *job = p->job;
+        pthread_mutex_unlock(&p->lock);
+
+        run_chunks(job);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->active == 0) {
+            pthread_cond_signal(&p->work_done);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,58 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "stats.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define SUM_CHUNK_SIZE 16384 // minimum iterations per chunk
+#define SUM_MAX_CHUNKS 65536
+#define SUM_MAX_BOUND 9007199254740992.0 // 2^53, beyond it i is inexact
+
+// Sums a body over [first, last] on the calling thread with env_vars as its
+// private environment.
+typedef double range_sum_fn(void *ctx, long long first, long long last,
+                            double *env_vars);
+
+typedef struct {
+    int num_threads;              // pool size, 0 for one per online CPU
+    long long parallel_threshold; // shorter ranges are summed serially
+} ParallelOptions;
+
+typedef struct {
+    range_sum_fn *fn;
+    void *ctx;
+    long long start;
+    long long chunk_size;
+    long long num_chunks;
+    long long end;
+    double *partials;
+    const double *env_vars;
+    int env_size;
+    LineStats *line_stats; // the submitter's stats_line
+    atomic_llong next_chunk;
+} SumJob;
+
+typedef struct {
+    pthread_t *threads;
+    int num_threads; // workers, the submitting thread also runs chunks
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    pthread_mutex_t busy; // held while a job runs, one job at a time
+    SumJob *job;
+    unsigned long generation;
+    int active;
+} ThreadPool;
+
+extern ParallelOptions parallel_options;
+
+long long sum_bound(double x);
+double parallel_sum(range_sum_fn *fn, void *ctx, long long first,
+                    long long last, double *env_vars, int env_size);
+double pairwise_sum(double *values, long long n);
+void run_chunks(SumJob *job);
+ThreadPool *get_thread_pool(void);
+void *worker_main(void *arg);
+
+#endif
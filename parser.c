@@ -5,16 +5,62 @@
 #include "util.h"
 #include <assert.h>
 #include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+ParserOptions parser_options = {DEFAULT_MAX_DEPTH};
 
 Parser *new_parser(Lexer *l) {
-    Parser *p = (Parser *)calloc(1, sizeof(Parser));
+    Parser *p = (Parser *)arena_alloc(l->arena, sizeof(Parser));
+    assertNotNull(p);
+    memset(p, 0, sizeof(Parser));
+    p->l = l;
+    p->arena = l->arena;
+    return init_parser(p);
+}
+
+// Lexes the whole input up front; the parser then walks the token array
+// instead of calling into the lexer for every token.
+Parser *new_buffered_parser(Lexer *l) {
+    Parser *p = (Parser *)arena_alloc(l->arena, sizeof(Parser));
+    assertNotNull(p);
+    return init_buffered_parser(p, l);
+}
+
+Parser *init_buffered_parser(Parser *p, Lexer *l) {
     assertNotNull(p);
+    assertNotNull(l);
+    memset(p, 0, sizeof(Parser));
     p->l = l;
+    p->arena = l->arena;
+    p->tokens = lexer_tokenize(l);
+    return init_parser(p);
+}
+
+// Restarts a buffered parser on whatever input its lexer was last reset to,
+// keeping the registered parse functions. The token array is allocated from
+// the arena, so this is called again after every arena_reset.
+void parser_reset(Parser *p) {
+    assertNotNull(p);
+    p->tokens = lexer_tokenize(p->l);
+    p->token_position = 0;
+    p->errors = NULL;
+    p->num_errors = 0;
+    p->frames = NULL;
+    p->num_frames = 0;
+    p->frames_capacity = 0;
     parser_next_token(p);
     parser_next_token(p);
+}
 
+Parser *init_parser(Parser *p) {
+    assertNotNull(p);
+    parser_next_token(p);
+    parser_next_token(p);
+
+    register_prefix(p, ILLEGAL, parse_illegal_expression);
     register_prefix(p, IDENT, parse_identifier);
     register_prefix(p, NUMBER, parse_number_literal);
     register_prefix(p, MINUS, parse_prefix_expression);
@@ -40,11 +86,13 @@ void free_parser(Parser **p) {
     if (p == NULL || *p == NULL) {
         return;
     }
-    free_lexer(&(*p)->l);
-    // cur_token is freed by free_expression on root node
-    if (parser_peek_token_is(*p, TOKEN_EOF)) {
-        free_token(&(*p)->peek_token); // free EOF token
+    if ((*p)->arena != NULL) {
+        *p = NULL; // released by arena_reset
+        return;
     }
+    free_lexer(&(*p)->l);
+    safe_free((void **)&(*p)->tokens.tokens);
+    safe_free((void **)&(*p)->frames);
     for (int i = 0; i < (*p)->num_errors; i++) {
         safe_free((void **)&(*p)->errors[i]);
     }
@@ -52,38 +100,27 @@ void free_parser(Parser **p) {
     safe_free((void **)p);
 }
 
-void free_argument_array(ArgumentArray **array) {
-    if (array == NULL || *array == NULL) {
-        return;
-    }
-    ArgumentArray *arr = *array;
-    if (arr->arguments == NULL) {
-        safe_free((void **)array);
-        return;
-    }
-    for (int i = 0; i < arr->num_arguments; i++) {
-        free_expression(&arr->arguments[i]);
-    }
-    safe_free((void **)&arr->arguments);
-    safe_free((void **)array);
-}
-
 void parser_next_token(Parser *p) {
     assertNotNull(p);
     p->cur_token = p->peek_token;
-    p->peek_token = lexer_next_token(p->l);
+    if (p->tokens.tokens == NULL) {
+        p->peek_token = lexer_next_token(p->l);
+        return;
+    }
+    p->peek_token = p->tokens.tokens[p->token_position];
+    if (p->token_position + 1 < p->tokens.num_tokens) {
+        p->token_position++; // stay on the trailing EOF token
+    }
 }
 
 int parser_cur_token_is(Parser *p, TokenType t) {
     assertNotNull(p);
-    assertNotNull(p->cur_token);
-    return p->cur_token->type == t;
+    return p->cur_token.type == t;
 }
 
 int parser_peek_token_is(Parser *p, TokenType t) {
     assertNotNull(p);
-    assertNotNull(p->peek_token);
-    return p->peek_token->type == t;
+    return p->peek_token.type == t;
 }
 
 int parser_expect_peek(Parser *p, TokenType t) {
@@ -96,14 +133,12 @@ int parser_expect_peek(Parser *p, TokenType t) {
 
 Precedence cur_prec(Parser *p) {
     assertNotNull(p);
-    assertNotNull(p->cur_token);
-    return precedences[p->cur_token->type];
+    return precedences[p->cur_token.type];
 }
 
 Precedence peek_prec(Parser *p) {
     assertNotNull(p);
-    assertNotNull(p->peek_token);
-    return precedences[p->peek_token->type];
+    return precedences[p->peek_token.type];
 }
 
 void register_prefix(Parser *p, TokenType token_type, prefix_parse_fn *fn) {
@@ -115,221 +150,346 @@ void register_infix(Parser *p, TokenType token_type, infix_parse_fn *fn) {
     p->infix_parse_fns[token_type] = fn;
 }
 
-double atod(char *str) {
-    assertNotNull(str);
-    char *end;
-    errno = 0;
-    double val = strtod(str, &end);
-    if (end == str) {
-        errno = ERANGE;
-    }
-    return val;
+char *parser_token_literal(Parser *p, Token tok) {
+    assertNotNull(p);
+    return lexer_token_literal(p->l, tok);
 }
 
 Expression *parse_expression_statement(Parser *p) {
     assertNotNull(p);
+    p->error_reported = 0;
     Expression *expr = parse_expression(p, LOWEST);
-    if (p != NULL && expr == NULL && errno != EINVAL) {
-        free_token(&p->cur_token);
+    if (p->arena == NULL) {
+        safe_free((void **)&p->frames);
+        p->frames_capacity = 0;
     }
     return expr;
 }
 
-Expression *parse_expression(Parser *p, Precedence precedence) {
+// Consumes the "name =" that starts a definition. Returns a NUL-terminated
+// copy of the name from the arena, or NULL, consuming nothing, for a plain
+// expression.
+char *parse_definition(Parser *p) {
     assertNotNull(p);
-    assertNotNull(p->cur_token);
-    prefix_parse_fn *prefix = p->prefix_parse_fns[p->cur_token->type];
-    if (prefix == NULL) {
+    if (!parser_cur_token_is(p, IDENT) || !parser_peek_token_is(p, ASSIGN)) {
         return NULL;
     }
-    Expression *left_expression = prefix(p);
-    if (left_expression == NULL) {
-        return NULL;
+    size_t length = p->cur_token.length;
+    char *name = (char *)arena_alloc(p->arena, length + 1);
+    assertNotNull(name);
+    memcpy(name, parser_token_literal(p, p->cur_token), length);
+    name[length] = '\0';
+    parser_next_token(p);
+    parser_next_token(p);
+    return name;
+}
+
+// Pratt parser on an explicit stack of frames instead of the C stack, so
+// nesting is bounded by memory and parser_options.max_depth only. Parse
+// functions that need an operand push frames saying what to do with it and
+// return; this loop parses the operand and hands it to the frames.
+Expression *parse_expression(Parser *p, Precedence precedence) {
+    assertNotNull(p);
+    size_t bottom = p->num_frames;
+    parser_push_frame(p, FRAME_EXPRESSION, precedence, NULL);
+    Expression *left = NULL;
+    int need_operand = 1;
+    while (1) {
+        size_t num_frames = p->num_frames;
+        if (need_operand) {
+            prefix_parse_fn *prefix = p->prefix_parse_fns[p->cur_token.type];
+            left = prefix != NULL ? prefix(p) : NULL;
+            if (p->num_frames > num_frames) {
+                left = NULL; // owned by the new frames
+                continue;
+            }
+            if (left == NULL) {
+                break;
+            }
+            need_operand = 0;
+            continue;
+        }
+        ParseFrame *top = &p->frames[p->num_frames - 1];
+        if (top->type != FRAME_EXPRESSION) {
+            Expression *finished = parser_finish_frame(p, left);
+            if (finished == NULL && p->num_frames == num_frames) {
+                break; // syntax error, left is not attached
+            }
+            left = finished;
+        } else if (!parser_peek_token_is(p, TOKEN_EOF) &&
+                   top->precedence < peek_prec(p)) {
+            infix_parse_fn *infix = p->infix_parse_fns[p->peek_token.type];
+            if (infix == NULL) {
+                break;
+            }
+            parser_next_token(p);
+            left = infix(p, left);
+        } else {
+            p->num_frames--;
+            if (p->num_frames == bottom) {
+                return left;
+            }
+            continue;
+        }
+        if (p->num_frames > num_frames) {
+            left = NULL; // owned by the new frames
+            need_operand = 1;
+            continue;
+        }
+        if (left == NULL || !parser_check_depth(p, left)) {
+            break;
+        }
     }
-    while (!parser_peek_token_is(p, TOKEN_EOF) && precedence < peek_prec(p)) {
-        infix_parse_fn *infix = p->infix_parse_fns[p->peek_token->type];
-        if (infix == NULL) {
+    parser_unwind(p, bottom, left);
+    return NULL;
+}
+
+void parser_push_frame(Parser *p, FrameType type, Precedence precedence,
+                       Expression *expr) {
+    assertNotNull(p);
+    if (p->num_frames == p->frames_capacity) {
+        size_t cap =
+            p->frames_capacity > 0 ? 2 * p->frames_capacity : PARSER_FRAMES;
+        p->frames = (ParseFrame *)arena_realloc(
+            p->arena, p->frames, p->frames_capacity * sizeof(ParseFrame),
+            cap * sizeof(ParseFrame));
+        assertNotNull(p->frames);
+        p->frames_capacity = cap;
+    }
+    ParseFrame *frame = &p->frames[p->num_frames++];
+    frame->type = type;
+    frame->precedence = precedence;
+    frame->expr = expr;
+    frame->capacity = 0;
+}
+
+// Moves to the first token of an operand and has parse_expression parse it
+// with the given precedence.
+void parser_push_operand(Parser *p, Precedence precedence) {
+    parser_next_token(p);
+    parser_push_frame(p, FRAME_EXPRESSION, precedence, NULL);
+}
+
+// Hands a finished operand to the frame on top of the stack. Returns the
+// expression that completes, or NULL on a syntax error and after pushing
+// the operand of the next call argument.
+Expression *parser_finish_frame(Parser *p, Expression *operand) {
+    assertNotNull(p);
+    assertNotNull(operand);
+    ParseFrame *top = &p->frames[p->num_frames - 1];
+    Expression *expr = top->expr;
+    switch (top->type) {
+    case FRAME_PREFIX:
+        expr->expression.prefix_expression->right = operand;
+        expr->depth = operand->depth + 1;
+        expr->nesting = operand->nesting + 1;
+        break;
+    case FRAME_INFIX: {
+        InfixExpression *infix = expr->expression.infix_expression;
+        infix->right = operand;
+        expr->depth = 1 + (infix->left->depth > operand->depth
+                               ? infix->left->depth
+                               : operand->depth);
+        // 1+2+...+n is as deep as 1+2, however long
+        expr->nesting = infix->left->nesting > operand->nesting
+                            ? infix->left->nesting
+                            : operand->nesting + 1;
+        break;
+    }
+    case FRAME_GROUP:
+        if (!parser_expect_peek(p, RPAREN)) {
             return NULL;
         }
+        expr = operand;
+        break;
+    case FRAME_ARGUMENT:
+        if (!parser_peek_token_is(p, COMMA) &&
+            !parser_peek_token_is(p, RPAREN)) {
+            errno = EINVAL;
+            return NULL;
+        }
+        parser_add_argument(p, top, operand);
         parser_next_token(p);
-        left_expression = infix(p, left_expression);
-        if (left_expression == NULL) {
+        if (parser_cur_token_is(p, COMMA)) {
+            parser_push_operand(p, LOWEST);
             return NULL;
         }
+        break;
+    default:
+        return NULL;
     }
-    if (parser_cur_token_is(p, RPAREN)) {
-        free_token(&p->cur_token);
+    p->num_frames--;
+    return expr;
+}
+
+void parser_add_argument(Parser *p, ParseFrame *frame, Expression *argument) {
+    CallExpression *call = frame->expr->expression.call_expression;
+    if (call->num_arguments >= frame->capacity) {
+        call->arguments = (Expression **)arena_realloc(
+            p->arena, call->arguments, frame->capacity * sizeof(Expression *),
+            2 * frame->capacity * sizeof(Expression *));
+        assertNotNull(call->arguments);
+        frame->capacity *= 2;
+    }
+    call->arguments[call->num_arguments++] = argument;
+    if (argument->depth >= frame->expr->depth) {
+        frame->expr->depth = argument->depth + 1;
+    }
+    if (argument->nesting >= frame->expr->nesting) {
+        frame->expr->nesting = argument->nesting + 1;
     }
-    return left_expression;
+}
+
+int parser_check_depth(Parser *p, Expression *expr) {
+    if (expr->nesting <= parser_options.max_depth) {
+        return 1;
+    }
+    report_error("Error: Expression nested deeper than %d levels.\n",
+                 parser_options.max_depth);
+    p->error_reported = 1;
+    return 0;
+}
+
+// Drops the frames of a failed parse_expression, freeing the partial tree
+// when it is not in an arena.
+void parser_unwind(Parser *p, size_t bottom, Expression *left) {
+    if (p->arena == NULL) {
+        free_expression(&left);
+        for (size_t k = p->num_frames; k-- > bottom;) {
+            free_expression(&p->frames[k].expr);
+        }
+    }
+    p->num_frames = bottom;
 }
 
 Expression *parse_number_literal(Parser *p) {
     assertNotNull(p);
-    double value = atod(p->cur_token->literal);
-    if (errno == ERANGE) {
+    double value = p->cur_token.value;
+    if (isinf(value)) {
+        report_error("Error: Number out of range '%.*s'.\n",
+                     (int)p->cur_token.length,
+                     parser_token_literal(p, p->cur_token));
+        p->error_reported = 1;
         return NULL;
     }
 
-    NumberLiteral *literal = (NumberLiteral *)malloc(sizeof(NumberLiteral));
+    NumberLiteral *literal =
+        (NumberLiteral *)arena_alloc(p->arena, sizeof(NumberLiteral));
     assertNotNull(literal);
     literal->token = p->cur_token;
     literal->value = value;
 
-    Expression *expr = (Expression *)malloc(sizeof(Expression));
-    assertNotNull(expr);
+    Expression *expr = new_expression(p->arena, NUMBER_LITERAL);
     expr->expression.number_literal = literal;
-    expr->type = NUMBER_LITERAL;
     return expr;
 }
 
+// Illegal tokens that start like a number are malformed literals such as
+// "1.2.3" or "1e+"; any other one is left to the caller's generic error.
+Expression *parse_illegal_expression(Parser *p) {
+    assertNotNull(p);
+    char *literal = parser_token_literal(p, p->cur_token);
+    if (is_num(literal[0])) {
+        report_error("Error: Malformed number '%.*s'.\n",
+                     (int)p->cur_token.length, literal);
+        p->error_reported = 1;
+    }
+    return NULL;
+}
+
 Expression *parse_identifier(Parser *p) {
     assertNotNull(p);
-    Identifier *ident = (Identifier *)malloc(sizeof(Identifier));
+    Identifier *ident = (Identifier *)arena_alloc(p->arena, sizeof(Identifier));
     assertNotNull(ident);
     ident->token = p->cur_token;
-    ident->value = p->cur_token->literal;
-    ident->length = p->cur_token->length;
+    ident->value = parser_token_literal(p, p->cur_token);
+    ident->length = p->cur_token.length;
+    ident->keyword = lookup_keyword(ident->value, ident->length);
 
-    Expression *expr = (Expression *)malloc(sizeof(Expression));
-    assertNotNull(expr);
+    Expression *expr = new_expression(p->arena, IDENTIFIER);
     expr->expression.identifier = ident;
-    expr->type = IDENTIFIER;
+    if ((int)ident->keyword == -1 && p->variables != NULL) {
+        int k = lookup_variable(p->variables, ident->value, ident->length);
+        if (k >= 0) {
+            expr->slot = VARIABLE_SLOT(k); // read like a hoisted value
+        }
+    }
     return expr;
 }
 
 Expression *parse_prefix_expression(Parser *p) {
     assertNotNull(p);
-    assertNotNull(p->cur_token);
     PrefixExpression *prefix =
-        (PrefixExpression *)malloc(sizeof(PrefixExpression));
+        (PrefixExpression *)arena_alloc(p->arena, sizeof(PrefixExpression));
     assertNotNull(prefix);
     prefix->token = p->cur_token;
-    prefix->op = p->cur_token->literal;
-
-    parser_next_token(p);
-    Expression *right = parse_expression(p, PREFIX);
-    if (right == NULL) {
-        free_prefix_expression(&prefix);
-        return NULL;
-    }
-    prefix->right = right;
+    prefix->op = parser_token_literal(p, p->cur_token);
+    prefix->operation = NEGATE; // only MINUS is registered as a prefix
+    prefix->right = NULL;
 
-    Expression *expr = (Expression *)malloc(sizeof(Expression));
-    assertNotNull(expr);
+    Expression *expr = new_expression(p->arena, PREFIX_EXPRESSION);
     expr->expression.prefix_expression = prefix;
-    expr->type = PREFIX_EXPRESSION;
+    parser_push_frame(p, FRAME_PREFIX, PREFIX, expr);
+    parser_push_operand(p, PREFIX);
     return expr;
 }
 
 Expression *parse_infix_expression(Parser *p, Expression *left_expression) {
     assertNotNull(p);
-    assertNotNull(p->cur_token);
     assertNotNull(left_expression);
-    InfixExpression *infix = (InfixExpression *)malloc(sizeof(InfixExpression));
+    InfixExpression *infix =
+        (InfixExpression *)arena_alloc(p->arena, sizeof(InfixExpression));
     assertNotNull(infix);
     infix->token = p->cur_token;
-    infix->op = p->cur_token->literal;
+    infix->op = parser_token_literal(p, p->cur_token);
+    infix->operation = token_operator(p->cur_token.type);
     infix->left = left_expression;
+    infix->right = NULL;
 
-    Precedence prec = cur_prec(p);
-    parser_next_token(p);
-    Expression *right = parse_expression(p, prec);
-    if (right == NULL) {
-        free_infix_expression(&infix);
-        return NULL;
-    }
-    infix->right = right;
-
-    Expression *expr = (Expression *)malloc(sizeof(Expression));
-    assertNotNull(expr);
+    Expression *expr = new_expression(p->arena, INFIX_EXPRESSION);
     expr->expression.infix_expression = infix;
-    expr->type = INFIX_EXPRESSION;
+    Precedence prec = cur_prec(p);
+    parser_push_frame(p, FRAME_INFIX, prec, expr);
+    parser_push_operand(p, prec);
     return expr;
 }
 
+// The grouped expression is the operand the pushed frames produce.
 Expression *parse_grouped_expression(Parser *p) {
     assertNotNull(p);
-    assert(p->cur_token->type == LPAREN);
-    free_token(&p->cur_token);
-    parser_next_token(p);
-    Expression *expr = parse_expression(p, LOWEST);
-    if (!parser_expect_peek(p, RPAREN)) {
-        free_expression(&expr);
-        return NULL;
-    }
-    return expr;
+    assert(p->cur_token.type == LPAREN);
+    parser_push_frame(p, FRAME_GROUP, LOWEST, NULL);
+    parser_push_operand(p, LOWEST);
+    return NULL;
 }
 
 Expression *parse_call_expression(Parser *p, Expression *function) {
     assertNotNull(p);
-    assertNotNull(p->cur_token);
     assertNotNull(function);
     CallExpression *call_expression =
-        (CallExpression *)calloc(1, sizeof(CallExpression));
+        (CallExpression *)arena_alloc(p->arena, sizeof(CallExpression));
     assertNotNull(call_expression);
+    memset(call_expression, 0, sizeof(CallExpression));
     call_expression->token = p->cur_token;
     call_expression->function = function;
-    ArgumentArray *arr = parse_call_arguments(p);
-    if (arr == NULL) {
-        free_call_expression(&call_expression);
-        return NULL;
-    }
-    call_expression->arguments = arr->arguments;
-    call_expression->num_arguments = arr->num_arguments;
-    safe_free((void **)&arr);
-
-    Expression *expr = (Expression *)malloc(sizeof(Expression));
-    assertNotNull(expr);
-    expr->expression.call_expression = call_expression;
-    expr->type = CALL_EXPRESSION;
-    return expr;
-}
-
-ArgumentArray *parse_call_arguments(Parser *p) {
-    assertNotNull(p);
-    errno = 0;
+    call_expression->keyword =
+        function->type == IDENTIFIER ? function->expression.identifier->keyword
+                                     : (KeywordType)-1;
     int cap = 4;
-    ArgumentArray *arr = (ArgumentArray *)malloc(sizeof(ArgumentArray));
-    assertNotNull(arr);
-    Expression **arguments = (Expression **)malloc(cap * sizeof(Expression *));
-    assertNotNull(arguments);
-    arr->arguments = arguments;
-    arr->num_arguments = 0;
+    call_expression->arguments =
+        (Expression **)arena_alloc(p->arena, cap * sizeof(Expression *));
+    assertNotNull(call_expression->arguments);
 
+    Expression *expr = new_expression(p->arena, CALL_EXPRESSION);
+    expr->expression.call_expression = call_expression;
+    expr->depth = function->depth + 1;
+    expr->nesting = function->nesting + 1;
     if (parser_peek_token_is(p, RPAREN)) {
         parser_next_token(p);
-        return arr;
+        return expr;
     }
-
-    parser_next_token(p);
-    arguments[0] = parse_expression(p, LOWEST);
-    if (arguments[0] == NULL) {
-        free_argument_array(&arr);
-        return NULL;
-    }
-    arr->num_arguments++;
-
-    while (parser_peek_token_is(p, COMMA)) {
-        parser_next_token(p);
-        free_token(&p->cur_token); // free COMMA token
-        parser_next_token(p);
-        if (arr->num_arguments >= cap) {
-            cap *= 2;
-            arguments = (Expression **)realloc(arguments, cap);
-            assertNotNull(arguments);
-        }
-        Expression *expr = parse_expression(p, LOWEST);
-        if (expr == NULL) {
-            free_argument_array(&arr);
-            return NULL;
-        }
-        arguments[arr->num_arguments] = expr;
-        arr->num_arguments++;
-    }
-    if (!parser_expect_peek(p, RPAREN)) {
-        errno = EINVAL;
-        free_argument_array(&arr);
-        return NULL;
-    }
-    return arr;
+    parser_push_frame(p, FRAME_ARGUMENT, LOWEST, expr);
+    p->frames[p->num_frames - 1].capacity = cap;
+    parser_push_operand(p, LOWEST);
+    return expr;
 }
@@ -1,9 +1,14 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "arena.h"
 #include "ast.h"
 #include "lexer.h"
 #include "token.h"
+#include "variables.h"
+
+#define DEFAULT_MAX_DEPTH 10000
+#define PARSER_FRAMES 16 // initial size of the frame stack
 
 struct Parser;
 
@@ -11,38 +16,70 @@ typedef Expression *prefix_parse_fn(struct Parser *p);
 typedef Expression *infix_parse_fn(struct Parser *p,
                                    Expression *left_expression);
 
+typedef struct {
+    int max_depth; // deepest expression accepted, see Expression.nesting
+} ParserOptions;
+
+// What parse_expression does with the next finished operand.
+typedef enum {
+    FRAME_EXPRESSION, // extend it with operators above precedence
+    FRAME_PREFIX,     // make it the operand of expr
+    FRAME_INFIX,      // make it the right operand of expr
+    FRAME_GROUP,      // expect the closing parenthesis after it
+    FRAME_ARGUMENT,   // append it to the arguments of the call expr
+} FrameType;
+
+typedef struct {
+    FrameType type;
+    Precedence precedence;
+    Expression *expr;
+    int capacity; // FRAME_ARGUMENT: size of the arguments array
+} ParseFrame;
+
 typedef struct Parser {
     Lexer *l;
-    Token *cur_token;
-    Token *peek_token;
+    Arena *arena; // shared with the lexer, NULL for heap allocation
+    Token cur_token;
+    Token peek_token;
+    // Whole-input token array for buffered parsers; tokens.tokens is NULL
+    // when tokens are pulled from the lexer one at a time.
+    TokenArray tokens;
+    size_t token_position;
     char **errors;
     int num_errors;
+    // Explicit stack of parse_expression, in the arena like the tree
+    ParseFrame *frames;
+    size_t num_frames;
+    size_t frames_capacity;
+    int error_reported; // the last parse failed with an error it reported
+    VariableTable *variables; // names resolved to env_vars slots, or NULL
 
     prefix_parse_fn *prefix_parse_fns[NUM_TOKEN_TYPES];
     infix_parse_fn *infix_parse_fns[NUM_TOKEN_TYPES];
 } Parser;
 
-typedef struct {
-    Expression **arguments;
-    int num_arguments;
-} ArgumentArray;
+extern ParserOptions parser_options;
 
 Parser *new_parser(Lexer *l);
+Parser *new_buffered_parser(Lexer *l);
+Parser *init_buffered_parser(Parser *p, Lexer *l);
+void parser_reset(Parser *p);
+Parser *init_parser(Parser *p);
 void print_parser_errors(Parser *p, FILE *out);
 void free_parser(Parser **p);
-void free_argument_array(ArgumentArray **arr);
 void parser_next_token(Parser *p);
 int parser_cur_token_is(Parser *p, TokenType t);
 int parser_peek_token_is(Parser *p, TokenType t);
 int parser_expect_peek(Parser *p, TokenType t);
 Precedence cur_prec(Parser *p);
 Precedence peek_prec(Parser *p);
-double atod(char *str);
+char *parser_token_literal(Parser *p, Token tok);
 
 void register_prefix(Parser *p, TokenType token_type, prefix_parse_fn *fn);
 void register_infix(Parser *p, TokenType token_type, infix_parse_fn *fn);
 
 Expression *parse_expression_statement(Parser *p);
+char *parse_definition(Parser *p);
 Expression *parse_expression(Parser *p, Precedence precedence);
 Expression *parse_identifier(Parser *p);
 Expression *parse_illegal_expression(Parser *p);
@@ -51,6 +88,12 @@ Expression *parse_infix_expression(Parser *p, Expression *left_expression);
 Expression *parse_number_literal(Parser *p);
 Expression *parse_grouped_expression(Parser *p);
 Expression *parse_call_expression(Parser *p, Expression *function);
-ArgumentArray *parse_call_arguments(Parser *p);
+void parser_push_frame(Parser *p, FrameType type, Precedence precedence,
+                       Expression *expr);
+void parser_push_operand(Parser *p, Precedence precedence);
+Expression *parser_finish_frame(Parser *p, Expression *operand);
+void parser_add_argument(Parser *p, ParseFrame *frame, Expression *argument);
+int parser_check_depth(Parser *p, Expression *expr);
+void parser_unwind(Parser *p, size_t bottom, Expression *left);
 
 #endif
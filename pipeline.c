@@ -0,0 +1,243 @@
+#include "pipeline.h"
+#include "repl.h"
+#include "stats.h"
+#include "util.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Evaluates lines with a reader (the calling thread), num_workers workers
+// and one writer, connected by a ring of PIPELINE_RING_SIZE slots. Workers
+// take lines in order but finish them in any order; the writer prints them
+// in input order. A line only waits for the one before it when it reads
+// ans, or when it fails and has to pass the previous ans along. A
+// definition waits for every line before it and holds back the ones after
+// it, since it changes the variables they read. Lines come from
+// input[0..n) when it is not NULL, from in otherwise.
+int run_pipeline(FILE *in, char *input, size_t n, FILE *out, int num_workers) {
+    assertNotNull(out);
+    if (num_workers > MAX_PIPELINE_WORKERS) {
+        num_workers = MAX_PIPELINE_WORKERS;
+    }
+    Pipeline *pl = (Pipeline *)calloc(1, sizeof(Pipeline));
+    assertNotNull(pl);
+    pl->out = out;
+    pl->variables = new_variable_table();
+
+    pthread_t writer;
+    pthread_t workers[MAX_PIPELINE_WORKERS];
+    int num_started = 0;
+    if (pthread_create(&writer, NULL, pipeline_writer, pl) != 0) {
+        report_error("Error: Cannot start pipeline threads.\n");
+        free(pl);
+        return 0;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i], NULL, pipeline_worker, pl) != 0) {
+            break;
+        }
+        num_started++;
+    }
+    if (num_started == 0) {
+        // no worker, the reader stops at once and the writer exits
+        report_error("Error: Cannot start pipeline threads.\n");
+        atomic_store_explicit(&pl->finished, 1, memory_order_release);
+    }
+
+    char *end = input != NULL ? input + n : NULL;
+    while (num_started > 0) {
+        size_t seq = atomic_load_explicit(&pl->produced, memory_order_relaxed);
+        int spins = 0;
+        // keep the previous line's slot intact until this one is written,
+        // pipeline_ans_before reads it
+        while (seq + 1 >= atomic_load_explicit(&pl->consumed,
+                                               memory_order_acquire) +
+                              PIPELINE_RING_SIZE) {
+            pipeline_backoff(&spins);
+        }
+        PipelineSlot *slot = &pl->slots[seq % PIPELINE_RING_SIZE];
+        STATS_SET_LINE(&slot->line_stats);
+        STATS_BEGIN(input_start);
+        int found = pipeline_read_line(pl, in, &input, end);
+        STATS_END(PHASE_INPUT, input_start);
+        STATS_SET_LINE(NULL);
+        if (!found) {
+            break;
+        }
+        atomic_store_explicit(&slot->state, SLOT_READY, memory_order_release);
+        atomic_store_explicit(&pl->produced, seq + 1, memory_order_release);
+        while (slot->is_definition &&
+               atomic_load_explicit(&slot->state, memory_order_acquire) ==
+                   SLOT_READY) {
+            pipeline_backoff(&spins);
+        }
+    }
+    atomic_store_explicit(&pl->finished, 1, memory_order_release);
+
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_join(writer, NULL);
+    for (int i = 0; i < PIPELINE_RING_SIZE; i++) {
+        free(pl->slots[i].copy);
+    }
+    free_variable_table(&pl->variables);
+    free(pl);
+    return num_started > 0;
+}
+
+// Fills the next free slot with a line, sliced from *input when it is not
+// NULL and copied from in otherwise. Returns 0 at EOF or on "exit".
+int pipeline_read_line(Pipeline *pl, FILE *in, char **input, char *end) {
+    size_t seq = atomic_load_explicit(&pl->produced, memory_order_relaxed);
+    PipelineSlot *slot = &pl->slots[seq % PIPELINE_RING_SIZE];
+    if (*input != NULL) {
+        if (*input >= end) {
+            return 0;
+        }
+        char *newline = (char *)memchr(*input, '\n', end - *input);
+        slot->line = *input;
+        slot->length = newline != NULL ? (size_t)(newline - *input)
+                                       : (size_t)(end - *input);
+        *input += slot->length + 1;
+    } else {
+        ssize_t len = getline(&slot->copy, &slot->copy_cap, in);
+        if (len == -1) {
+            return 0;
+        }
+        slot->line = slot->copy;
+        slot->length = len;
+    }
+    slot->is_definition = is_definition(slot->line, slot->length);
+    return !is_exit(slot->line, slot->length);
+}
+
+void *pipeline_worker(void *arg) {
+    Pipeline *pl = (Pipeline *)arg;
+    Session *s = new_session();
+    free_variable_table(&s->variables);
+    s->variables = pl->variables;
+    while (1) {
+        size_t seq = atomic_fetch_add(&pl->claimed, 1);
+        int spins = 0;
+        while (seq >=
+               atomic_load_explicit(&pl->produced, memory_order_acquire)) {
+            if (atomic_load_explicit(&pl->finished, memory_order_acquire) &&
+                seq >= atomic_load_explicit(&pl->produced,
+                                            memory_order_acquire)) {
+                s->variables = NULL; // pl's
+                free_session(&s);
+                return NULL;
+            }
+            pipeline_backoff(&spins);
+        }
+        PipelineSlot *slot = &pl->slots[seq % PIPELINE_RING_SIZE];
+        // the reader produces nothing after a definition until it is done,
+        // so once the lines before it are written out no other thread uses
+        // the variables
+        while (slot->is_definition &&
+               atomic_load_explicit(&pl->consumed, memory_order_acquire) <
+                   seq) {
+            pipeline_backoff(&spins);
+        }
+
+        slot->errors.length = 0;
+        slot->is_stats = is_command(slot->line, slot->length, ":stats");
+        error_buffer = &slot->errors;
+        STATS_SET_LINE(&slot->line_stats);
+        double x = 0.0;
+        int ok = 0;
+        LineStatus status = LINE_FAILED; // :stats, nothing to print
+        if (!slot->is_stats) {
+            status = session_prepare(s, slot->line, slot->length);
+        }
+        if (status == LINE_OK) {
+            double ans = 0.0;
+            if (s->uses_ans) {
+                ans = pipeline_ans_before(pl, seq);
+            }
+            STATS_BEGIN(eval_start);
+            ok = session_run(s, ans, &x);
+            STATS_END(PHASE_EVAL, eval_start);
+        }
+        STATS_SET_LINE(NULL);
+        error_buffer = NULL;
+        arena_reset(s->arena);
+
+        slot->status = status;
+        slot->ok = ok;
+        slot->value = x;
+        slot->ans_after = ok ? x : pipeline_ans_before(pl, seq);
+        atomic_store_explicit(&slot->state, SLOT_DONE, memory_order_release);
+    }
+}
+
+void *pipeline_writer(void *arg) {
+    Pipeline *pl = (Pipeline *)arg;
+    for (size_t seq = 0;; seq++) {
+        PipelineSlot *slot = &pl->slots[seq % PIPELINE_RING_SIZE];
+        int spins = 0;
+        while (atomic_load_explicit(&slot->state, memory_order_acquire) !=
+               SLOT_DONE) {
+            if (atomic_load_explicit(&pl->finished, memory_order_acquire) &&
+                seq >= atomic_load_explicit(&pl->produced,
+                                            memory_order_acquire)) {
+                return NULL;
+            }
+            pipeline_backoff(&spins);
+        }
+        // every earlier line has been recorded, so :stats sees them all
+        STATS_SET_LINE(&slot->line_stats);
+        if (slot->is_stats) {
+            print_stats(pl->out);
+            print_variable_stats(pl->out, pl->variables);
+            STATS_CLEAR_LINE();
+        } else {
+            STATS_BEGIN(output_start);
+            fwrite(slot->errors.text, 1, slot->errors.length, pl->out);
+            if (slot->status == LINE_INVALID) {
+                fprintf(pl->out, "Invalid calculator input.\n");
+            } else if (slot->ok) {
+                fprintf(pl->out, "%.8g\n", slot->value);
+            }
+            STATS_END(PHASE_OUTPUT, output_start);
+            STATS_END_LINE();
+        }
+        STATS_SET_LINE(NULL);
+        atomic_store_explicit(&slot->state, SLOT_EMPTY, memory_order_release);
+        atomic_store_explicit(&pl->consumed, seq + 1, memory_order_release);
+    }
+}
+
+// The ans a line sees: whatever the previous line left behind, or 0 for
+// the first line. The previous slot still holds that line, DONE or already
+// written out (EMPTY), see run_pipeline.
+double pipeline_ans_before(Pipeline *pl, size_t seq) {
+    if (seq == 0) {
+        return 0.0;
+    }
+    PipelineSlot *prev = &pl->slots[(seq - 1) % PIPELINE_RING_SIZE];
+    int spins = 0;
+    while (atomic_load_explicit(&prev->state, memory_order_acquire) ==
+           SLOT_READY) {
+        pipeline_backoff(&spins);
+    }
+    return prev->ans_after;
+}
+
+// Spins briefly, then yields, then sleeps, so idle stages do not keep a
+// core busy while input trickles in.
+void pipeline_backoff(int *spins) {
+    if (*spins < 64) {
+        (*spins)++;
+    } else if (*spins < 128) {
+        (*spins)++;
+        sched_yield();
+    } else {
+        struct timespec ts = {0, 50000};
+        nanosleep(&ts, NULL);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "repl.h"
+#include "stats.h"
+#include "util.h"
+#include "variables.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define PIPELINE_RING_SIZE 1024 // lines in flight, power of two
+#define MAX_PIPELINE_WORKERS 256
+
+typedef enum {
+    SLOT_EMPTY, // written out, free for the reader
+    SLOT_READY, // holds a line for a worker
+    SLOT_DONE,  // evaluated, waiting for the writer
+} SlotState;
+
+// One line travelling through the pipeline. The reader owns an EMPTY slot,
+// one worker a READY slot, and the writer a DONE slot; state changes are
+// release stores so the fields written before them are visible after.
+typedef struct {
+    atomic_int state;
+    char *line;
+    size_t length;
+    char *copy; // line storage for unmapped input, reused by the slot
+    size_t copy_cap;
+    LineStatus status;
+    int ok;
+    double value;
+    double ans_after; // ans once this line is done, for the next line
+    int is_stats;     // a :stats line, printed by the writer in order
+    int is_definition; // runs alone, see pipeline_worker
+    ErrorBuffer errors;
+    LineStats line_stats; // recorded by the writer, see stats_line
+} PipelineSlot;
+
+typedef struct {
+    PipelineSlot slots[PIPELINE_RING_SIZE];
+    atomic_size_t produced; // lines handed to workers
+    atomic_size_t claimed;  // next line a worker takes
+    atomic_size_t consumed; // lines written out
+    atomic_int finished;    // reader saw EOF or exit, produced is final
+    VariableTable *variables; // read by every worker, changed by definitions
+    FILE *out;
+} Pipeline;
+
+int run_pipeline(FILE *in, char *input, size_t n, FILE *out, int num_workers);
+int pipeline_read_line(Pipeline *pl, FILE *in, char **input, char *end);
+void *pipeline_worker(void *arg);
+void *pipeline_writer(void *arg);
+double pipeline_ans_before(Pipeline *pl, size_t seq);
+void pipeline_backoff(int *spins);
+
+#endif
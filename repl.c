@@ -1,42 +1,467 @@
 #include "repl.h"
 #include "ast.h"
+#include "cache.h"
+#include "closedform.h"
+#include "compiler.h"
+#include "cse.h"
 #include "evaluator.h"
+#include "keyword.h"
 #include "lexer.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "resolver.h"
+#include "stats.h"
 #include "token.h"
 #include "util.h"
+#include "variables.h"
+#include "vm.h"
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 const char *PROMPT = ">> ";
+ReplOptions repl_options = {.cache_size = DEFAULT_CACHE_SIZE};
 
 int start(FILE *in, FILE *out) {
     assertNotNull(in);
     assertNotNull(out);
-    double ans = 0.0;
+    run_stream(fileno(in), out, PROMPT);
+    return 0;
+}
+
+// Evaluates every line of in without prompts, stopping at EOF or at a line
+// starting with "exit". Regular files are memory-mapped and lexed in place;
+// pipes are read line by line into one reused buffer.
+int run_batch(FILE *in, FILE *out) {
+    assertNotNull(in);
+    assertNotNull(out);
+    struct stat st;
+    if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode)) {
+        return run_fd(fileno(in), st.st_size, out);
+    }
+    if (use_pipeline()) {
+        return run_pipeline(in, NULL, 0, out, repl_options.workers);
+    }
+    return run_stream(fileno(in), out, NULL);
+}
+
+// Reads fd through a streaming lexer. Lines that fit in one chunk are
+// evaluated in place, like mapped input; longer ones are parsed while the
+// lexer refills its window, so memory does not grow with the line length.
+// Prints prompt before each line when it is not NULL (interactive use).
+int run_stream(int fd, FILE *out, const char *prompt) {
+    assertNotNull(out);
+    Session *s = new_session();
+    Lexer stream;
+    init_stream_lexer(&stream, s->arena, fd);
     while (1) {
-        fprintf(out, "%s", PROMPT);
-        char *buffer = get_input(in, out);
-        assertNotNull(buffer);
-        Lexer *l = new_lexer(buffer, MAX_BUFFER_SIZE);
-        Parser *p = new_parser(l);
-        Expression *ptr = parse_expression_statement(p);
-        if (ptr == NULL) {
-            fprintf(out, "Invalid calculator input.\n");
+        if (prompt != NULL) {
+            fprintf(out, "%s", prompt);
+            fflush(out);
+        }
+        char *line;
+        size_t len;
+        STATS_BEGIN(input_start);
+        int found = lexer_next_line(&stream, &line, &len);
+        STATS_END(PHASE_INPUT, input_start);
+        if (found == 0) {
+            if (prompt != NULL) {
+                fprintf(out, "\n"); // end of input
+            }
+            break;
+        }
+        if (is_exit(line, len)) {
+            if (prompt != NULL) {
+                fprintf(out, "Exiting...\n");
+            }
+            break;
+        }
+        if (found > 0) {
+            session_eval(s, line, len, out);
         } else {
-            errno = 0;
-            double env_vars[NUM_ENV_VARS] = {ans, 0.0};
-            ans = eval(ptr, env_vars);
-            if (errno != EINVAL) {
-                fprintf(out, "%.8g\n", ans);
+            session_eval_stream(s, &stream, out);
+        }
+    }
+    close_stream_lexer(&stream);
+    free_session(&s);
+    return 1;
+}
+
+// Regular files are mapped by run_batch; FIFOs, /dev/stdin and <(...)
+// report a size of 0, so they are streamed like piped input.
+int run_file(const char *path, FILE *out) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        printf("Error: Cannot read '%s'.\n", path);
+        return 0;
+    }
+    int ok = run_batch(in, out);
+    fclose(in);
+    return ok;
+}
+
+int run_fd(int fd, size_t size, FILE *out) {
+    if (size == 0) {
+        return 1;
+    }
+    char *input = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (input == MAP_FAILED) {
+        printf("Error: Cannot map input.\n");
+        errno = EINVAL;
+        return 0;
+    }
+    madvise(input, size, MADV_SEQUENTIAL);
+    int ok = run_buffer(input, size, out);
+    munmap(input, size);
+    return ok;
+}
+
+// Lines are handed to the lexer as (pointer, length) slices of input.
+int run_buffer(char *input, size_t n, FILE *out) {
+    assertNotNull(input);
+    if (use_pipeline()) {
+        return run_pipeline(NULL, input, n, out, repl_options.workers);
+    }
+    Session *s = new_session();
+    char *end = input + n;
+    for (char *line = input; line < end;) {
+        char *newline = (char *)memchr(line, '\n', end - line);
+        size_t len = newline != NULL ? (size_t)(newline - line)
+                                     : (size_t)(end - line);
+        if (is_exit(line, len)) {
+            break;
+        }
+        session_eval(s, line, len, out);
+        line += len + 1;
+    }
+    free_session(&s);
+    return 1;
+}
+
+// -p output is printed by whoever evaluates, so it stays serial.
+int use_pipeline(void) {
+    return repl_options.workers > 0 && !repl_options.print_tree;
+}
+
+int is_exit(const char *line, size_t len) {
+    return is_command(line, len, "exit");
+}
+
+// Whether line starts with "name =", without lexing the rest of it.
+int is_definition(const char *line, size_t len) {
+    size_t k = 0;
+    while (k < len && (line[k] == ' ' || line[k] == '\t')) {
+        k++;
+    }
+    if (k == len || !is_letter(line[k])) {
+        return 0;
+    }
+    while (k < len && (is_letter(line[k]) || is_digit(line[k]))) {
+        k++;
+    }
+    while (k < len && (line[k] == ' ' || line[k] == '\t')) {
+        k++;
+    }
+    return k < len && line[k] == '=';
+}
+
+int is_command(const char *line, size_t len, const char *command) {
+    size_t n = strlen(command);
+    return len >= n && strncmp(line, command, n) == 0;
+}
+
+// One arena, lexer and parser for a whole run: each line resets them
+// instead of allocating new ones.
+Session *new_session(void) {
+    Session *s = (Session *)malloc(sizeof(Session));
+    assertNotNull(s);
+    s->arena = new_arena(ARENA_BLOCK_SIZE);
+    s->ans = 0.0;
+    s->cache = new_program_cache(repl_options.cache_size);
+    s->variables = new_variable_table();
+    s->definitions = NULL;
+    init_lexer(&s->l, s->arena, "", 0);
+    init_buffered_parser(&s->p, &s->l);
+    arena_reset(s->arena);
+    return s;
+}
+
+void free_session(Session **s) {
+    if (s == NULL || *s == NULL) {
+        return;
+    }
+    free_arena(&(*s)->arena);
+    free_program_cache(&(*s)->cache);
+    free_variable_table(&(*s)->variables);
+    free_arena(&(*s)->definitions);
+    safe_free((void **)s);
+}
+
+// Parses, checks and evaluates one line, printing its value or an error.
+// Returns 1 when a value was printed and stored in ans.
+int session_eval(Session *s, char *line, size_t n, FILE *out) {
+    assertNotNull(s);
+    if (is_command(line, n, ":stats")) {
+        print_stats(out);
+        print_cache_stats(out, s->cache);
+        print_variable_stats(out, s->variables);
+        STATS_CLEAR_LINE();
+        return 0;
+    }
+    return session_finish(s, session_prepare(s, line, n), out);
+}
+
+// Evaluates the line a streaming lexer is positioned at, parsing it as it
+// is read. Such lines are too long to be worth caching.
+int session_eval_stream(Session *s, Lexer *stream, FILE *out) {
+    assertNotNull(s);
+    assertNotNull(stream);
+    s->prog = NULL;
+    s->owns_prog = 0;
+    STATS_BEGIN(parse_start);
+    Parser *p = new_parser(stream);
+    LineStatus status = session_parse(s, p);
+    lexer_skip_line(stream);
+    STATS_END(PHASE_PARSE, parse_start);
+    if (status == LINE_OK) {
+        STATS_COUNT(COUNTER_NODES, count_nodes(s->expr));
+        STATS_BEGIN(compile_start);
+        status = session_compile(s, NULL, 0, 0);
+        STATS_END(PHASE_COMPILE, compile_start);
+    }
+    return session_finish(s, status, out);
+}
+
+// Runs a prepared line and prints its value, or the parse error. Returns 1
+// when a value was printed and stored in ans.
+int session_finish(Session *s, LineStatus status, FILE *out) {
+    assertNotNull(s);
+    if (status == LINE_INVALID) {
+        fprintf(out, "Invalid calculator input.\n");
+    }
+    if (status != LINE_OK) {
+        arena_reset(s->arena); // resolve errors are already reported
+        STATS_END_LINE();
+        return 0;
+    }
+    if (repl_options.print_tree) {
+        print_expression(out, s->expr);
+        fprintf(out, "\n");
+    }
+    double x;
+    STATS_BEGIN(eval_start);
+    int ok = session_run(s, s->ans, &x);
+    STATS_END(PHASE_EVAL, eval_start);
+    STATS_BEGIN(output_start);
+    if (ok) {
+        s->ans = x;
+        fprintf(out, "%.8g\n", x);
+    }
+    STATS_END(PHASE_OUTPUT, output_start);
+    arena_reset(s->arena);
+    STATS_END_LINE();
+    return ok;
+}
+
+// Turns one line into something session_run can evaluate: a compiled
+// program, from the cache when the same text was seen before, or s->expr
+// for the tree walker. s->env_vars is sized for the hoisted slots.
+// Everything but cached programs lives in s->arena until the caller
+// resets it.
+LineStatus session_prepare(Session *s, char *line, size_t n) {
+    assertNotNull(s);
+    STATS_BEGIN(lookup_start);
+    s->expr = NULL;
+    s->name = NULL;
+    s->prog = NULL;
+    s->owns_prog = 0;
+    // -p needs the expression, which the cache does not keep
+    int cached = s->cache != NULL && !repl_options.tree_walk &&
+                 !repl_options.print_tree;
+    char *key = NULL;
+    size_t key_length = 0;
+    uint64_t hash = 0;
+    if (cached) {
+        key = (char *)arena_alloc(s->arena, n > 0 ? n : 1);
+        assertNotNull(key);
+        key_length = normalize_expression(line, n, key);
+        hash = fnv1a_hash(key, key_length);
+        CacheEntry *entry = cache_lookup(s->cache, key, key_length, hash);
+        if (entry != NULL) {
+            s->prog = entry->prog;
+            s->uses_ans = entry->uses_ans;
+            s->env_size = s->prog->env_size;
+            s->env_vars = (double *)arena_alloc(
+                s->arena, s->env_size * sizeof(double));
+            assertNotNull(s->env_vars);
+            STATS_END(PHASE_COMPILE, lookup_start);
+            return LINE_OK;
+        }
+    }
+    STATS_END(PHASE_COMPILE, lookup_start);
+
+    STATS_BEGIN(lex_start);
+    lexer_reset(&s->l, line, n);
+    parser_reset(&s->p);
+    STATS_END(PHASE_LEX, lex_start);
+    STATS_COUNT(COUNTER_TOKENS, s->p.tokens.num_tokens - 1);
+    STATS_BEGIN(parse_start);
+    LineStatus status = session_parse(s, &s->p);
+    STATS_END(PHASE_PARSE, parse_start);
+    if (status != LINE_OK) {
+        return status;
+    }
+    STATS_COUNT(COUNTER_NODES, count_nodes(s->expr));
+    STATS_BEGIN(compile_start);
+    status = session_compile(s, key, key_length, hash);
+    STATS_END(PHASE_COMPILE, compile_start);
+    return status;
+}
+
+// Parses the line p is at into s->expr, after the "name =" of a definition
+// if it starts with one. The tree walker keeps the tree of a definition,
+// so that is built in s->definitions instead of s->arena.
+LineStatus session_parse(Session *s, Parser *p) {
+    assertNotNull(s);
+    assertNotNull(p);
+    p->variables = s->variables;
+    s->tree_arena = s->arena;
+    s->name = parse_definition(p);
+    if (s->name != NULL) {
+        if ((int)lookup_keyword(s->name, strlen(s->name)) != -1) {
+            report_error("Error: Cannot define keyword '%s'.\n", s->name);
+            errno = EINVAL;
+            return LINE_FAILED;
+        }
+        if (repl_options.tree_walk) {
+            if (s->definitions == NULL) {
+                s->definitions = new_arena(ARENA_BLOCK_SIZE);
             }
-            free_expression(&ptr);
+            arena_reset(s->definitions);
+            s->tree_arena = p->arena = s->definitions;
         }
-        free_parser(&p);
     }
-    return 0;
+    s->expr = parse_expression_statement(p);
+    p->arena = s->arena;
+    if (s->expr == NULL) {
+        // malformed numbers and the depth limit report their own error
+        return p->error_reported ? LINE_FAILED : LINE_INVALID;
+    }
+    return LINE_OK;
+}
+
+// Checks, optimizes and compiles s->expr, then caches the program when key
+// is not NULL.
+LineStatus session_compile(Session *s, char *key, size_t key_length,
+                           uint64_t hash) {
+    assertNotNull(s);
+    if (!resolve_expression(s->expr)) {
+        return LINE_FAILED;
+    }
+    if (repl_options.optimize) {
+        s->expr = fold_expression(s->expr, s->tree_arena);
+    }
+    s->uses_ans = uses_keyword(s->expr, ANS);
+    if (s->name != NULL && !session_check_definition(s)) {
+        return LINE_FAILED;
+    }
+    if (closed_form_options.enabled) {
+        find_closed_forms(s->expr, s->tree_arena);
+    }
+    // hoisted invariants go past the variables
+    int first_slot =
+        VARIABLE_SLOT(s->variables != NULL ? s->variables->num_vars : 0);
+    int num_slots = hoist_invariants(s->expr, first_slot, s->tree_arena);
+    s->expr = hash_cons(s->expr, s->tree_arena);
+    s->env_size = first_slot + num_slots;
+    s->env_vars =
+        (double *)arena_alloc(s->arena, s->env_size * sizeof(double));
+    assertNotNull(s->env_vars);
+    if (repl_options.tree_walk) {
+        return LINE_OK;
+    }
+    s->prog = compile(s->expr);
+    if (s->prog == NULL) {
+        return LINE_FAILED;
+    }
+    if (key != NULL && s->name == NULL) {
+        cache_insert(s->cache, key, key_length, hash, s->prog, s->uses_ans);
+    } else {
+        s->owns_prog = 1;
+    }
+    return LINE_OK;
+}
+
+// A definition is evaluated again whenever its inputs change, so it must
+// not read ans, nor itself through other definitions. Returns 0 after
+// reporting why it cannot be defined.
+int session_check_definition(Session *s) {
+    assertNotNull(s);
+    if (s->uses_ans) {
+        report_error("Error: Definitions cannot read ans.\n");
+        errno = EINVAL;
+        return 0;
+    }
+    s->num_deps =
+        variable_dependencies(s->variables, s->expr, s->arena, &s->deps);
+    int k = lookup_variable(s->variables, s->name, strlen(s->name));
+    if (k >= 0 && depends_on_variable(s->variables, s->deps, s->num_deps, k)) {
+        report_error("Error: Circular definition of '%s'.\n", s->name);
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+// Evaluates the prepared line with the given ans, then stores it when it
+// is a definition. Returns 0 on error.
+int session_run(Session *s, double ans, double *result) {
+    assertNotNull(s);
+    s->env_vars[ENV_ANS] = ans;
+    s->env_vars[ENV_I] = 0.0;
+    if (s->variables != NULL) {
+        load_variables(s->variables, s->env_vars, s->env_size);
+    }
+    errno = 0;
+    int ok = 1;
+    if (repl_options.tree_walk) {
+        *result = eval(s->expr, s->env_vars);
+        ok = errno != EINVAL;
+    } else {
+        *result = vm_run(s->prog, s->env_vars);
+    }
+    if (ok && s->name != NULL) {
+        session_define(s, *result);
+    }
+    if (s->owns_prog) {
+        free_program(&s->prog);
+    }
+    return ok;
+}
+
+// Gives the variable the line defines its new definition and value, then
+// recomputes just the definitions that read it.
+void session_define(Session *s, double value) {
+    assertNotNull(s);
+    VariableTable *t = s->variables;
+    size_t length = strlen(s->name);
+    int k = lookup_variable(t, s->name, length);
+    if (k < 0) {
+        k = add_variable(t, s->name, length);
+    }
+    // only the tree walker's tree outlives the line, in s->definitions
+    define_variable(t, k, repl_options.tree_walk ? s->expr : NULL,
+                    &s->definitions, s->prog, s->deps, s->num_deps,
+                    s->env_size, value);
+    s->prog = NULL;
+    s->owns_prog = 0;
+    recompute_dependents(t, k);
 }
 
 int parser_repl(FILE *in, FILE *out) {
@@ -44,7 +469,7 @@ int parser_repl(FILE *in, FILE *out) {
     assertNotNull(out);
     while (1) {
         fprintf(out, "%s", PROMPT);
-        char *buffer = get_input(in, out);
+        char *buffer = get_input(NULL, in, out);
         assertNotNull(buffer);
         Lexer *l = new_lexer(buffer, MAX_BUFFER_SIZE);
         Parser *p = new_parser(l);
@@ -68,15 +493,15 @@ int lexer_repl(FILE *in, FILE *out) {
     assertNotNull(out);
     while (1) {
         fprintf(out, "%s", PROMPT);
-        char *buffer = get_input(in, out);
+        char *buffer = get_input(NULL, in, out);
         assertNotNull(buffer);
         Lexer *l = new_lexer(buffer, MAX_BUFFER_SIZE);
-        Token *tok;
-        for (tok = lexer_next_token(l); tok->type != TOKEN_EOF;
+        Token tok;
+        for (tok = lexer_next_token(l); tok.type != TOKEN_EOF;
              tok = lexer_next_token(l)) {
-            fprintf(out, "{ Type: %s, Literal: '%s' }\n",
-                    tokentype_names[tok->type], tok->literal);
-            free_token(&tok);
+            fprintf(out, "{ Type: %s, Literal: '%.*s' }\n",
+                    tokentype_names[tok.type], (int)tok.length,
+                    lexer_token_literal(l, tok));
         }
         safe_free((void **)&buffer);
         safe_free((void **)&l);
@@ -84,16 +509,21 @@ int lexer_repl(FILE *in, FILE *out) {
     return 0;
 }
 
-char *get_input(FILE *in, FILE *out) {
-    char *buffer = (char *)calloc(MAX_BUFFER_SIZE, sizeof(char));
+char *get_input(Arena *arena, FILE *in, FILE *out) {
+    char *buffer = (char *)arena_alloc(arena, MAX_BUFFER_SIZE * sizeof(char));
     assertNotNull(buffer);
+    memset(buffer, 0, MAX_BUFFER_SIZE * sizeof(char));
     char *result = fgets(buffer, MAX_BUFFER_SIZE, in);
     if (result == NULL) {
-        safe_free((void **)&buffer);
+        if (arena == NULL) {
+            safe_free((void **)&buffer);
+        }
         return NULL;
     }
     if (strncmp(result, "exit", 4) == 0) {
-        safe_free((void **)&buffer);
+        if (arena == NULL) {
+            safe_free((void **)&buffer);
+        }
         fprintf(out, "Exiting...\n");
         exit(0);
     }
@@ -1,16 +1,80 @@
 #ifndef REPL_H
 #define REPL_H
 
+#include "arena.h"
+#include "cache.h"
+#include "lexer.h"
+#include "parser.h"
+#include "variables.h"
+#include <stdint.h>
 #include <stdio.h>
 
 #define MAX_BUFFER_SIZE 100
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    int tree_walk;  // evaluate with the reference tree walker, not the VM
+    int optimize;   // fold constants and simplify before evaluating
+    int print_tree; // print the (optimized) expression before its value
+    int workers;    // batch mode pipeline workers, 0 to evaluate in order
+    int cache_size; // compiled programs kept per session, 0 disables
+} ReplOptions;
+
+typedef enum {
+    LINE_OK,
+    LINE_INVALID, // could not be parsed
+    LINE_FAILED,  // parsed, but an error was reported
+} LineStatus;
+
+// State carried from one input line to the next.
+typedef struct {
+    Arena *arena; // reset after every line
+    Lexer l;
+    Parser p;
+    ProgramCache *cache;      // NULL when disabled
+    VariableTable *variables; // NULL where lines run out of order
+    Expression *expr;         // line being evaluated, in tree_arena
+    Arena *tree_arena;        // arena, or definitions for a definition
+    Arena *definitions; // tree walker definitions, until a variable takes it
+    Program *prog;      // compiled line, NULL for the tree walker
+    int owns_prog;      // prog is not in the cache, free it after the run
+    int uses_ans;
+    char *name; // variable the line defines, in arena, or NULL
+    int *deps;  // variables the definition reads, in arena
+    int num_deps;
+    double *env_vars; // in arena
+    int env_size;
+    double ans;
+} Session;
 
 extern const char *PROMPT;
+extern ReplOptions repl_options;
 
 int start(FILE *in, FILE *out);
+int run_batch(FILE *in, FILE *out);
+int run_file(const char *path, FILE *out);
+int run_fd(int fd, size_t size, FILE *out);
+int run_buffer(char *input, size_t n, FILE *out);
+int run_stream(int fd, FILE *out, const char *prompt);
+int use_pipeline(void);
+int is_exit(const char *line, size_t len);
+int is_definition(const char *line, size_t len);
+int is_command(const char *line, size_t len, const char *command);
 int parser_repl(FILE *in, FILE *out);
 int lexer_repl(FILE *in, FILE *out);
 
-char *get_input(FILE *in, FILE *out);
+char *get_input(Arena *arena, FILE *in, FILE *out);
+Session *new_session(void);
+void free_session(Session **s);
+int session_eval(Session *s, char *line, size_t n, FILE *out);
+int session_eval_stream(Session *s, Lexer *stream, FILE *out);
+int session_finish(Session *s, LineStatus status, FILE *out);
+LineStatus session_prepare(Session *s, char *line, size_t n);
+LineStatus session_parse(Session *s, Parser *p);
+int session_check_definition(Session *s);
+void session_define(Session *s, double value);
+LineStatus session_compile(Session *s, char *key, size_t key_length,
+                           uint64_t hash);
+int session_run(Session *s, double ans, double *result);
 
 #endif
@@ -0,0 +1,120 @@
+#include "resolver.h"
+#include "ast.h"
+#include "keyword.h"
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+
+// Checks a parsed expression once before evaluation: every identifier must
+// be a constant or variable keyword or a named variable, which the parser
+// gave a slot, every call must name a builtin with the right number of
+// arguments, and sum() calls may nest MAX_SUM_NESTING deep. Keywords and
+// operators were already resolved by the parser, so evaluators can switch
+// on them directly. Nodes are checked in input order with an explicit
+// stack, so any depth resolves. Returns 1 on success; on failure prints an
+// error and sets errno.
+int resolve_expression(Expression *expr) {
+    assertNotNull(expr);
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    int sums = 0; // open sum() frames
+    int ok = 1;
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        Expression *node = f->expr;
+        int is_sum = node->type == CALL_EXPRESSION &&
+                     node->expression.call_expression->keyword == KW_SUM;
+        if (f->step == 0) {
+            if (!resolve_node(node)) {
+                ok = 0;
+                break;
+            }
+            if (is_sum && ++sums > MAX_SUM_NESTING) {
+                report_error("Error: sum() nested deeper than %d levels.\n",
+                             MAX_SUM_NESTING);
+                errno = EINVAL;
+                ok = 0;
+                break;
+            }
+        }
+        if (f->step < expression_num_children(node)) {
+            expression_stack_push(&s, expression_child(node, f->step++));
+            continue;
+        }
+        sums -= is_sum;
+        s.num_frames--;
+    }
+    free_expression_stack(&s);
+    return ok;
+}
+
+// Checks expr itself, not its operands.
+int resolve_node(Expression *expr) {
+    assertNotNull(expr);
+    switch (expr->type) {
+    case NUMBER_LITERAL:
+        return 1;
+    case IDENTIFIER:
+        if (expr->slot >= 0) {
+            return 1; // named variable
+        }
+        return resolve_identifier(expr->expression.identifier);
+    case PREFIX_EXPRESSION:
+        return 1;
+    case INFIX_EXPRESSION:
+        if ((int)expr->expression.infix_expression->operation == -1) {
+            report_error("Error: Invalid infix expression.\n");
+            errno = EINVAL;
+            return 0;
+        }
+        return 1;
+    case CALL_EXPRESSION:
+        return resolve_call_expression(expr->expression.call_expression);
+    default:
+        report_error("Error: Invalid Expression node.\n");
+        errno = EINVAL;
+        return 0;
+    }
+}
+
+int resolve_identifier(Identifier *expr) {
+    assertNotNull(expr);
+    switch (expr->keyword) {
+    case PI:
+    case E:
+    case ANS:
+    case I:
+        return 1;
+    default:
+        report_error("Error: Invalid identifier '%.*s'.\n", (int)expr->length,
+                     expr->value);
+        errno = EINVAL;
+        return 0;
+    }
+}
+
+int resolve_call_expression(CallExpression *expr) {
+    assertNotNull(expr);
+    if (expr->function->type != IDENTIFIER) {
+        report_error("Error: Invalid call expression.\n");
+        errno = EINVAL;
+        return 0;
+    }
+    Identifier *function = expr->function->expression.identifier;
+    KeywordType kw = expr->keyword;
+    if ((int)kw == -1 || keyword_num_args[kw] == 0) {
+        report_error("Error: Invalid call expression '%.*s'.\n",
+                     (int)function->length, function->value);
+        errno = EINVAL;
+        return 0;
+    }
+    if (expr->num_arguments != keyword_num_args[kw]) {
+        report_error(
+            "Error: Invalid number of arguments in %s call expression.\n",
+            keywords[kw]);
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
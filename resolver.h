@@ -0,0 +1,14 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "ast.h"
+
+// Every nested sum() costs its evaluators a level of C stack.
+#define MAX_SUM_NESTING 1000
+
+int resolve_expression(Expression *expr);
+int resolve_node(Expression *expr);
+int resolve_identifier(Identifier *expr);
+int resolve_call_expression(CallExpression *expr);
+
+#endif
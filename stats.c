@@ -0,0 +1,138 @@
+#include "stats.h"
+#include <stdio.h>
+#include <time.h>
+
+Stats stats;
+_Thread_local LineStats *stats_line = NULL;
+
+const char *phase_names[NUM_PHASES + 1] = {
+    "input", "lex", "parse", "compile", "eval", "output", "line"};
+const char *counter_names[NUM_COUNTERS] = {"tokens", "nodes", "iterations"};
+
+long long stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void stats_add(atomic_ullong *sum, unsigned long long n) {
+    atomic_fetch_add_explicit(sum, n, memory_order_relaxed);
+}
+
+// Moves a line's times and counts into the histograms.
+void stats_end_line(LineStats *line) {
+    uint64_t total = 0;
+    for (int i = 0; i < NUM_PHASES; i++) {
+        uint64_t ns =
+            atomic_exchange_explicit(&line->ns[i], 0, memory_order_relaxed);
+        histogram_record(&stats.phases[i], ns);
+        total += ns;
+    }
+    histogram_record(&stats.phases[NUM_PHASES], total);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        histogram_record(&stats.counters[i],
+                         atomic_exchange_explicit(&line->counts[i], 0,
+                                                  memory_order_relaxed));
+    }
+}
+
+// Drops a line that is not recorded, such as :stats itself.
+void stats_clear_line(LineStats *line) {
+    for (int i = 0; i < NUM_PHASES; i++) {
+        atomic_store_explicit(&line->ns[i], 0, memory_order_relaxed);
+    }
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        atomic_store_explicit(&line->counts[i], 0, memory_order_relaxed);
+    }
+}
+
+void print_stats(FILE *out) {
+    if (!STATS_ENABLED) {
+        fprintf(out, "Statistics are disabled, rebuild with make STATS=1.\n");
+        return;
+    }
+    fprintf(out, "%-10s %10s %10s %10s %10s\n", "per line", "lines", "p50",
+            "p99", "max");
+    for (int i = 0; i <= NUM_PHASES; i++) {
+        print_histogram_row(out, phase_names[i], &stats.phases[i], 1);
+    }
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        print_histogram_row(out, counter_names[i], &stats.counters[i], 0);
+    }
+}
+
+// For atexit, so the REPL's exit() on "exit" prints them too.
+void print_stats_at_exit(void) {
+    print_stats(stderr);
+}
+
+void print_histogram_row(FILE *out, const char *name, Histogram *h,
+                         int is_time) {
+    fprintf(out, "%-10s %10llu", name, (unsigned long long)h->count);
+    print_stat_value(out, histogram_percentile(h, 0.50), is_time);
+    print_stat_value(out, histogram_percentile(h, 0.99), is_time);
+    print_stat_value(out, h->max, is_time);
+    fprintf(out, "\n");
+}
+
+void print_stat_value(FILE *out, uint64_t value, int is_time) {
+    if (!is_time || value < 1000) {
+        fprintf(out, " %8llu%s", (unsigned long long)value,
+                is_time ? "ns" : "  ");
+    } else if (value < 1000000) {
+        fprintf(out, " %8.1fus", value / 1e3);
+    } else if (value < 1000000000) {
+        fprintf(out, " %8.1fms", value / 1e6);
+    } else {
+        fprintf(out, " %8.2fs ", value / 1e9);
+    }
+}
+
+void histogram_record(Histogram *h, uint64_t value) {
+    h->counts[histogram_bucket(value)]++;
+    h->count++;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+// Smallest bucket bound with at least p of the values at or below it,
+// capped by the largest value seen.
+uint64_t histogram_percentile(Histogram *h, double p) {
+    if (h->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * h->count);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t bound = histogram_bucket_max(i);
+            return bound < h->max ? bound : h->max;
+        }
+    }
+    return h->max;
+}
+
+int histogram_bucket(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return (int)value;
+    }
+    int e = 63 - __builtin_clzll(value); // HISTOGRAM_SUB_BITS or more
+    int sub = (int)(value >> (e - HISTOGRAM_SUB_BITS)) &
+              (HISTOGRAM_SUB_BUCKETS - 1);
+    return (e - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+uint64_t histogram_bucket_max(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int e = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (e - HISTOGRAM_SUB_BITS)) -
+           1;
+}
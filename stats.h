@@ -0,0 +1,99 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Per-line latency and size statistics. They are only collected in builds
+// made with STATS=1 (-DINTERP_STATS); otherwise the STATS_ macros expand to
+// nothing, their arguments are not evaluated and no clock is read.
+#ifdef INTERP_STATS
+#define STATS_ENABLED 1
+#define STATS_BEGIN(t) long long t = stats_now_ns()
+#define STATS_END(phase, t)                                                    \
+    stats_add(&stats_current()->ns[phase], stats_now_ns() - (t))
+#define STATS_COUNT(counter, n) stats_add(&stats_current()->counts[counter], n)
+#define STATS_END_LINE() stats_end_line(stats_current())
+#define STATS_CLEAR_LINE() stats_clear_line(stats_current())
+#define STATS_SET_LINE(line) (stats_line = (line))
+#else
+#define STATS_ENABLED 0
+#define STATS_BEGIN(t)
+#define STATS_END(phase, t)
+#define STATS_COUNT(counter, n)
+#define STATS_END_LINE()
+#define STATS_CLEAR_LINE()
+#define STATS_SET_LINE(line)
+#endif
+
+#define HISTOGRAM_SUB_BITS 3 // 8 buckets per power of two, within 12.5%
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+typedef enum {
+    PHASE_INPUT,
+    PHASE_LEX,
+    PHASE_PARSE,
+    PHASE_COMPILE, // cache lookup, resolve, optimize and compile
+    PHASE_EVAL,
+    PHASE_OUTPUT,
+    NUM_PHASES,
+} Phase;
+
+typedef enum {
+    COUNTER_TOKENS,
+    COUNTER_NODES,
+    COUNTER_ITERATIONS, // of every sum(), nested ones included
+    NUM_COUNTERS,
+} Counter;
+
+// Log-linear histogram: exact below HISTOGRAM_SUB_BUCKETS, then
+// HISTOGRAM_SUB_BUCKETS buckets per power of two.
+typedef struct {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+} Histogram;
+
+// Times and counts of the line being evaluated. They are atomic because
+// sum() chunks run on the thread pool.
+typedef struct {
+    atomic_ullong ns[NUM_PHASES];
+    atomic_ullong counts[NUM_COUNTERS];
+} LineStats;
+
+// Lines are recorded into the histograms by one thread at a time: the one
+// running the session, or the pipeline writer.
+typedef struct {
+    Histogram phases[NUM_PHASES + 1]; // the last one is the whole line
+    Histogram counters[NUM_COUNTERS];
+    LineStats line; // the current line, unless stats_line says otherwise
+} Stats;
+
+extern Stats stats;
+// Where this thread adds the current line's times, NULL for stats.line.
+// Pipeline stages point it at their slot, pool threads at the submitter's.
+extern _Thread_local LineStats *stats_line;
+extern const char *phase_names[NUM_PHASES + 1];
+extern const char *counter_names[NUM_COUNTERS];
+
+long long stats_now_ns(void);
+void stats_add(atomic_ullong *sum, unsigned long long n);
+void stats_end_line(LineStats *line);
+void stats_clear_line(LineStats *line);
+void print_stats(FILE *out);
+void print_stats_at_exit(void);
+void print_histogram_row(FILE *out, const char *name, Histogram *h,
+                         int is_time);
+void print_stat_value(FILE *out, uint64_t value, int is_time);
+void histogram_record(Histogram *h, uint64_t value);
+uint64_t histogram_percentile(Histogram *h, double p);
+int histogram_bucket(uint64_t value);
+uint64_t histogram_bucket_max(int bucket);
+
+static inline LineStats *stats_current(void) {
+    return stats_line != NULL ? stats_line : &stats.line;
+}
+
+#endif
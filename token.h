@@ -4,12 +4,13 @@
 #include <stddef.h>
 
 #define MAX_TOKEN_TYPE_LEN 9
-#define NUM_TOKEN_TYPES 14
+#define NUM_TOKEN_TYPES 15
 
 typedef enum {
     ILLEGAL,
     TOKEN_EOF,
     COMMA,
+    ASSIGN, // '=' of a definition
 
     // Operands
     IDENT,
@@ -38,16 +39,18 @@ typedef enum {
     CALL,
 } Precedence;
 
+// Tokens are small values: the literal is the slice
+// input[offset, offset + length) of the lexer's input buffer.
 typedef struct {
     TokenType type;
-    char *literal;
+    size_t offset;
     size_t length;
+    double value; // NUMBER: the literal's value, scanned by the lexer
 } Token;
 
 extern char tokentype_names[NUM_TOKEN_TYPES][MAX_TOKEN_TYPE_LEN];
 extern Precedence precedences[NUM_TOKEN_TYPES];
 
-Token *new_token(TokenType type, char literal);
-void free_token(Token **tok);
+Token new_token(TokenType type, size_t offset, size_t length);
 
 #endif
@@ -1,7 +1,11 @@
 #include "util.h"
 #include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+_Thread_local ErrorBuffer *error_buffer = NULL;
+
 void safe_free(void **ptr) {
     if (ptr == NULL || *ptr == NULL) {
         return;
@@ -11,3 +15,24 @@ void safe_free(void **ptr) {
 }
 
 void assertNotNull(void *val) { assert(val != NULL); }
+
+// Prints to stdout, or appends to error_buffer when one is installed so
+// worker threads can hand their messages to whoever prints in order.
+void report_error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (error_buffer == NULL) {
+        vprintf(format, args);
+    } else if (error_buffer->length < ERROR_BUFFER_SIZE - 1) {
+        int n = vsnprintf(error_buffer->text + error_buffer->length,
+                          ERROR_BUFFER_SIZE - error_buffer->length, format,
+                          args);
+        if (n > 0) {
+            error_buffer->length += n;
+            if (error_buffer->length > ERROR_BUFFER_SIZE - 1) {
+                error_buffer->length = ERROR_BUFFER_SIZE - 1;
+            }
+        }
+    }
+    va_end(args);
+}
@@ -1,7 +1,21 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
+
+#define ERROR_BUFFER_SIZE 512
+
+// Collects the error messages of one evaluation when installed as the
+// calling thread's error_buffer; messages past the end are truncated.
+typedef struct {
+    char text[ERROR_BUFFER_SIZE];
+    size_t length;
+} ErrorBuffer;
+
+extern _Thread_local ErrorBuffer *error_buffer;
+
 void safe_free(void **ptr);
 void assertNotNull(void *val);
+void report_error(const char *format, ...);
 
 #endif
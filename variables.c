@@ -0,0 +1,326 @@
+#include "variables.h"
+#include "ast.h"
+#include "cache.h"
+#include "evaluator.h"
+#include "util.h"
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+VariableTable *new_variable_table(void) {
+    VariableTable *t = (VariableTable *)calloc(1, sizeof(VariableTable));
+    assertNotNull(t);
+    t->buckets = (int *)calloc(VARIABLE_BUCKETS, sizeof(int));
+    assertNotNull(t->buckets);
+    t->num_buckets = VARIABLE_BUCKETS;
+    return t;
+}
+
+void free_variable_table(VariableTable **t) {
+    if (t == NULL || *t == NULL) {
+        return;
+    }
+    for (int k = 0; k < (*t)->num_vars; k++) {
+        Variable *v = &(*t)->vars[k];
+        safe_free((void **)&v->name);
+        free_arena(&v->arena);
+        free_program(&v->prog);
+        safe_free((void **)&v->deps);
+        safe_free((void **)&v->dependents);
+    }
+    safe_free((void **)&(*t)->vars);
+    safe_free((void **)&(*t)->values);
+    safe_free((void **)&(*t)->buckets);
+    safe_free((void **)&(*t)->work);
+    safe_free((void **)&(*t)->env_vars);
+    safe_free((void **)t);
+}
+
+// Index of the variable called name, or -1.
+int lookup_variable(VariableTable *t, const char *name, size_t length) {
+    assertNotNull(t);
+    size_t mask = t->num_buckets - 1;
+    for (size_t h = fnv1a_hash(name, length) & mask; t->buckets[h] != 0;
+         h = (h + 1) & mask) {
+        Variable *v = &t->vars[t->buckets[h] - 1];
+        if (v->length == length && memcmp(v->name, name, length) == 0) {
+            return t->buckets[h] - 1;
+        }
+    }
+    return -1;
+}
+
+// Adds a variable that is not defined yet, with the value 0. Returns its
+// index.
+int add_variable(VariableTable *t, const char *name, size_t length) {
+    assertNotNull(t);
+    if (t->num_vars == t->capacity) {
+        t->capacity = t->capacity > 0 ? 2 * t->capacity : VARIABLE_BUCKETS;
+        t->vars = (Variable *)realloc(t->vars, t->capacity * sizeof(Variable));
+        t->values =
+            (double *)realloc(t->values, t->capacity * sizeof(double));
+        assertNotNull(t->vars);
+        assertNotNull(t->values);
+    }
+    int k = t->num_vars++;
+    Variable *v = &t->vars[k];
+    memset(v, 0, sizeof(Variable));
+    v->name = (char *)malloc(length + 1);
+    assertNotNull(v->name);
+    memcpy(v->name, name, length);
+    v->name[length] = '\0';
+    v->length = length;
+    t->values[k] = 0.0;
+    if (2 * (size_t)t->num_vars > t->num_buckets) {
+        variable_table_rehash(t); // keeps the table at most half full
+        return k;
+    }
+    size_t mask = t->num_buckets - 1;
+    size_t h = fnv1a_hash(name, length) & mask;
+    while (t->buckets[h] != 0) {
+        h = (h + 1) & mask;
+    }
+    t->buckets[h] = k + 1;
+    return k;
+}
+
+// Doubles the name table and inserts every variable again.
+void variable_table_rehash(VariableTable *t) {
+    assertNotNull(t);
+    safe_free((void **)&t->buckets);
+    t->num_buckets *= 2;
+    t->buckets = (int *)calloc(t->num_buckets, sizeof(int));
+    assertNotNull(t->buckets);
+    size_t mask = t->num_buckets - 1;
+    for (int k = 0; k < t->num_vars; k++) {
+        Variable *v = &t->vars[k];
+        size_t h = fnv1a_hash(v->name, v->length) & mask;
+        while (t->buckets[h] != 0) {
+            h = (h + 1) & mask;
+        }
+        t->buckets[h] = k + 1;
+    }
+}
+
+// The variables a resolved tree reads, each once, into a new array at
+// *deps, from arena or the heap without one. Returns how many there are.
+int variable_dependencies(VariableTable *t, Expression *expr, Arena *arena,
+                          int **deps) {
+    assertNotNull(t);
+    assertNotNull(expr);
+    t->epoch++;
+    *deps = NULL;
+    int num_deps = 0;
+    int capacity = 0;
+    ExpressionStack s;
+    init_expression_stack(&s);
+    expression_stack_push(&s, expr);
+    while (s.num_frames > 0) {
+        ExpressionFrame *f = &s.frames[s.num_frames - 1];
+        if (f->step < expression_num_children(f->expr)) {
+            expression_stack_push(&s, expression_child(f->expr, f->step++));
+            continue;
+        }
+        Expression *node = f->expr;
+        s.num_frames--;
+        if (node->type != IDENTIFIER || node->slot < 0) {
+            continue;
+        }
+        Variable *v = &t->vars[node->slot - NUM_ENV_VARS];
+        if (v->mark == t->epoch) {
+            continue;
+        }
+        v->mark = t->epoch;
+        if (num_deps == capacity) {
+            int old = capacity;
+            capacity = capacity > 0 ? 2 * capacity : 4;
+            *deps = (int *)arena_realloc(arena, *deps, old * sizeof(int),
+                                         capacity * sizeof(int));
+            assertNotNull(*deps);
+        }
+        (*deps)[num_deps++] = node->slot - NUM_ENV_VARS;
+    }
+    free_expression_stack(&s);
+    return num_deps;
+}
+
+// Whether any of deps is target or reads it through other definitions,
+// which would make defining target with them circular.
+int depends_on_variable(VariableTable *t, const int *deps, int num_deps,
+                        int target) {
+    assertNotNull(t);
+    variable_work_reserve(t, t->num_vars);
+    t->epoch++;
+    int n = 0;
+    for (int i = 0; i < num_deps; i++) {
+        t->vars[deps[i]].mark = t->epoch;
+        t->work[n++] = deps[i];
+    }
+    while (n > 0) {
+        int k = t->work[--n];
+        if (k == target) {
+            return 1;
+        }
+        Variable *v = &t->vars[k];
+        for (int i = 0; i < v->num_deps; i++) {
+            if (t->vars[v->deps[i]].mark != t->epoch) {
+                t->vars[v->deps[i]].mark = t->epoch;
+                t->work[n++] = v->deps[i];
+            }
+        }
+    }
+    return 0;
+}
+
+// Gives variable k a new definition and its value, replacing its edges in
+// the dependency graph. Takes ownership of prog; the definition's arena is
+// swapped with the one the old definition used.
+void define_variable(VariableTable *t, int k, Expression *expr,
+                     Arena **arena, Program *prog, const int *deps,
+                     int num_deps, int env_size, double value) {
+    assertNotNull(t);
+    Variable *v = &t->vars[k];
+    for (int i = 0; i < v->num_deps; i++) {
+        remove_dependent(&t->vars[v->deps[i]], k);
+    }
+    v->deps = (int *)realloc(v->deps, (num_deps > 0 ? num_deps : 1) *
+                                          sizeof(int));
+    assertNotNull(v->deps);
+    if (num_deps > 0) {
+        memcpy(v->deps, deps, num_deps * sizeof(int));
+    }
+    v->num_deps = num_deps;
+    for (int i = 0; i < num_deps; i++) {
+        add_dependent(&t->vars[deps[i]], k);
+    }
+    free_program(&v->prog);
+    v->prog = prog;
+    Arena *old = v->arena;
+    v->arena = *arena;
+    *arena = old;
+    v->expr = expr;
+    v->env_size = env_size;
+    t->values[k] = value;
+}
+
+void add_dependent(Variable *v, int k) {
+    assertNotNull(v);
+    if (v->num_dependents == v->dependents_capacity) {
+        v->dependents_capacity =
+            v->dependents_capacity > 0 ? 2 * v->dependents_capacity : 4;
+        v->dependents = (int *)realloc(
+            v->dependents, v->dependents_capacity * sizeof(int));
+        assertNotNull(v->dependents);
+    }
+    v->dependents[v->num_dependents++] = k;
+}
+
+void remove_dependent(Variable *v, int k) {
+    assertNotNull(v);
+    for (int i = 0; i < v->num_dependents; i++) {
+        if (v->dependents[i] == k) {
+            v->dependents[i] = v->dependents[--v->num_dependents];
+            return;
+        }
+    }
+}
+
+// Brings every definition that reads variable k, directly or not, up to
+// date with its new value. Only those are evaluated, each once and after
+// all of its own inputs (Kahn's algorithm over the affected variables).
+// Returns how many were evaluated.
+int recompute_dependents(VariableTable *t, int k) {
+    assertNotNull(t);
+    variable_work_reserve(t, t->num_vars);
+    t->epoch++;
+    // breadth-first over the dependents edges collects the affected set
+    int n = 0;
+    t->work[n++] = k;
+    t->vars[k].mark = t->epoch;
+    for (int head = 0; head < n; head++) {
+        Variable *v = &t->vars[t->work[head]];
+        for (int i = 0; i < v->num_dependents; i++) {
+            Variable *w = &t->vars[v->dependents[i]];
+            if (w->mark != t->epoch) {
+                w->mark = t->epoch;
+                t->work[n++] = v->dependents[i];
+            }
+        }
+    }
+    for (int i = 1; i < n; i++) {
+        Variable *w = &t->vars[t->work[i]];
+        w->pending = 0;
+        for (int j = 0; j < w->num_deps; j++) {
+            w->pending += t->vars[w->deps[j]].mark == t->epoch;
+        }
+    }
+    // the affected list is no longer needed, the queue reuses it
+    int tail = 1;
+    for (int head = 0; head < tail; head++) {
+        int j = t->work[head];
+        if (j != k) {
+            t->values[j] = run_definition(t, j);
+        }
+        Variable *v = &t->vars[j];
+        for (int i = 0; i < v->num_dependents; i++) {
+            Variable *w = &t->vars[v->dependents[i]];
+            if (w->mark == t->epoch && --w->pending == 0) {
+                t->work[tail++] = v->dependents[i];
+            }
+        }
+    }
+    t->recomputed += n - 1;
+    return n - 1;
+}
+
+// Evaluates the definition of variable k with the current values.
+double run_definition(VariableTable *t, int k) {
+    assertNotNull(t);
+    Variable *v = &t->vars[k];
+    if (v->env_size > t->env_size) {
+        t->env_vars =
+            (double *)realloc(t->env_vars, v->env_size * sizeof(double));
+        assertNotNull(t->env_vars);
+        t->env_size = v->env_size;
+    }
+    t->env_vars[ENV_ANS] = 0.0; // definitions do not read ans
+    t->env_vars[ENV_I] = 0.0;
+    load_variables(t, t->env_vars, v->env_size);
+    if (v->prog != NULL) {
+        return vm_run(v->prog, t->env_vars);
+    }
+    eval_epoch++; // memoized values are from the last evaluation
+    return eval(v->expr, t->env_vars);
+}
+
+// Copies the values into the variable slots of env_vars, as far as its
+// env_size entries go. The slots past the variables a program reads are
+// hoisted invariants, which the program stores before reading.
+void load_variables(VariableTable *t, double *env_vars, int env_size) {
+    assertNotNull(t);
+    int n = env_size - NUM_ENV_VARS;
+    if (n > t->num_vars) {
+        n = t->num_vars;
+    }
+    if (n > 0) {
+        memcpy(env_vars + NUM_ENV_VARS, t->values, n * sizeof(double));
+    }
+}
+
+void print_variable_stats(FILE *out, VariableTable *t) {
+    assertNotNull(out);
+    if (t == NULL) {
+        return;
+    }
+    fprintf(out, "variables  %d defined, %lu recomputed after edits\n",
+            t->num_vars, t->recomputed);
+}
+
+void variable_work_reserve(VariableTable *t, int n) {
+    assertNotNull(t);
+    if (n > t->work_capacity) {
+        t->work_capacity = n;
+        t->work = (int *)realloc(t->work, n * sizeof(int));
+        assertNotNull(t->work);
+    }
+}
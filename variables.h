@@ -0,0 +1,72 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include "arena.h"
+#include "ast.h"
+#include "compiler.h"
+#include "evaluator.h"
+#include <stddef.h>
+#include <stdio.h>
+
+#define VARIABLE_BUCKETS 16 // initial size of the name table, a power of two
+
+// env_vars slot of variable k: right after the keyword variables, and
+// before the slots hoist_invariants assigns.
+#define VARIABLE_SLOT(k) (NUM_ENV_VARS + (k))
+
+// A named definition such as "rate = 0.05". Names are never removed, so a
+// variable keeps its index, and its slot, for the whole session.
+typedef struct {
+    char *name; // NUL-terminated copy
+    size_t length;
+    Arena *arena;     // definition tree for the tree walker, else NULL
+    Expression *expr; // definition, in arena
+    Program *prog;    // compiled definition, NULL for the tree walker
+    int env_size;     // env_vars entries the definition uses
+    int *deps;        // variables the definition reads, each once
+    int num_deps;
+    int *dependents; // variables whose definitions read this one
+    int num_dependents;
+    int dependents_capacity;
+    int pending;        // recompute_dependents: deps not recomputed yet
+    unsigned long mark; // epoch of the last walk that reached it
+} Variable;
+
+// Variables of a session and the dependency graph between them. Values
+// are kept apart from the definitions so they copy straight into env_vars.
+typedef struct {
+    Variable *vars;
+    double *values; // values[k] is variable k
+    int num_vars;
+    int capacity;
+    int *buckets; // name hash -> index + 1, 0 when empty
+    size_t num_buckets;
+    unsigned long epoch;
+    int *work; // stack and queue of the graph walks
+    int work_capacity;
+    double *env_vars; // recompute_dependents' environment
+    int env_size;
+    unsigned long recomputed; // definitions evaluated again after an edit
+} VariableTable;
+
+VariableTable *new_variable_table(void);
+void free_variable_table(VariableTable **t);
+int lookup_variable(VariableTable *t, const char *name, size_t length);
+int add_variable(VariableTable *t, const char *name, size_t length);
+void variable_table_rehash(VariableTable *t);
+int variable_dependencies(VariableTable *t, Expression *expr, Arena *arena,
+                          int **deps);
+int depends_on_variable(VariableTable *t, const int *deps, int num_deps,
+                        int target);
+void define_variable(VariableTable *t, int k, Expression *expr,
+                     Arena **arena, Program *prog, const int *deps,
+                     int num_deps, int env_size, double value);
+void add_dependent(Variable *v, int k);
+void remove_dependent(Variable *v, int k);
+int recompute_dependents(VariableTable *t, int k);
+double run_definition(VariableTable *t, int k);
+void load_variables(VariableTable *t, double *env_vars, int env_size);
+void print_variable_stats(FILE *out, VariableTable *t);
+void variable_work_reserve(VariableTable *t, int n);
+
+#endif
@@ -0,0 +1,233 @@
+#include "vecmath.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__) && defined(__GNUC__)
+#define VECMATH_X86 1
+#include <immintrin.h>
+#else
+#define VECMATH_X86 0
+#endif
+
+// Bits and constants, most of them from fdlibm
+#define VECMATH_SIGN 0x8000000000000000UL
+#define VECMATH_HIGH_WORD 0xffffffff00000000UL
+#define VECMATH_EXPONENT_MASK 0xfff0000000000000UL
+#define VECMATH_EXPONENT_BIAS 0x3ff0000000000000UL
+#define VECMATH_LN_OFFSET 0x3fe6a09e00000000UL // sqrt(2)/2
+#define VECMATH_SHIFT52_BITS 0x4330000000000000UL
+#define VECMATH_SHIFT52 0x1p52
+#define VECMATH_SHIFT 0x1.8p52 // x + SHIFT - SHIFT rounds x to an integer
+#define VECMATH_SPLITTER 134217729.0 // 2^27 + 1
+#define VECMATH_SPLIT_MAX 0x1p995
+
+#define VECMATH_TWO_OVER_PI 0x1.45f306dc9c883p-1
+#define VECMATH_PIO2_1 0x1.921fb5p0 // pi/2 in 25-bit parts and the rest
+#define VECMATH_PIO2_2 0x1.110b46p-26
+#define VECMATH_PIO2_3 0x1.1a6263p-54
+#define VECMATH_PIO2_4 0x1.8a2e03707344ap-81
+#define VECMATH_TRIG_TINY 0x1p-44 // smallest remainder trig_reduce keeps
+#define VECMATH_PI 3.14159265358979311600e+00
+#define VECMATH_PIO2_HI 1.57079632679489655800e+00
+#define VECMATH_PIO2_LO 6.12323399573676603587e-17
+#define VECMATH_PIO4_HI 7.85398163397448278999e-01
+
+#define VECMATH_S1 -1.66666666666666324348e-01
+#define VECMATH_S2 8.33333333332248946124e-03
+#define VECMATH_S3 -1.98412698298579493134e-04
+#define VECMATH_S4 2.75573137070700676789e-06
+#define VECMATH_S5 -2.50507602534068634195e-08
+#define VECMATH_S6 1.58969099521155010221e-10
+#define VECMATH_C1 4.16666666666666019037e-02
+#define VECMATH_C2 -1.38888888888741095749e-03
+#define VECMATH_C3 2.48015872894767294178e-05
+#define VECMATH_C4 -2.75573143513906633035e-07
+#define VECMATH_C5 2.08757232129817482790e-09
+#define VECMATH_C6 -1.13596475577881948265e-11
+
+#define VECMATH_ASIN_NEAR_ONE 0x1.f3333p-1 // 0.975
+#define VECMATH_PS0 1.66666666666666657415e-01
+#define VECMATH_PS1 -3.25565818622400915405e-01
+#define VECMATH_PS2 2.01212532134862925881e-01
+#define VECMATH_PS3 -4.00555345006794114027e-02
+#define VECMATH_PS4 7.91534994289814532176e-04
+#define VECMATH_PS5 3.47933107596021167570e-05
+#define VECMATH_QS1 -2.40339491173441421878e+00
+#define VECMATH_QS2 2.02094576023350569471e+00
+#define VECMATH_QS3 -6.88283971605453293030e-01
+#define VECMATH_QS4 7.70381505559019352791e-02
+
+#define VECMATH_ATAN_HI0 4.63647609000806093515e-01 // atan(1/2)
+#define VECMATH_ATAN_HI1 7.85398163397448278999e-01 // atan(1)
+#define VECMATH_ATAN_HI2 9.82793723247329054082e-01 // atan(3/2)
+#define VECMATH_ATAN_HI3 1.57079632679489655800e+00 // atan(inf)
+#define VECMATH_ATAN_LO0 2.26987774529616870924e-17
+#define VECMATH_ATAN_LO1 3.06161699786838301793e-17
+#define VECMATH_ATAN_LO2 1.39033110312309984516e-17
+#define VECMATH_ATAN_LO3 6.12323399573676603587e-17
+#define VECMATH_AT0 3.33333333333329318027e-01
+#define VECMATH_AT1 -1.99999999998764832476e-01
+#define VECMATH_AT2 1.42857142725034663711e-01
+#define VECMATH_AT3 -1.11111104054623557880e-01
+#define VECMATH_AT4 9.09088713343650656196e-02
+#define VECMATH_AT5 -7.69187620504482999495e-02
+#define VECMATH_AT6 6.66107313738753120669e-02
+#define VECMATH_AT7 -5.83357013379057348645e-02
+#define VECMATH_AT8 4.97687799461593236017e-02
+#define VECMATH_AT9 -3.65315727442169155270e-02
+#define VECMATH_AT10 1.62858201153657823623e-02
+
+#define VECMATH_LN2_HI 6.93147180369123816490e-01 // 32 bits, k ln2_hi is exact
+#define VECMATH_LN2_LO 1.90821492927058770002e-10
+#define VECMATH_INV_LN2 1.44269504088896338700e+00
+#define VECMATH_LN10 2.30258509299404568402e+00
+#define VECMATH_LN_E_LO -0x1.ea8556644e4cdp-55 // ln(M_E) - 1
+#define VECMATH_TWO_THIRDS_HI 0x1.5555555555555p-1
+#define VECMATH_TWO_THIRDS_LO 0x1.5555555555555p-55
+#define VECMATH_LG1 6.666666666666735130e-01
+#define VECMATH_LG2 3.999999999940941908e-01
+#define VECMATH_LG3 2.857142874366239149e-01
+#define VECMATH_LG4 2.222219843214978396e-01
+#define VECMATH_LG5 1.818357216161805012e-01
+#define VECMATH_LG6 1.531383769920937332e-01
+#define VECMATH_LG7 1.479819860511658591e-01
+#define VECMATH_P1 1.66666666666666019037e-01
+#define VECMATH_P2 -2.77777777770155933842e-03
+#define VECMATH_P3 6.61375632143793436117e-05
+#define VECMATH_P4 -1.65339022054652515390e-06
+#define VECMATH_P5 4.13813679705723846039e-08
+
+double vecmath_ref_log(double x) { return log(x) / log(10); }
+double vecmath_ref_exp(double x) { return pow(M_E, x); }
+double vecmath_ref_rootn(double x, double n) { return pow(x, 1 / n); }
+
+uint64_t vecmath_bits(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+double vecmath_double(uint64_t u) {
+    double x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+// One lane at a time, in plain C
+#define VEC_WIDTH 1
+#define VEC_NAME(name) scalar_##name
+#define VEC_TARGET
+#define VD double
+#define VI long
+#define VU unsigned long
+#define VEC_BITS(x) vecmath_bits(x)
+#define VEC_DOUBLE(u) vecmath_double(u)
+#define VEC_SELECT(m, a, b) ((m) ? (a) : (b))
+#define VEC_SPLAT(x) (x)
+#define VEC_SQRT(x) sqrt(x)
+#define VEC_LOAD(p) (*(p))
+#define VEC_STORE(p, x) (*(p) = (x))
+#define VEC_TAIL(name, a, n)
+#define VEC_TAIL2(name, a, b, n)
+#include "vecmath_lanes.h"
+#undef VEC_WIDTH
+#undef VEC_NAME
+#undef VEC_TARGET
+#undef VD
+#undef VI
+#undef VU
+#undef VEC_BITS
+#undef VEC_DOUBLE
+#undef VEC_SELECT
+#undef VEC_SPLAT
+#undef VEC_SQRT
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_TAIL
+#undef VEC_TAIL2
+
+VecMathKernels vecmath_kernels = {
+    "scalar",    scalar_sin, scalar_cos, scalar_tan, scalar_asin,
+    scalar_acos, scalar_atan, scalar_ln, scalar_log, scalar_exp,
+    scalar_rootn};
+
+#if VECMATH_X86
+typedef double v2d __attribute__((vector_size(16)));
+typedef long v2i __attribute__((vector_size(16)));
+typedef unsigned long v2u __attribute__((vector_size(16)));
+typedef double v4d __attribute__((vector_size(32)));
+typedef long v4i __attribute__((vector_size(32)));
+typedef unsigned long v4u __attribute__((vector_size(32)));
+
+// GCC vector extensions, which also take a scalar for either operand
+#define VEC_BITS(x) ((VU)(x))
+#define VEC_DOUBLE(u) ((VD)(u))
+#define VEC_SELECT(m, a, b) ((VD)(((VI)(a) & (m)) | ((VI)(b) & ~(m))))
+#define VEC_SPLAT(x) ((VD){0} + (x))
+#define VEC_WIDTH 2
+#define VEC_NAME(name) sse2_##name
+#define VEC_TARGET
+#define VD v2d
+#define VI v2i
+#define VU v2u
+#define VEC_SQRT(x) ((v2d)_mm_sqrt_pd((__m128d)(x)))
+#define VEC_LOAD(p) ((v2d)_mm_loadu_pd(p))
+#define VEC_STORE(p, x) _mm_storeu_pd(p, (__m128d)(x))
+#define VEC_TAIL(name, a, n) scalar_##name(a, n)
+#define VEC_TAIL2(name, a, b, n) scalar_##name(a, b, n)
+#include "vecmath_lanes.h"
+#undef VEC_WIDTH
+#undef VEC_NAME
+#undef VEC_TARGET
+#undef VD
+#undef VI
+#undef VU
+#undef VEC_SQRT
+#undef VEC_LOAD
+#undef VEC_STORE
+#undef VEC_TAIL
+#undef VEC_TAIL2
+
+#define VEC_WIDTH 4
+#define VEC_NAME(name) avx2_##name
+#define VEC_TARGET __attribute__((target("avx2")))
+#define VD v4d
+#define VI v4i
+#define VU v4u
+#define VEC_SQRT(x) ((v4d)_mm256_sqrt_pd((__m256d)(x)))
+#define VEC_LOAD(p) ((v4d)_mm256_loadu_pd(p))
+#define VEC_STORE(p, x) _mm256_storeu_pd(p, (__m256d)(x))
+// GCC can tail-call the scalar code with the upper halves of the ymm
+// registers still dirty, which slows down every SSE instruction after it
+#define VEC_TAIL(name, a, n)                                                   \
+    do {                                                                       \
+        _mm256_zeroupper();                                                    \
+        scalar_##name(a, n);                                                   \
+    } while (0)
+#define VEC_TAIL2(name, a, b, n)                                               \
+    do {                                                                       \
+        _mm256_zeroupper();                                                    \
+        scalar_##name(a, b, n);                                                \
+    } while (0)
+#include "vecmath_lanes.h"
+
+// Picks the widest kernels the CPU supports before main() runs, like
+// batch_init.
+__attribute__((constructor)) void vecmath_init(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        VecMathKernels avx2 = {"avx2",    avx2_sin,  avx2_cos, avx2_tan,
+                               avx2_asin, avx2_acos, avx2_atan, avx2_ln,
+                               avx2_log,  avx2_exp,  avx2_rootn};
+        vecmath_kernels = avx2;
+    } else {
+        VecMathKernels sse2 = {"sse2",    sse2_sin,  sse2_cos, sse2_tan,
+                               sse2_asin, sse2_acos, sse2_atan, sse2_ln,
+                               sse2_log,  sse2_exp,  sse2_rootn};
+        vecmath_kernels = sse2;
+    }
+}
+#else
+void vecmath_init(void) {}
+#endif
@@ -0,0 +1,61 @@
+#ifndef VECMATH_H
+#define VECMATH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VECMATH_TRIG_MAX 134217728.0 // 2^27, larger |x| use libm
+#define VECMATH_EXP_MAX 708.0        // |exponent| that keeps 2^k normal
+
+// Vectorized builtins over arrays of doubles, in place: a[k] = f(a[k]) for
+// k < n. Every kernel computes each lane with the same operations at every
+// vector width, so results do not depend on the CPU. Lanes outside a
+// kernel's domain (NaN, infinities, subnormals, |x| > VECMATH_TRIG_MAX or
+// within 2^-44 of a nonzero multiple of pi/2 for sin, cos and tan, results
+// past VECMATH_EXP_MAX for exp and rootn) are computed with libm instead.
+//
+// Largest error in ULP against glibc, as measured by bin/bench over dense
+// sweeps of each domain and, for sin, cos and tan, of the doubles around
+// multiples of pi/2 (see bench_math):
+//   sin, cos      1      fdlibm's kernels after a compensated Cody-Waite
+//                        reduction
+//   tan           2      sin / cos from the same kernels
+//   asin, acos    1      fdlibm's rational approximations
+//   atan          1      fdlibm's reduction to |x| < 7/16
+//   ln            1      fdlibm's log
+//   log           2      ln(x) / ln(10), like the builtin
+//   exp           1      e(x) = M_E^x, with ln(M_E) in double-double
+//   rootn         1      x^(1/n) from ln(x) in double-double
+// sqrt is correctly rounded by the hardware, see batch_kernels.
+typedef void vecmath_unary_fn(double *a, size_t n);
+typedef void vecmath_binary_fn(double *a, const double *b, size_t n);
+
+// The scalar kernels are always available; on x86-64 Linux they are
+// replaced at startup with SSE2 or AVX2 versions depending on the CPU.
+typedef struct {
+    const char *name;
+    vecmath_unary_fn *sin;
+    vecmath_unary_fn *cos;
+    vecmath_unary_fn *tan;
+    vecmath_unary_fn *asin;
+    vecmath_unary_fn *acos;
+    vecmath_unary_fn *atan;
+    vecmath_unary_fn *ln;
+    vecmath_unary_fn *log; // base 10
+    vecmath_unary_fn *exp; // M_E^x, like the e() builtin
+    vecmath_binary_fn *rootn; // a[k] = a[k]^(1 / b[k])
+} VecMathKernels;
+
+extern VecMathKernels vecmath_kernels;
+
+void vecmath_init(void);
+
+// The builtins as libm computes them, for the lanes the kernels leave to
+// libm and as the reference they are measured against.
+double vecmath_ref_log(double x);
+double vecmath_ref_exp(double x);
+double vecmath_ref_rootn(double x, double n);
+uint64_t vecmath_bits(double x);
+double vecmath_double(uint64_t u);
+
+#endif
@@ -0,0 +1,449 @@
+// Kernels of vecmath.c for one vector width. vecmath.c includes this once
+// per width after defining:
+//   VEC_WIDTH           lanes per vector
+//   VEC_NAME(name)      name of this width's version of a function
+//   VEC_TARGET          function attributes, e.g. the target ISA
+//   VD, VI, VU          vectors of double, of lane masks and of bits
+//   VEC_BITS, VEC_DOUBLE  reinterpret VD as VU and back
+//   VEC_SELECT(m, a, b) a in the lanes where mask m is set, else b
+//   VEC_SPLAT(x)        x in every lane
+//   VEC_SQRT, VEC_LOAD, VEC_STORE
+//   VEC_TAIL(name, a, n)  the last n < VEC_WIDTH values, or nothing
+// Every step is a plain double operation on each lane, never fused, so all
+// widths give the same results as the scalar one.
+
+VEC_TARGET void VEC_NAME(two_sum)(VD a, VD b, VD *hi, VD *lo) {
+    // Knuth: hi + lo = a + b exactly
+    VD s = a + b;
+    VD bb = s - a;
+    *lo = (a - (s - bb)) + (b - bb);
+    *hi = s;
+}
+
+VEC_TARGET void VEC_NAME(two_product)(VD a, VD b, VD *hi, VD *lo) {
+    // Dekker: hi + lo = a * b exactly, for |a|, |b| < VECMATH_SPLIT_MAX
+    VD c = a * VECMATH_SPLITTER;
+    VD a_hi = c - (c - a);
+    VD a_lo = a - a_hi;
+    c = b * VECMATH_SPLITTER;
+    VD b_hi = c - (c - b);
+    VD b_lo = b - b_hi;
+    VD p = a * b;
+    *lo = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+    *hi = p;
+}
+
+VEC_TARGET VD VEC_NAME(fabs)(VD x) {
+    return VEC_DOUBLE(VEC_BITS(x) & ~VECMATH_SIGN);
+}
+
+// Sets the lanes of a where ok is clear to fn of the same lane of x.
+VEC_TARGET void VEC_NAME(fix_lanes)(double *a, VD x, VI ok,
+                                    double (*fn)(double)) {
+    long lanes[VEC_WIDTH];
+    memcpy(lanes, &ok, sizeof(lanes));
+    for (int j = 0; j < VEC_WIDTH; j++) {
+        if (!lanes[j]) {
+            double xs[VEC_WIDTH];
+            memcpy(xs, &x, sizeof(xs));
+            a[j] = fn(xs[j]);
+        }
+    }
+}
+
+VEC_TARGET void VEC_NAME(fix_lanes2)(double *a, VD x, VD y, VI ok,
+                                     double (*fn)(double, double)) {
+    long lanes[VEC_WIDTH];
+    memcpy(lanes, &ok, sizeof(lanes));
+    for (int j = 0; j < VEC_WIDTH; j++) {
+        if (!lanes[j]) {
+            double xs[VEC_WIDTH];
+            double ys[VEC_WIDTH];
+            memcpy(xs, &x, sizeof(xs));
+            memcpy(ys, &y, sizeof(ys));
+            a[j] = fn(xs[j], ys[j]);
+        }
+    }
+}
+
+// x = n pi/2 + hi + lo with |hi + lo| about pi/4 at most, for
+// |x| <= VECMATH_TRIG_MAX. The first three parts of pi/2 have 25 bits, so n
+// times them is exact (Cody and Waite), and each is subtracted with
+// two_sum so the bits that cancel near a multiple of pi/2 are kept, like
+// the tail compensation of fdlibm's medium-size reduction. What is left,
+// n times the last part rounded and the part of pi/2 past it, is under
+// 2^-105. Returns bits whose low two are n mod 4.
+VEC_TARGET VU VEC_NAME(trig_reduce)(VD x, VD *hi, VD *lo) {
+    VD nd = x * VECMATH_TWO_OVER_PI + VECMATH_SHIFT;
+    VD n = nd - VECMATH_SHIFT;
+    VD r;
+    VD e;
+    VD e2;
+    VD e3;
+    VEC_NAME(two_sum)(x - n * VECMATH_PIO2_1, -(n * VECMATH_PIO2_2), &r, &e);
+    VEC_NAME(two_sum)(r, -(n * VECMATH_PIO2_3), &r, &e2);
+    VEC_NAME(two_sum)(r, -(n * VECMATH_PIO2_4), &r, &e3);
+    e = e + (e2 + e3);
+    *hi = r + e;
+    *lo = (r - *hi) + e;
+    return VEC_BITS(nd);
+}
+
+// Lanes whose reduction trig_reduce gets right to well under an ULP: |x|
+// up to VECMATH_TRIG_MAX, and a remainder hi that is either x itself or
+// not so close to zero that the 2^-105 left over shows. x that close to a
+// multiple of pi/2 is rare, and left to libm.
+VEC_TARGET VI VEC_NAME(trig_ok)(VD x, VD hi) {
+    return (VEC_NAME(fabs)(x) <= VECMATH_TRIG_MAX) &
+           ((VEC_NAME(fabs)(hi) >= VECMATH_TRIG_TINY) | (hi == x));
+}
+
+// sin(x + y) for |x| <= pi/4, fdlibm's __kernel_sin
+VEC_TARGET VD VEC_NAME(sin_kernel)(VD x, VD y) {
+    VD z = x * x;
+    VD v = z * x;
+    VD r = VECMATH_S2 +
+           z * (VECMATH_S3 + z * (VECMATH_S4 + z * (VECMATH_S5 +
+                                                    z * VECMATH_S6)));
+    return x - ((z * (0.5 * y - v * r) - y) - v * VECMATH_S1);
+}
+
+// cos(x + y) for |x| <= pi/4, fdlibm's __kernel_cos
+VEC_TARGET VD VEC_NAME(cos_kernel)(VD x, VD y) {
+    VD z = x * x;
+    VD w = z * z;
+    VD r = z * (VECMATH_C1 + z * (VECMATH_C2 + z * VECMATH_C3)) +
+           w * w * (VECMATH_C4 + z * (VECMATH_C5 + z * VECMATH_C6));
+    VD hz = 0.5 * z;
+    w = 1.0 - hz;
+    return w + (((1.0 - w) - hz) + (z * r - x * y));
+}
+
+// e^(hi + lo) for |hi| <= VECMATH_EXP_MAX and |lo| much smaller, fdlibm's
+// exp: k = round(hi / ln 2), r = hi + lo - k ln 2 and
+// e^r = 1 + r + r c / (2 - c), scaled by 2^k.
+VEC_TARGET VD VEC_NAME(exp_dd)(VD hi, VD lo) {
+    VD kd = hi * VECMATH_INV_LN2 + VECMATH_SHIFT;
+    VD k = kd - VECMATH_SHIFT;
+    VD r_hi = hi - k * VECMATH_LN2_HI; // exact
+    VD r_lo = k * VECMATH_LN2_LO - lo;
+    VD r = r_hi - r_lo;
+    VD t = r * r;
+    VD c = r - t * (VECMATH_P1 +
+                    t * (VECMATH_P2 +
+                         t * (VECMATH_P3 + t * (VECMATH_P4 + t * VECMATH_P5))));
+    VD y = 1.0 - ((r_lo - (r * c) / (2.0 - c)) - r_hi);
+    // the low bits of kd hold k, so this is the exponent field of 2^k
+    return y * VEC_DOUBLE((VEC_BITS(kd) + 1023) << 52);
+}
+
+// x = 2^k (1 + f) with 1 + f in [sqrt(2)/2, sqrt(2)), for x in
+// [DBL_MIN, DBL_MAX].
+VEC_TARGET void VEC_NAME(ln_reduce)(VD x, VD *k, VD *f) {
+    VU ix = VEC_BITS(x);
+    VU tmp = ix - VECMATH_LN_OFFSET;
+    VU biased = (tmp + VECMATH_EXPONENT_BIAS) >> 52; // k + 1023
+    *k = VEC_DOUBLE(biased | VECMATH_SHIFT52_BITS) -
+         (VECMATH_SHIFT52 + 1023.0);
+    *f = VEC_DOUBLE(ix - (tmp & VECMATH_EXPONENT_MASK)) - 1.0;
+}
+
+// ln x for x in [DBL_MIN, DBL_MAX], fdlibm's log with s = f / (2 + f)
+VEC_TARGET VD VEC_NAME(ln_normal)(VD x) {
+    VD k;
+    VD f;
+    VEC_NAME(ln_reduce)(x, &k, &f);
+    VD hfsq = 0.5 * f * f;
+    VD s = f / (2.0 + f);
+    VD z = s * s;
+    VD w = z * z;
+    VD t1 = w * (VECMATH_LG2 + w * (VECMATH_LG4 + w * VECMATH_LG6));
+    VD t2 = z * (VECMATH_LG1 +
+                 w * (VECMATH_LG3 + w * (VECMATH_LG5 + w * VECMATH_LG7)));
+    VD r = t2 + t1;
+    return s * (hfsq + r) + k * VECMATH_LN2_LO - hfsq + f + k * VECMATH_LN2_HI;
+}
+
+// ln x = hi + lo to about 2^-70, for x in [DBL_MIN, DBL_MAX]:
+// ln(1 + f) = 2 atanh(s) = 2s + 2s^3/3 + 2s^5/5 + ..., with s and the
+// first two terms in double-double and the rest, under 2^-12 of the
+// total, in double.
+VEC_TARGET void VEC_NAME(ln_dd)(VD x, VD *hi, VD *lo) {
+    VD k;
+    VD f;
+    VEC_NAME(ln_reduce)(x, &k, &f);
+    VD d_hi = 2.0 + f;
+    VD d_lo = f - (d_hi - 2.0);
+    VD s = f / d_hi;
+    VD p_hi;
+    VD p_lo;
+    VEC_NAME(two_product)(s, d_hi, &p_hi, &p_lo);
+    VD s_lo = (((f - p_hi) - p_lo) - s * d_lo) / d_hi;
+    VD q_hi; // s^2
+    VD q_lo;
+    VEC_NAME(two_product)(s, s, &q_hi, &q_lo);
+    q_lo = q_lo + 2.0 * s * s_lo;
+    VD c_hi; // s^3
+    VD c_lo;
+    VEC_NAME(two_product)(q_hi, s, &c_hi, &c_lo);
+    c_lo = c_lo + (q_lo * s + q_hi * s_lo);
+    VD t_hi; // 2s^3/3
+    VD t_lo;
+    VEC_NAME(two_product)(c_hi, VEC_SPLAT(VECMATH_TWO_THIRDS_HI), &t_hi,
+                          &t_lo);
+    t_lo = t_lo + (c_hi * VECMATH_TWO_THIRDS_LO + c_lo * VECMATH_TWO_THIRDS_HI);
+    VD z = q_hi;
+    VD tail =
+        c_hi * z *
+        (2.0 / 5 +
+         z * (2.0 / 7 +
+              z * (2.0 / 9 +
+                   z * (2.0 / 11 +
+                        z * (2.0 / 13 +
+                             z * (2.0 / 15 +
+                                  z * (2.0 / 17 +
+                                       z * (2.0 / 19 +
+                                            z * (2.0 / 21 +
+                                                 z * (2.0 / 23 +
+                                                      z * (2.0 / 25)))))))))));
+    VD h;
+    VD e;
+    VEC_NAME(two_sum)(2.0 * s, t_hi, &h, &e);
+    e = e + (2.0 * s_lo + t_lo + tail);
+    VD g;
+    VEC_NAME(two_sum)(k * VECMATH_LN2_HI, h, &h, &g);
+    e = g + e + k * VECMATH_LN2_LO;
+    *hi = h + e;
+    *lo = (h - *hi) + e;
+}
+
+// p(t) / q(t) with asin(x) = x + x p(x^2) / q(x^2), fdlibm's asin and acos
+VEC_TARGET VD VEC_NAME(asin_rational)(VD t) {
+    VD p = t * (VECMATH_PS0 +
+                t * (VECMATH_PS1 +
+                     t * (VECMATH_PS2 +
+                          t * (VECMATH_PS3 +
+                               t * (VECMATH_PS4 + t * VECMATH_PS5)))));
+    VD q = 1.0 + t * (VECMATH_QS1 +
+                      t * (VECMATH_QS2 + t * (VECMATH_QS3 + t * VECMATH_QS4)));
+    return p / q;
+}
+
+// The high 32 bits of x, for fdlibm's exact s^2 in asin and acos.
+VEC_TARGET VD VEC_NAME(high_word)(VD x) {
+    return VEC_DOUBLE(VEC_BITS(x) & VECMATH_HIGH_WORD);
+}
+
+VEC_TARGET void VEC_NAME(sin)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD hi;
+        VD lo;
+        VU q = VEC_NAME(trig_reduce)(x, &hi, &lo);
+        VD s = VEC_NAME(sin_kernel)(hi, lo);
+        VD c = VEC_NAME(cos_kernel)(hi, lo);
+        VD r = VEC_SELECT((q & 1) != 0, c, s);
+        r = VEC_SELECT((q & 2) != 0, -r, r);
+        VEC_STORE(a + k, VEC_SELECT(x == 0.0, x, r)); // sin(-0) is -0
+        VEC_NAME(fix_lanes)(a + k, x, VEC_NAME(trig_ok)(x, hi), sin);
+    }
+    VEC_TAIL(sin, a + k, n - k);
+}
+
+VEC_TARGET void VEC_NAME(cos)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD hi;
+        VD lo;
+        VU q = VEC_NAME(trig_reduce)(x, &hi, &lo);
+        VD s = VEC_NAME(sin_kernel)(hi, lo);
+        VD c = VEC_NAME(cos_kernel)(hi, lo);
+        VD r = VEC_SELECT((q & 1) != 0, s, c);
+        r = VEC_SELECT(((q + 1) & 2) != 0, -r, r);
+        VEC_STORE(a + k, r);
+        VEC_NAME(fix_lanes)(a + k, x, VEC_NAME(trig_ok)(x, hi), cos);
+    }
+    VEC_TAIL(cos, a + k, n - k);
+}
+
+VEC_TARGET void VEC_NAME(tan)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD hi;
+        VD lo;
+        VU q = VEC_NAME(trig_reduce)(x, &hi, &lo);
+        VD s = VEC_NAME(sin_kernel)(hi, lo);
+        VD c = VEC_NAME(cos_kernel)(hi, lo);
+        VI odd = (q & 1) != 0; // tan(x + pi/2) = -cos(x) / sin(x)
+        VD r = VEC_SELECT(odd, c, s) / VEC_SELECT(odd, s, c);
+        r = VEC_SELECT(odd, -r, r);
+        VEC_STORE(a + k, VEC_SELECT(x == 0.0, x, r)); // tan(-0) is -0
+        VEC_NAME(fix_lanes)(a + k, x, VEC_NAME(trig_ok)(x, hi), tan);
+    }
+    VEC_TAIL(tan, a + k, n - k);
+}
+
+// NaN and |x| > 1 come out as NaN from the square root.
+VEC_TARGET void VEC_NAME(asin)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD ax = VEC_NAME(fabs)(x);
+        VI small = ax < 0.5;
+        VD t = VEC_SELECT(small, x * x, (1.0 - ax) * 0.5);
+        VD r = VEC_NAME(asin_rational)(t);
+        VD s = VEC_SQRT(t);
+        // 0.5 <= |x| < 0.975, with s^2 split to keep the last bits
+        VD df = VEC_NAME(high_word)(s);
+        VD c = (t - df * df) / (s + df);
+        VD p = 2.0 * s * r - (VECMATH_PIO2_LO - 2.0 * c);
+        VD q = VECMATH_PIO4_HI - 2.0 * df;
+        VD large = VECMATH_PIO4_HI - (p - q);
+        // |x| >= 0.975
+        large = VEC_SELECT(ax >= VECMATH_ASIN_NEAR_ONE,
+                           VECMATH_PIO2_HI -
+                               (2.0 * (s + s * r) - VECMATH_PIO2_LO),
+                           large);
+        large = VEC_DOUBLE(VEC_BITS(large) | (VEC_BITS(x) & VECMATH_SIGN));
+        VEC_STORE(a + k, VEC_SELECT(small, x + x * r, large));
+    }
+    VEC_TAIL(asin, a + k, n - k);
+}
+
+VEC_TARGET void VEC_NAME(acos)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD ax = VEC_NAME(fabs)(x);
+        VI small = ax < 0.5;
+        VD z = VEC_SELECT(small, x * x, (1.0 - ax) * 0.5);
+        VD r = VEC_NAME(asin_rational)(z);
+        VD s = VEC_SQRT(z);
+        // x > 0.5; at x = 1, s and df are 0
+        VD df = VEC_NAME(high_word)(s);
+        VD c = VEC_SELECT(z > 0.0, (z - df * df) / (s + df), VEC_SPLAT(0.0));
+        VD large = 2.0 * (df + (r * s + c));
+        // x < -0.5
+        large = VEC_SELECT(x < 0.0,
+                           VECMATH_PI - 2.0 * (s + (r * s - VECMATH_PIO2_LO)),
+                           large);
+        VEC_STORE(a + k,
+                  VEC_SELECT(small,
+                             VECMATH_PIO2_HI -
+                                 (x - (VECMATH_PIO2_LO - x * r)),
+                             large));
+    }
+    VEC_TAIL(acos, a + k, n - k);
+}
+
+// |x| is reduced to [0, 7/16) with atan(x) = atan(c) + atan(y) for the
+// nearest of c = 1/2, 1, 3/2 or infinity.
+VEC_TARGET void VEC_NAME(atan)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD ax = VEC_NAME(fabs)(x);
+        VD num = ax;
+        VD den = VEC_SPLAT(1.0);
+        VD hi = VEC_SPLAT(0.0);
+        VD lo = hi;
+        VI in = ax >= 0.4375;
+        num = VEC_SELECT(in, 2.0 * ax - 1.0, num);
+        den = VEC_SELECT(in, 2.0 + ax, den);
+        hi = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_HI0), hi);
+        lo = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_LO0), lo);
+        in = ax >= 0.6875;
+        num = VEC_SELECT(in, ax - 1.0, num);
+        den = VEC_SELECT(in, ax + 1.0, den);
+        hi = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_HI1), hi);
+        lo = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_LO1), lo);
+        in = ax >= 1.1875;
+        num = VEC_SELECT(in, ax - 1.5, num);
+        den = VEC_SELECT(in, 1.0 + 1.5 * ax, den);
+        hi = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_HI2), hi);
+        lo = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_LO2), lo);
+        in = ax >= 2.4375;
+        num = VEC_SELECT(in, VEC_SPLAT(-1.0), num);
+        den = VEC_SELECT(in, ax, den);
+        hi = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_HI3), hi);
+        lo = VEC_SELECT(in, VEC_SPLAT(VECMATH_ATAN_LO3), lo);
+        VD y = num / den;
+        VD z = y * y;
+        VD w = z * z;
+        VD s1 = z * (VECMATH_AT0 +
+                     w * (VECMATH_AT2 +
+                          w * (VECMATH_AT4 +
+                               w * (VECMATH_AT6 +
+                                    w * (VECMATH_AT8 + w * VECMATH_AT10)))));
+        VD s2 = w * (VECMATH_AT1 +
+                     w * (VECMATH_AT3 +
+                          w * (VECMATH_AT5 +
+                               w * (VECMATH_AT7 + w * VECMATH_AT9))));
+        VD r = hi - ((y * (s1 + s2) - lo) - y);
+        r = VEC_DOUBLE(VEC_BITS(r) | (VEC_BITS(x) & VECMATH_SIGN));
+        VEC_STORE(a + k, r);
+    }
+    VEC_TAIL(atan, a + k, n - k);
+}
+
+VEC_TARGET void VEC_NAME(ln)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VEC_STORE(a + k, VEC_NAME(ln_normal)(x));
+        VEC_NAME(fix_lanes)(a + k, x, (x >= DBL_MIN) & (x <= DBL_MAX), log);
+    }
+    VEC_TAIL(ln, a + k, n - k);
+}
+
+VEC_TARGET void VEC_NAME(log)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VEC_STORE(a + k, VEC_NAME(ln_normal)(x) / VECMATH_LN10);
+        VEC_NAME(fix_lanes)(a + k, x, (x >= DBL_MIN) & (x <= DBL_MAX),
+                            vecmath_ref_log);
+    }
+    VEC_TAIL(log, a + k, n - k);
+}
+
+// M_E^x = e^(x ln M_E), and ln M_E is 1 + VECMATH_LN_E_LO.
+VEC_TARGET void VEC_NAME(exp)(double *a, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VEC_STORE(a + k, VEC_NAME(exp_dd)(x, x * VECMATH_LN_E_LO));
+        VEC_NAME(fix_lanes)(a + k, x, VEC_NAME(fabs)(x) <= VECMATH_EXP_MAX,
+                            vecmath_ref_exp);
+    }
+    VEC_TAIL(exp, a + k, n - k);
+}
+
+// x^y = e^(y ln x) for x > 0, with y ln x in double-double so that the
+// error does not grow with the result.
+VEC_TARGET void VEC_NAME(rootn)(double *a, const double *b, size_t n) {
+    size_t k = 0;
+    for (; k + VEC_WIDTH <= n; k += VEC_WIDTH) {
+        VD x = VEC_LOAD(a + k);
+        VD m = VEC_LOAD(b + k);
+        VD y = 1.0 / m;
+        VD hi;
+        VD lo;
+        VEC_NAME(ln_dd)(x, &hi, &lo);
+        VD z_hi;
+        VD z_lo;
+        VEC_NAME(two_product)(y, hi, &z_hi, &z_lo);
+        z_lo = z_lo + y * lo;
+        VEC_STORE(a + k, VEC_NAME(exp_dd)(z_hi, z_lo));
+        VEC_NAME(fix_lanes2)(
+            a + k, x, m,
+            (x >= DBL_MIN) & (x <= DBL_MAX) &
+                (VEC_NAME(fabs)(y) <= VECMATH_SPLIT_MAX) &
+                (VEC_NAME(fabs)(z_hi) <= VECMATH_EXP_MAX),
+            vecmath_ref_rootn);
+    }
+    VEC_TAIL2(rootn, a + k, b + k, n - k);
+}
@@ -0,0 +1,245 @@
+#include "vm.h"
+#include "batch.h"
+#include "closedform.h"
+#include "compiler.h"
+#include "evaluator.h"
+#include "jit.h"
+#include "parallel.h"
+#include "stats.h"
+#include "util.h"
+#include <math.h>
+#include <stdlib.h>
+
+#if VM_COMPUTED_GOTO
+#define TARGET(op) TARGET_##op:
+#define DISPATCH() goto *dispatch_table[ip->op]
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+#endif
+
+double vm_run(Program *prog, double env_vars[NUM_ENV_VARS]) {
+    assertNotNull(prog);
+    double small[VM_STACK_SIZE];
+    double *stack = small;
+    if (prog->max_stack > VM_STACK_SIZE) {
+        stack = (double *)malloc(prog->max_stack * sizeof(double));
+        assertNotNull(stack);
+    }
+    double small_temps[VM_TEMPS_SIZE];
+    double *temps = small_temps;
+    if (prog->num_temps > VM_TEMPS_SIZE) {
+        temps = (double *)malloc(prog->num_temps * sizeof(double));
+        assertNotNull(temps);
+    }
+    double *sp = stack; // next free slot
+    const Instruction *ip = prog->code;
+    double result;
+
+#if VM_COMPUTED_GOTO
+    static void *dispatch_table[NUM_OPCODES] = {
+        &&TARGET_OP_CONST, &&TARGET_OP_LOAD, &&TARGET_OP_STORE,
+        &&TARGET_OP_TEE,   &&TARGET_OP_TEMP, &&TARGET_OP_NEG,
+        &&TARGET_OP_ADD,   &&TARGET_OP_SUB,
+        &&TARGET_OP_MUL,   &&TARGET_OP_DIV,  &&TARGET_OP_POW,
+        &&TARGET_OP_SQRT,  &&TARGET_OP_ROOTN, &&TARGET_OP_LOG,
+        &&TARGET_OP_LOGN,  &&TARGET_OP_LN,   &&TARGET_OP_SIN,
+        &&TARGET_OP_COS,   &&TARGET_OP_TAN,  &&TARGET_OP_ASIN,
+        &&TARGET_OP_ACOS,  &&TARGET_OP_ATAN, &&TARGET_OP_EXP,
+        &&TARGET_OP_SUM,   &&TARGET_OP_RETURN};
+    DISPATCH();
+#else
+    for (;;)
+        switch (ip->op) {
+#endif
+
+    TARGET(OP_CONST) {
+        *sp++ = prog->constants[ip->arg];
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_LOAD) {
+        *sp++ = env_vars[ip->arg];
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_STORE) {
+        env_vars[ip->arg] = *--sp;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_TEE) {
+        temps[ip->arg] = sp[-1];
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_TEMP) {
+        *sp++ = temps[ip->arg];
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_NEG) {
+        sp[-1] = -sp[-1];
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_ADD) {
+        sp[-2] = sp[-2] + sp[-1];
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_SUB) {
+        sp[-2] = sp[-2] - sp[-1];
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_MUL) {
+        sp[-2] = sp[-2] * sp[-1];
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_DIV) {
+        sp[-2] = sp[-2] / sp[-1];
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_POW) {
+        sp[-2] = pow(sp[-2], sp[-1]);
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_SQRT) {
+        sp[-1] = sqrt(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_ROOTN) {
+        sp[-2] = pow(sp[-2], 1 / sp[-1]);
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_LOG) {
+        sp[-1] = log(sp[-1]) / log(10);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_LOGN) {
+        sp[-2] = log(sp[-2]) / log(sp[-1]);
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_LN) {
+        sp[-1] = log(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_SIN) {
+        sp[-1] = sin(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_COS) {
+        sp[-1] = cos(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_TAN) {
+        sp[-1] = tan(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_ASIN) {
+        sp[-1] = asin(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_ACOS) {
+        sp[-1] = acos(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_ATAN) {
+        sp[-1] = atan(sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_EXP) {
+        sp[-1] = pow(M_E, sp[-1]);
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_SUM) {
+        sp[-2] = vm_sum(prog->bodies[ip->arg], sp[-2], sp[-1], env_vars);
+        sp--;
+        ip++;
+        DISPATCH();
+    }
+    TARGET(OP_RETURN) {
+        result = sp[-1];
+        goto done;
+    }
+
+#if !VM_COMPUTED_GOTO
+        default:
+            result = 0.0;
+            goto done;
+        }
+#endif
+
+done:
+    if (stack != small) {
+        free(stack);
+    }
+    if (temps != small_temps) {
+        free(temps);
+    }
+    return result;
+}
+
+double vm_sum(Program *body, double start, double end,
+              double env_vars[NUM_ENV_VARS]) {
+    assertNotNull(body);
+    long long first = sum_bound(start);
+    long long last = sum_bound(end);
+    ClosedForm *f = body->closed_form;
+    if (f != NULL && !closed_form_checks(first, last)) {
+        return closed_form_sum(f, first, last);
+    }
+    STATS_COUNT(COUNTER_ITERATIONS, last >= first ? last - first + 1 : 0);
+    range_sum_fn *fn = vm_range_sum;
+    if (jit_options.threshold >= 0 && last - first + 1 >= BATCH_SIZE &&
+        last - first + 1 >= jit_options.threshold && jit_ready(body)) {
+        fn = jit_range_sum;
+    }
+    double x = parallel_sum(fn, body, first, last, env_vars, body->env_size);
+    if (f != NULL) {
+        return closed_form_check(f, first, last,
+                                 closed_form_sum(f, first, last), x);
+    }
+    return x;
+}
+
+// Serial sum of one range, run by parallel_sum for the whole range or for
+// each of its chunks.
+double vm_range_sum(void *ctx, long long first, long long last,
+                    double *env_vars) {
+    Program *body = (Program *)ctx;
+    if (body->batchable && last - first + 1 >= BATCH_SIZE) {
+        return batch_sum(body, first, last, env_vars);
+    }
+    double x = 0;
+    double saved_i = env_vars[ENV_I];
+    for (long long i = first; i <= last; i++) {
+        env_vars[ENV_I] = (double)i;
+        x += vm_run(body, env_vars);
+    }
+    env_vars[ENV_I] = saved_i;
+    return x;
+}
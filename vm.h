@@ -0,0 +1,24 @@
+#ifndef VM_H
+#define VM_H
+
+#include "compiler.h"
+#include "evaluator.h"
+
+#define VM_STACK_SIZE 64
+#define VM_TEMPS_SIZE 16
+
+// Computed goto dispatch where the compiler supports labels as values,
+// a plain switch everywhere else.
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+double vm_run(Program *prog, double env_vars[NUM_ENV_VARS]);
+double vm_sum(Program *body, double start, double end,
+              double env_vars[NUM_ENV_VARS]);
+double vm_range_sum(void *ctx, long long first, long long last,
+                    double *env_vars);
+
+#endif